@@ -21,33 +21,140 @@ KernelHandler::KernelHandler(Real radius)
 void KernelHandler::set_neighbor_search_radius(Real radius)
 {
 	neighbor_search_radius = radius;
+
+	if (lookup_table)
+	{
+		m4_table.set_neighbor_search_radius(radius);
+		m5_table.set_neighbor_search_radius(radius);
+		m6_table.set_neighbor_search_radius(radius);
+		wendland_table.set_neighbor_search_radius(radius);
+	}
 }
 
-Real KernelHandler::compute_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle, int kernel_type )
+void KernelHandler::use_lookup_table(bool enable, size_t table_size)
 {
+	lookup_table = enable;
+
+	m4_table.set_table_size(table_size);
+	m5_table.set_table_size(table_size);
+	m6_table.set_table_size(table_size);
+	wendland_table.set_table_size(table_size);
+
+	set_neighbor_search_radius(neighbor_search_radius);
+}
+
+template <template <int> class Shape, int Dim>
+Real KernelHandler::compute_kernel_in_dimension( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle )
+{
+	typedef typename SPHKernel<Shape, Dim>::VectorD VectorD;
+	SPHKernel<Shape, Dim> kernel(neighbor_search_radius);
+	return kernel.compute_kernel( VectorD(source_particle), VectorD(destination_particle) );
+}
+
+template <template <int> class Shape, int Dim>
+RealVectorX KernelHandler::gradient_of_kernel_in_dimension( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle )
+{
+	typedef typename SPHKernel<Shape, Dim>::VectorD VectorD;
+	SPHKernel<Shape, Dim> kernel(neighbor_search_radius);
+	return kernel.gradient_of_kernel( VectorD(source_particle), VectorD(destination_particle) );
+}
+
+template <template <int> class Shape>
+Real KernelHandler::compute_kernel_of_type( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle )
+{
+	switch (source_particle.size()) {
+	case 1:
+		return compute_kernel_in_dimension<Shape, 1>(source_particle, destination_particle);
+	case 2:
+		return compute_kernel_in_dimension<Shape, 2>(source_particle, destination_particle);
+	case 3:
+		return compute_kernel_in_dimension<Shape, 3>(source_particle, destination_particle);
+	default:
+		throw "Invalid number of dimension";
+	}
+}
+
+template <template <int> class Shape>
+RealVectorX KernelHandler::gradient_of_kernel_of_type( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle )
+{
+	switch (source_particle.size()) {
+	case 1:
+		return gradient_of_kernel_in_dimension<Shape, 1>(source_particle, destination_particle);
+	case 2:
+		return gradient_of_kernel_in_dimension<Shape, 2>(source_particle, destination_particle);
+	case 3:
+		return gradient_of_kernel_in_dimension<Shape, 3>(source_particle, destination_particle);
+	default:
+		throw "Invalid number of dimension";
+	}
+}
+
+Real KernelHandler::compute_kernel( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle, int kernel_type )
+{
+	if (use_table_for(source_particle))
+	{
+		RealVector3 s(source_particle);
+		RealVector3 d(destination_particle);
+
+		switch (kernel_type) {
+		case M4:
+			return m4_table.compute_kernel(s, d);
+		case M5:
+			return m5_table.compute_kernel(s, d);
+		case M6:
+			return m6_table.compute_kernel(s, d);
+		case WENDLAND_C2:
+			return wendland_table.compute_kernel(s, d);
+		default:
+			throw "Invalid kernel type!";
+		}
+	}
+
 	switch (kernel_type) {
-	case 4:
-		return compute_M4_kernel(source_particle, destination_particle);
-	case 5:
-		return compute_M5_kernel(source_particle, destination_particle);
-	case 6:
-		return compute_M6_kernel(source_particle, destination_particle);
+	case M4:
+		return compute_kernel_of_type<M4Shape>(source_particle, destination_particle);
+	case M5:
+		return compute_kernel_of_type<M5Shape>(source_particle, destination_particle);
+	case M6:
+		return compute_kernel_of_type<M6Shape>(source_particle, destination_particle);
+	case WENDLAND_C2:
+		return compute_kernel_of_type<WendlandC2Shape>(source_particle, destination_particle);
 	default:
 		throw "Invalid kernel type!";
 	}
 }
 
-RealVectorX KernelHandler::gradient_of_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle, int kernel_type, bool analytical_solution )
+RealVectorX KernelHandler::gradient_of_kernel( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle, int kernel_type, bool analytical_solution )
 {
-	if (analytical_solution)
+	if (analytical_solution && use_table_for(source_particle))
+	{
+		RealVector3 s(source_particle);
+		RealVector3 d(destination_particle);
+
+		switch (kernel_type) {
+		case M4:
+			return m4_table.gradient_of_kernel(s, d);
+		case M5:
+			return m5_table.gradient_of_kernel(s, d);
+		case M6:
+			return m6_table.gradient_of_kernel(s, d);
+		case WENDLAND_C2:
+			return wendland_table.gradient_of_kernel(s, d);
+		default:
+			throw "Invalid kernel type!";
+		}
+	}
+	else if (analytical_solution)
 	{
 		switch (kernel_type) {
-		case 4:
-			return gradient_of_M4_kernel(source_particle, destination_particle);
-		case 5:
-			return gradient_of_M5_kernel(source_particle, destination_particle);
-		case 6:
-			return gradient_of_M6_kernel(source_particle, destination_particle);
+		case M4:
+			return gradient_of_kernel_of_type<M4Shape>(source_particle, destination_particle);
+		case M5:
+			return gradient_of_kernel_of_type<M5Shape>(source_particle, destination_particle);
+		case M6:
+			return gradient_of_kernel_of_type<M6Shape>(source_particle, destination_particle);
+		case WENDLAND_C2:
+			return gradient_of_kernel_of_type<WendlandC2Shape>(source_particle, destination_particle);
 		default:
 			throw "Invalid kernel type!";
 		}
@@ -73,7 +180,7 @@ RealVectorX KernelHandler::gradient_of_kernel( Eigen::Ref<RealVectorX> source_pa
 	throw "Something wrong in gradient_of_kernel!";
 }
 
-Real KernelHandler::test_gradient( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle, int kernel_type )
+Real KernelHandler::test_gradient( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle, int kernel_type )
 {
 	RealVectorX analytical_solution_of_gradient = gradient_of_kernel(source_particle, destination_particle, kernel_type, true);
 	RealVectorX approximate_solution_of_gradient = gradient_of_kernel(source_particle, destination_particle, kernel_type, false);
@@ -82,227 +189,27 @@ Real KernelHandler::test_gradient( Eigen::Ref<RealVectorX> source_particle, Eige
 	return error_rate;
 }
 
-Real KernelHandler::compute_M4_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle )
-{
-	int number_of_dimension = source_particle.size();
-
-	Real h = neighbor_search_radius / 2.0;
-	Real q = (source_particle - destination_particle).norm() / h;
-
-	Eigen::Vector3d sigma_list(2.0/3.0, 10.0/(7.0*(Real)M_PI), 1.0/(Real)M_PI);
-	Real sigma = sigma_list[number_of_dimension - 1];
-
-	Real W = 0.0;
-	Real inside_w = 0.0;
-
-	if (q >= 1.0 && q < 2.0)
-	{
-		inside_w = 1.0/4.0 * (2.0-q) * (2.0-q) * (2.0-q);
-	}
-	else if (q >= 0.0 && q < 1.0)
-	{
-		inside_w = 1.0/4.0 * (2.0-q) * (2.0-q) * (2.0-q) - (1.0-q) * (1.0-q) * (1.0-q);
-	}
-
-
-	Real h_pow = 1.0;
-	for (int i=0; i<number_of_dimension; ++i)
-		h_pow *= h;
-
-	W = sigma * inside_w * 1.0/h_pow;
-
-	return W;
-}
-
-Real KernelHandler::compute_M5_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle )
-{
-	int number_of_dimension = source_particle.size();
-
-	Real h = neighbor_search_radius / 2.5;
-	Real q = (source_particle - destination_particle).norm() / h;
-
-	Eigen::Vector3d sigma_list(1.0/24.0, 96.0/(1199.0*(Real)M_PI), 1.0/(20.*(Real)M_PI));
-	Real sigma = sigma_list[number_of_dimension - 1];
-
-	Real W = 0.0;
-	Real inside_w = 0.0;
-
-	if (q >= 1.5 && q < 2.5)
-	{
-		inside_w = (2.5-q)*(2.5-q)*(2.5-q)*(2.5-q);
-	}
-	else if (q >= 0.5 && q < 1.5)
-	{
-		inside_w = (2.5-q)*(2.5-q)*(2.5-q)*(2.5-q) - 5.0*(1.5-q)*(1.5-q)*(1.5-q)*(1.5-q);
-	}
-	else if (q >= 0.0 && q < 0.5)
-	{
-		inside_w = (2.5-q)*(2.5-q)*(2.5-q)*(2.5-q) - 5.0*(1.5-q)*(1.5-q)*(1.5-q)*(1.5-q) + 10.0*(0.5-q)*(0.5-q)*(0.5-q)*(0.5-q);
-	}
-
-	Real h_pow = 1.0;
-	for (int i=0; i<number_of_dimension; ++i)
-		h_pow *= h;
-
-	W = sigma * inside_w * 1.0/h_pow;
-	return W;
-}
-
-Real KernelHandler::compute_M6_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle )
-{
-	int number_of_dimension = source_particle.size();
-
-	Real h = neighbor_search_radius / 3.0;
-	Real q = (source_particle - destination_particle).norm() / h;
-
-	Eigen::Vector3d sigma_list(1.0/120.0, 7.0/(478.0*(Real)M_PI), 1.0/(120.*(Real)M_PI));
-	Real sigma = sigma_list[number_of_dimension - 1];
-
-	Real W = 0.0;
-	Real inside_w = 0.0;
-
-	if (q >= 2.0 && q < 3.0)
-	{
-		inside_w = (3.0-q)*(3.0-q)*(3.0-q)*(3.0-q)*(3.0-q);
-	}
-	else if (q >= 1.0 && q < 2.0)
-	{
-		inside_w = (3.0-q)*(3.0-q)*(3.0-q)*(3.0-q)*(3.0-q) - 6.0*(2.0-q)*(2.0-q)*(2.0-q)*(2.0-q)*(2.0-q);
-	}
-	else if (q >= 0.0 && q < 1.0)
-	{
-		inside_w = (3.0-q)*(3.0-q)*(3.0-q)*(3.0-q)*(3.0-q) - 6.0*(2.0-q)*(2.0-q)*(2.0-q)*(2.0-q)*(2.0-q) + 15.0*(1.0-q)*(1.0-q)*(1.0-q)*(1.0-q)*(1.0-q);
-	}
-
-	Real h_pow = 1.0;
-	for (int i=0; i<number_of_dimension; ++i)
-		h_pow *= h;
-
-	W = sigma * inside_w * 1.0/h_pow;
-	return W;
-}
-
-RealVectorX KernelHandler::gradient_of_M4_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle )
-{
-	if ((source_particle-destination_particle).norm() < epsilon)
-		return RealVectorX::Zero(source_particle.size());
-
-	int number_of_dimension = source_particle.size();
-
-	RealVectorX gradient_W_over_x(source_particle.size());
-
-	Eigen::Vector3d sigma_list(2.0/3.0, 10.0/(7.0*(Real)M_PI), 1.0/(Real)M_PI);
-	Real sigma = sigma_list[number_of_dimension - 1];
-
-	Real h = neighbor_search_radius / 2.0;
-	Real q = (source_particle - destination_particle).norm() / h;
-
-	RealVectorX gradient_q_over_x = (source_particle-destination_particle) / (source_particle-destination_particle).norm() / h;
-	Real gradient_w_over_q = 0.0;
-
-	if (q >= 1.0 && q < 2.0)
-	{
-		gradient_w_over_q = sigma * (-3.0/4.0) * (2.0-q) * (2.0-q);
-	}
-	else if (q >= 0.0 && q < 1.0)
-	{
-		gradient_w_over_q = sigma * ( (-3.0/4.0) * (2.0-q) * (2.0-q) + 3.0 * (1.0-q) * (1.0-q));
-	}
-
-	Real h_pow = 1.0;
-	for (int i=0; i<number_of_dimension; ++i)
-		h_pow *= h;
-
-	gradient_W_over_x = gradient_w_over_q * 1.0/h_pow * gradient_q_over_x;
-
-	return gradient_W_over_x;
-}
-
-RealVectorX KernelHandler::gradient_of_M5_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle )
+Real KernelHandler::test_lookup_table( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle, int kernel_type )
 {
-	if ((source_particle-destination_particle).norm() < epsilon)
-		return RealVectorX::Zero(source_particle.size());
-
-	int number_of_dimension = source_particle.size();
-
-	RealVectorX gradient_W_over_x(source_particle.size());
-
-	Eigen::Vector3d sigma_list(1.0/24.0, 96.0/(1199.0*(Real)M_PI), 1.0/(20.*(Real)M_PI));
-	Real sigma = sigma_list[number_of_dimension - 1];
-
-	Real h = neighbor_search_radius / 2.5;
-	Real q = (source_particle - destination_particle).norm() / h;
+	bool was_enabled = lookup_table;
 
-	RealVectorX gradient_q_over_x = (source_particle-destination_particle) / (source_particle-destination_particle).norm() / h;
-	Real gradient_w_over_q = 0.0;
+	if (!was_enabled)
+		use_lookup_table(true);
+	RealVectorX tabulated_gradient = gradient_of_kernel(source_particle, destination_particle, kernel_type, true);
 
-	if (q >= 1.5 && q < 2.5)
-	{
-		gradient_w_over_q = sigma * (-4.0) * (2.5-q) * (2.5-q) * (2.5-q);
-	}
-	else if (q >= 0.5 && q < 1.5)
-	{
-		gradient_w_over_q = sigma * ( (-4.0) * (2.5-q) * (2.5-q) * (2.5-q) + 20.0 * (1.5-q) * (1.5-q) * (1.5-q) );
-	}
-	else if (q >= 0.0 && q < 0.5)
-	{
-		gradient_w_over_q = sigma * ( (-4.0) * (2.5-q) * (2.5-q) * (2.5-q) + 20.0 * (1.5-q) * (1.5-q) * (1.5-q) - 40.0 * (0.5-q) * (0.5-q) * (0.5-q) );
-	}
-
-	Real h_pow = 1.0;
-	for (int i=0; i<number_of_dimension; ++i)
-		h_pow *= h;
-
-	gradient_W_over_x = gradient_w_over_q * 1.0/h_pow * gradient_q_over_x;
-
-	return gradient_W_over_x;
-}
-
-RealVectorX KernelHandler::gradient_of_M6_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle )
-{
-	if ((source_particle-destination_particle).norm() < epsilon)
-		return RealVectorX::Zero(source_particle.size());
-
-	int number_of_dimension = source_particle.size();
-
-	RealVectorX gradient_W_over_x(source_particle.size());
-
-	Eigen::Vector3d sigma_list(1.0/120.0, 7.0/(478.0*(Real)M_PI), 1.0/(120.0*(Real)M_PI));
-	Real sigma = sigma_list[number_of_dimension - 1];
-
-	Real h = neighbor_search_radius / 3.0;
-	Real q = (source_particle - destination_particle).norm() / h;
-
-	RealVectorX gradient_q_over_x = (source_particle-destination_particle) / (source_particle-destination_particle).norm() / h;
-	Real gradient_w_over_q = 0.0;
-
-	if (q >= 2.0 && q < 3.0)
-	{
-		gradient_w_over_q = sigma * (-5.0) * (3.0-q) * (3.0-q) * (3.0-q) * (3.0-q);
-	}
-	else if (q >= 1.0 && q < 2.0)
-	{
-		gradient_w_over_q = sigma * ( (-5.0) * (3.0-q) * (3.0-q) * (3.0-q) * (3.0-q) + 30.0 * (2.0-q) * (2.0-q) * (2.0-q) * (2.0-q) );
-	}
-	else if (q >= 0.0 && q < 1.0)
-	{
-		gradient_w_over_q = sigma * ( (-5.0) * (3.0-q) * (3.0-q) * (3.0-q) * (3.0-q) + 30.0 * (2.0-q) * (2.0-q) * (2.0-q) * (2.0-q) - 75.0 * (1.0-q) * (1.0-q) * (1.0-q) * (1.0-q) );
-	}
-
-	Real h_pow = 1.0;
-	for (int i=0; i<number_of_dimension; ++i)
-		h_pow *= h;
-
-	gradient_W_over_x = gradient_w_over_q * 1.0/h_pow * gradient_q_over_x;
+	lookup_table = false;
+	RealVectorX analytical_solution_of_gradient = gradient_of_kernel(source_particle, destination_particle, kernel_type, true);
+	lookup_table = was_enabled;
 
-	return gradient_W_over_x;
+	Real error_rate = (analytical_solution_of_gradient - tabulated_gradient).norm() / analytical_solution_of_gradient.norm();
+	return error_rate;
 }
 
 Real KernelHandler::integrate_kernel( int kernel_type, int number_of_dimension )
 {
 	RealVectorX origin = RealVectorX::Zero(number_of_dimension);
 
-	Real integration = 0.0;
+	AccumReal integration = 0.0;
 
 	Real step_size = 2 * neighbor_search_radius / 100.0;
 
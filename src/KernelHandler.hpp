@@ -1,11 +1,19 @@
 #pragma once
 
 #include "math_types.hpp"
+#include "SPHKernels.hpp"
 
 #include <Eigen/Geometry>
+#include <type_traits>
 
 using namespace Simulator;
 
+/*
+ *  kernel selected at runtime by kernel_type (see KernelType) and by the size of the vectors.
+ *  only meant for tests and tools, the particle loops use the fixed kernels of SPHKernels.hpp directly
+ *  (M4Kernel, or TabulatedM4Kernel after ParticleFunc::use_lookup_table and PBFSolver::use_lookup_table).
+ *  with use_lookup_table(true) the 3D kernels are evaluated from the tables of TabulatedSPHKernel instead.
+ */
 class KernelHandler
 {
 public:
@@ -13,21 +21,36 @@ public:
 	KernelHandler(Real radius);
 
 	void set_neighbor_search_radius(Real radius);
+	void use_lookup_table(bool enable, size_t table_size=4096);
 
-	Real 		compute_kernel	  ( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle, int kernel_type=4 );
-	RealVectorX gradient_of_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle, int kernel_type=4, bool analytical_solution=true );
-	Real 		test_gradient     ( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle, int kernel_type=4 );
+	Real 		compute_kernel	  ( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle, int kernel_type=4 );
+	RealVectorX gradient_of_kernel( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle, int kernel_type=4, bool analytical_solution=true );
+	Real 		test_gradient     ( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle, int kernel_type=4 );
 	Real 		integrate_kernel  ( int kernel_type, int number_of_dimension );
 
-private:
-	Real neighbor_search_radius;
-	Real epsilon = 0.000001;
-
-	Real compute_M4_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle );
-	Real compute_M5_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle );
-	Real compute_M6_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle );
+	// error rate of the tabulated gradient against the analytical one, measured like in test_gradient
+	Real 		test_lookup_table ( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle, int kernel_type=4 );
 
-	RealVectorX gradient_of_M4_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle );
-	RealVectorX gradient_of_M5_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle );
-	RealVectorX gradient_of_M6_kernel( Eigen::Ref<RealVectorX> source_particle, Eigen::Ref<RealVectorX> destination_particle );
+private:
+	Real neighbor_search_radius = 1.0;
+	// step of the finite differences, float needs a much larger one to stay above round-off
+	Real epsilon = std::is_same<Real, float>::value ? 0.001 : 0.000001;
+
+	bool lookup_table = false;
+	TabulatedM4Kernel m4_table;
+	TabulatedM5Kernel m5_table;
+	TabulatedM6Kernel m6_table;
+	TabulatedWendlandC2Kernel wendland_table;
+
+	bool use_table_for( Eigen::Ref<const RealVectorX> source_particle ) const { return lookup_table && source_particle.size() == 3; }
+
+	template <template <int> class Shape>
+	Real compute_kernel_of_type( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle );
+	template <template <int> class Shape>
+	RealVectorX gradient_of_kernel_of_type( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle );
+
+	template <template <int> class Shape, int Dim>
+	Real compute_kernel_in_dimension( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle );
+	template <template <int> class Shape, int Dim>
+	RealVectorX gradient_of_kernel_in_dimension( Eigen::Ref<const RealVectorX> source_particle, Eigen::Ref<const RealVectorX> destination_particle );
 };
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "math_types.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace Simulator
+{
+/*
+ *  neighbors of a whole point set in compressed-row layout.
+ *  the neighbors of point i are indices[offsets[i]] ... indices[offsets[i+1]-1],
+ *  so all lists live in one contiguous buffer instead of one heap allocation per particle.
+ *  the buffers are refilled in place by NeighborSearcher, once they have grown no allocation happens.
+ */
+	struct NeighborList {
+
+		// view on the neighbors of one point, can be used like the old std::vector<size_t>
+		struct Row {
+			const uint32_t* first;
+			const uint32_t* last;
+
+			size_t size() const { return static_cast<size_t>(last - first); }
+			bool empty() const { return first == last; }
+			uint32_t operator[](size_t k) const { return first[k]; }
+			const uint32_t* begin() const { return first; }
+			const uint32_t* end() const { return last; }
+		};
+
+		std::vector<size_t> offsets;     // size n+1, offsets[0] == 0
+		std::vector<uint32_t> indices;   // neighbor indices of all points, row after row
+
+		// kernel data of every pair (i, indices[k]) at position k, filled by ParticleFunc::update_density
+		// and only valid until the positions move again. x_i - x_j itself is cheaper to recompute than to store
+		std::vector<Real> pair_kernels;               // W(x_i - x_j)
+		std::vector<Real> pair_gradient_factors;      // gradient of W is pair_gradient_factors[k] * (x_i - x_j)
+
+		size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+		size_t total() const { return indices.size(); }
+
+		Row operator[](size_t i) const
+		{
+			return Row{ indices.data() + offsets[i], indices.data() + offsets[i+1] };
+		}
+
+		// keep the capacity, only drop the content
+		void clear()
+		{
+			offsets.assign(1, 0);
+			indices.clear();
+			pair_kernels.clear();
+			pair_gradient_factors.clear();
+		}
+
+		void resize_pair_data()
+		{
+			pair_kernels.resize(total());
+			pair_gradient_factors.resize(total());
+		}
+
+		// rows can also be appended one after another
+		void push_back(uint32_t j) { indices.push_back(j); }
+		void end_row() { offsets.push_back(indices.size()); }
+	};
+}
@@ -7,6 +7,9 @@
 #include <algorithm>    // std::sort
 #include <numeric>
 #include <iostream>
+#include <type_traits>
+#include <cmath>
+#include <cstdint>
 
 using namespace Simulator;
 
@@ -23,75 +26,193 @@ NeighborSearcher::NeighborSearcher(Real radius)
 void NeighborSearcher::set_neighbor_search_radius(Real radius)
 {
 	neighbor_search_radius = radius;
+
+	if (nsearch)
+		nsearch->set_radius(static_cast<CompactNSearch::Real>(radius));
+	points_changed = true;
+}
+
+CompactNSearch::Real const* NeighborSearcher::compactN_data( std::vector<RealVector3>& point_set, std::vector<std::array<CompactNSearch::Real, 3>>& CompactN_particles )
+{
+	if (point_set.empty())
+		return nullptr;
+
+	// RealVector3 is unaligned, so the vector already is a packed array of 3 * n reals
+	if (std::is_same<CompactNSearch::Real, Real>::value && sizeof(RealVector3) == 3 * sizeof(Real))
+		return reinterpret_cast<CompactNSearch::Real const*>(point_set.front().data());
+
+	convect_to_CompactN_position(point_set, CompactN_particles);
+	return CompactN_particles.front().data();
 }
 
 void NeighborSearcher::set_particles_ptr(std::vector<RealVector3>& particles)
 {
-	particles_ptr = std::make_shared<std::vector<RealVector3>>(particles);
+	particles_ptr = &particles;
+
+	// the point set keeps a raw pointer to the positions, so a new size or buffer means re-registering the sets
+	CompactNSearch::Real const* data = compactN_data(particles, fluid_points);
+	if (particles.size() != n_fluid_points || data != fluid_data)
+		nsearch.reset();
+
+	fluid_data = data;
+	n_fluid_points = particles.size();
+	points_changed = true;
 }
 
 void NeighborSearcher::set_boundary_particles_ptr(std::vector<RealVector3>& boundary_particles)
 {
-	boundary_particles_ptr = std::make_shared<std::vector<RealVector3>>(boundary_particles);
+	boundary_particles_ptr = &boundary_particles;
+
+	CompactNSearch::Real const* data = compactN_data(boundary_particles, boundary_points);
+	if (boundary_particles.size() != n_boundary_points || data != boundary_data)
+		nsearch.reset();
+
+	boundary_data = data;
+	n_boundary_points = boundary_particles.size();
+	points_changed = true;
+
+	// boundary is registered as static, once it is set again it is a moving boundary
+	if (nsearch && has_boundary_set)
+		nsearch->point_set(boundary_set_id).set_dynamic(true);
 }
 
-// already set inactive
-std::vector< std::vector<size_t> > NeighborSearcher::find_neighbors_in_boundary( )
+void NeighborSearcher::rebuild_point_sets()
 {
-	CompactNSearch::NeighborhoodSearch nsearch(neighbor_search_radius);
-	std::vector<std::array<CompactNSearch::Real, 3>> boundary_positions = convect_to_CompactN_position(*boundary_particles_ptr);
-	std::vector<std::array<CompactNSearch::Real, 3>> particle_positions = convect_to_CompactN_position(*particles_ptr);
+	nsearch.reset(new CompactNSearch::NeighborhoodSearch(static_cast<CompactNSearch::Real>(neighbor_search_radius)));
 
-	unsigned int point_set_id_1 = nsearch.add_point_set(particle_positions.front().data(), particle_positions.size());
-	unsigned int point_set_id_2 = nsearch.add_point_set(boundary_positions.front().data(), boundary_positions.size());
-	nsearch.set_active(point_set_id_2, point_set_id_1, false);
-	nsearch.find_neighbors();
+	has_fluid_set = n_fluid_points > 0;
+	has_boundary_set = n_boundary_points > 0;
 
-    CompactNSearch::PointSet const& ps = nsearch.point_set(point_set_id_1);
-    std::vector< std::vector<size_t> > m_neighbors;
-    m_neighbors.reserve(particle_positions.size());
+	if (has_fluid_set)
+		fluid_set_id = nsearch->add_point_set(fluid_data, n_fluid_points);
+
+	// boundary particles are only found by the fluid, they never search neighbors themselves
+	if (has_boundary_set)
+		boundary_set_id = nsearch->add_point_set(boundary_data, n_boundary_points, false, false, true);
+
+	points_changed = true;
+}
+
+void NeighborSearcher::update_point_sets()
+{
+	if (!nsearch)
+		rebuild_point_sets();
 
-	for (size_t i =0; i < particle_positions.size(); ++i)
+	if (!has_fluid_set)
+		return;
+
+	// hash grid is updated incrementally, only cells of particles that moved are touched
+	if (points_changed)
 	{
-		std::vector<size_t> ns;
-		// n_neighbors: returns Number of neighbors of point i in point set point_set
-		for (size_t j = 0; j < ps.n_neighbors(point_set_id_2, i); ++j)
+		nsearch->find_neighbors(true);
+		points_changed = false;
+	}
+}
+
+// spreads the lower 21 bits of v so that there are two zero bits between every two of them
+static inline uint64_t spread_bits( uint64_t v )
+{
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffULL;
+	v = (v | v << 16) & 0x1f0000ff0000ffULL;
+	v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+	v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+	v = (v | v << 2)  & 0x1249249249249249ULL;
+	return v;
+}
+
+void NeighborSearcher::z_order( const std::vector<RealVector3>& points, size_t begin, size_t end, std::vector<size_t>& order )
+{
+	order.resize(end - begin);
+	std::iota(order.begin(), order.end(), begin);
+
+	if (begin >= end)
+		return;
+
+	RealVector3 min_corner = points[begin];
+	for (size_t i = begin; i < end; ++i)
+		min_corner = min_corner.cwiseMin(points[i]);
+
+	// morton code of the grid cell, cells have the size of the search radius like in CompactNSearch
+	std::vector<uint64_t> keys(end - begin);
+	for (size_t i = begin; i < end; ++i)
+	{
+		uint64_t key = 0;
+		for (int d = 0; d < 3; ++d)
 		{
-			// Return PointID of the jth neighbor of the ith particle in the 2nd point set.
-			unsigned int pid = ps.neighbor(point_set_id_2, i, j);
-			ns.push_back(pid);
+			Real cell = std::floor((points[i][d] - min_corner[d]) / neighbor_search_radius);
+			key |= spread_bits(static_cast<uint64_t>(std::min(cell, static_cast<Real>(0x1fffff)))) << d;
 		}
-		m_neighbors.push_back(ns);
+		keys[i - begin] = key;
 	}
 
-	return m_neighbors;
+	// stable, so particles in the same cell keep their relative order
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a - begin] < keys[b - begin]; });
 }
 
-// neighbors include itself
-std::vector< std::vector<size_t> > NeighborSearcher::find_boundary_neighbors( )
+void NeighborSearcher::points_reordered()
+{
+	nsearch.reset();
+	points_changed = true;
+}
+
+void NeighborSearcher::fill_neighbor_list( CompactNSearch::PointSet const& ps, unsigned int neighbor_set_id, bool with_self, NeighborList& neighbors )
 {
-	CompactNSearch::NeighborhoodSearch nsearch(neighbor_search_radius);
-	std::vector<std::array<CompactNSearch::Real, 3>> boundary_positions = convect_to_CompactN_position(*boundary_particles_ptr);
+	size_t n = ps.n_points();
+	size_t self = with_self ? 1 : 0;
 
-	// ... Fill array with 3 * n real numbers representing three-dimensional point positions.
-	unsigned int point_set_id = nsearch.add_point_set(boundary_positions.front().data(), boundary_positions.size());
-    nsearch.find_neighbors();
+	// first pass: row offsets from the neighbor counts, second pass: copy the indices
+	neighbors.offsets.resize(n + 1);
+	neighbors.offsets[0] = 0;
+	for (size_t i = 0; i < n; ++i)
+		neighbors.offsets[i+1] = neighbors.offsets[i] + ps.n_neighbors(neighbor_set_id, i) + self;
 
-    CompactNSearch::PointSet const& ps = nsearch.point_set(point_set_id);
-    std::vector< std::vector<size_t> > m_neighbors;
+	neighbors.indices.resize(neighbors.offsets[n]);
 
-    for (size_t i = 0; i < ps.n_points(); ++i)
-    {
-    	std::vector<size_t> neighbors_of_i;
-    	neighbors_of_i.push_back(i);
-        for (size_t j = 0; j < ps.n_neighbors(point_set_id, i); ++j)
-        {
-        	neighbors_of_i.push_back(ps.neighbor(point_set_id, i, j));
-        }
-        m_neighbors.push_back(neighbors_of_i);
-    }
+	#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < n; ++i)
+	{
+		uint32_t* row = neighbors.indices.data() + neighbors.offsets[i];
+		if (with_self)
+			*row++ = static_cast<uint32_t>(i);
+
+		// n_neighbors: returns Number of neighbors of point i in point set neighbor_set_id
+		size_t n_i = ps.n_neighbors(neighbor_set_id, i);
+		for (size_t j = 0; j < n_i; ++j)
+			row[j] = ps.neighbor(neighbor_set_id, i, j);
+
+		// CompactNSearch fills the lists in parallel, so their order changes from run to run.
+		// sorted rows make every sum over the neighbors reproducible, whatever the number of threads
+		std::sort(row, row + n_i);
+	}
+}
 
-	return m_neighbors;
+// already set inactive
+void NeighborSearcher::find_neighbors_in_boundary( NeighborList& neighbors )
+{
+	update_point_sets();
+
+	if (!has_fluid_set || !has_boundary_set)
+	{
+		// every fluid particle still gets an (empty) row
+		neighbors.offsets.assign(n_fluid_points + 1, 0);
+		neighbors.indices.clear();
+		return;
+	}
+
+	fill_neighbor_list(nsearch->point_set(fluid_set_id), boundary_set_id, false, neighbors);
+}
+
+// neighbors include itself
+void NeighborSearcher::find_boundary_neighbors( NeighborList& neighbors )
+{
+	CompactNSearch::NeighborhoodSearch boundary_search(neighbor_search_radius);
+
+	// ... Fill array with 3 * n real numbers representing three-dimensional point positions.
+	unsigned int point_set_id = boundary_search.add_point_set(boundary_data, n_boundary_points);
+    boundary_search.find_neighbors();
+
+    fill_neighbor_list(boundary_search.point_set(point_set_id), point_set_id, true, neighbors);
 }
 
 std::vector<size_t> NeighborSearcher::find_neighbors_within_radius( size_t selected_particle_index, bool use_compactN )
@@ -107,23 +228,22 @@ std::vector<size_t> NeighborSearcher::find_neighbors_within_radius( size_t selec
 
 std::vector< std::vector<size_t> > NeighborSearcher::find_neighbors_within_radius( std::vector<size_t> point_set )
 {
-	CompactNSearch::NeighborhoodSearch nsearch(neighbor_search_radius);
-	std::vector<std::array<CompactNSearch::Real, 3>> positions = convect_to_CompactN_position();
-
-	unsigned int point_set_id = nsearch.add_point_set(positions.front().data(), positions.size());
-	nsearch.find_neighbors();
+	update_point_sets();
 
-    CompactNSearch::PointSet const& ps = nsearch.point_set(point_set_id);
     std::vector< std::vector<size_t> > m_neighbors;
     m_neighbors.reserve(point_set.size());
+    if (!has_fluid_set)
+    	return m_neighbors;
+
+    CompactNSearch::PointSet const& ps = nsearch->point_set(fluid_set_id);
 
 	for (size_t i =0; i < point_set.size(); ++i)
 	{
 		std::vector<size_t> ns;
-		for (size_t j = 0; j < ps.n_neighbors(point_set_id, point_set[i]); ++j)
+		for (size_t j = 0; j < ps.n_neighbors(fluid_set_id, point_set[i]); ++j)
 		{
 			// Return PointID of the jth neighbor of the ith particle in the 0th point set.
-			unsigned int pid = ps.neighbor(point_set_id, point_set[i], j);
+			unsigned int pid = ps.neighbor(fluid_set_id, point_set[i], j);
 			ns.push_back(pid);
 		}
 		m_neighbors.push_back(ns);
@@ -132,111 +252,84 @@ std::vector< std::vector<size_t> > NeighborSearcher::find_neighbors_within_radiu
 	return m_neighbors;
 }
 
-std::vector< std::vector<size_t> > NeighborSearcher::find_neighbors_within_radius( bool use_compactN )
+void NeighborSearcher::find_neighbors_within_radius( NeighborList& neighbors, bool use_compactN )
 {
 	if (use_compactN)
-		return compactN_neighbor_search( );
+		compactN_neighbor_search( neighbors );
 	else
-		return brute_force_neighbor_search( );
-
-	return {};
+		brute_force_neighbor_search( neighbors );
 }
 
-std::vector< std::vector<size_t> > NeighborSearcher::find_neighbors_within_radius( std::vector<RealVector3>& point_set )
+void NeighborSearcher::find_neighbors_within_radius( std::vector<RealVector3>& point_set, NeighborList& neighbors )
 {
-	CompactNSearch::NeighborhoodSearch nsearch(neighbor_search_radius);
-	std::vector<std::array<CompactNSearch::Real, 3>> sample_positions = convect_to_CompactN_position(point_set);
-	std::vector<std::array<CompactNSearch::Real, 3>> particle_positions = convect_to_CompactN_position();
+	// the samples change on every call, so they get their own search instead of the persistent one
+	CompactNSearch::NeighborhoodSearch sample_search(neighbor_search_radius);
+	std::vector<std::array<CompactNSearch::Real, 3>> sample_positions;
+	CompactNSearch::Real const* sample_data = compactN_data(point_set, sample_positions);
 
-	unsigned int point_set_id_1 = nsearch.add_point_set(particle_positions.front().data(), particle_positions.size());
-	unsigned int point_set_id_2 = nsearch.add_point_set(sample_positions.front().data(), sample_positions.size());
-	nsearch.set_active(point_set_id_1, point_set_id_2, false);
-	nsearch.find_neighbors();
+	unsigned int point_set_id_1 = sample_search.add_point_set(fluid_data, n_fluid_points);
+	unsigned int point_set_id_2 = sample_search.add_point_set(sample_data, point_set.size());
+	sample_search.set_active(point_set_id_1, point_set_id_2, false);
+	sample_search.find_neighbors();
 
-    CompactNSearch::PointSet const& ps = nsearch.point_set(point_set_id_2);
-    std::vector< std::vector<size_t> > m_neighbors;
-    m_neighbors.reserve(point_set.size());
+	fill_neighbor_list(sample_search.point_set(point_set_id_2), point_set_id_1, false, neighbors);
+}
 
-	for (size_t i =0; i < point_set.size(); ++i)
+void NeighborSearcher::convect_to_CompactN_position( std::vector<RealVector3>& point_set, std::vector<std::array<CompactNSearch::Real, 3>>& CompactN_particles )
+{
+	// resize keeps the capacity, so in steady state this does not allocate
+	CompactN_particles.resize(point_set.size());
+	for (size_t i=0; i<point_set.size(); ++i)
 	{
-		std::vector<size_t> ns;
-		for (size_t j = 0; j < ps.n_neighbors(point_set_id_1, i); ++j)
-		{
-			// Return PointID of the jth neighbor of the ith particle in the 0th point set.
-			unsigned int pid = ps.neighbor(point_set_id_1, i, j);
-			ns.push_back(pid);
-		}
-		m_neighbors.push_back(ns);
+		CompactN_particles[i][0] = static_cast<CompactNSearch::Real>(point_set[i][0]);
+		CompactN_particles[i][1] = static_cast<CompactNSearch::Real>(point_set[i][1]);
+		CompactN_particles[i][2] = static_cast<CompactNSearch::Real>(point_set[i][2]);
 	}
-
-	return m_neighbors;
 }
 
 std::vector<std::array<CompactNSearch::Real, 3>> NeighborSearcher::convect_to_CompactN_position( std::vector<RealVector3>& point_set )
 {
 	std::vector<std::array<CompactNSearch::Real, 3>> CompactN_particles;
-	for (size_t i=0; i<point_set.size(); ++i)
-	{
-		CompactN_particles.push_back(std::array<CompactNSearch::Real, 3>{ point_set[i][0], point_set[i][1], point_set[i][2] });
-	}
+	convect_to_CompactN_position(point_set, CompactN_particles);
 	return CompactN_particles;
 }
 
 std::vector<std::array<CompactNSearch::Real, 3>> NeighborSearcher::convect_to_CompactN_position( )
 {
-	std::vector<std::array<CompactNSearch::Real, 3>> CompactN_particles;
-	for (size_t i=0; i<particles_ptr->size(); ++i)
-	{
-		CompactN_particles.push_back(std::array<CompactNSearch::Real, 3>{ (*particles_ptr)[i][0], (*particles_ptr)[i][1], (*particles_ptr)[i][2] });
-	}
-	return CompactN_particles;
+	return convect_to_CompactN_position(*particles_ptr);
 }
 
 std::vector<size_t> NeighborSearcher::compactN_neighbor_search( size_t selected_particle_index )
 {
-	CompactNSearch::NeighborhoodSearch nsearch(neighbor_search_radius);
-	std::vector<std::array<CompactNSearch::Real, 3>> positions = convect_to_CompactN_position();
-
-	unsigned int point_set_id = nsearch.add_point_set(positions.front().data(), positions.size());
-	nsearch.find_neighbors();
+	update_point_sets();
 
-    CompactNSearch::PointSet const& ps = nsearch.point_set(point_set_id);
 	std::vector<size_t> m_neighbors;
+	if (!has_fluid_set)
+		return m_neighbors;
+
+    CompactNSearch::PointSet const& ps = nsearch->point_set(fluid_set_id);
 
-	for (size_t i = 0; i < ps.n_neighbors(point_set_id, selected_particle_index); ++i)
+	for (size_t i = 0; i < ps.n_neighbors(fluid_set_id, selected_particle_index); ++i)
 	{
 		// Return PointID of the jth neighbor of the ith particle in the 0th point set.
-		unsigned int pid = ps.neighbor(point_set_id, selected_particle_index, i);
+		unsigned int pid = ps.neighbor(fluid_set_id, selected_particle_index, i);
 		m_neighbors.push_back(pid);
 	}
 	return m_neighbors;
 }
 
 // neighbors include itself
-std::vector< std::vector<size_t> > NeighborSearcher::compactN_neighbor_search( )
+void NeighborSearcher::compactN_neighbor_search( NeighborList& neighbors )
 {
-	CompactNSearch::NeighborhoodSearch nsearch(neighbor_search_radius);
-	std::vector<std::array<CompactNSearch::Real, 3>> positions = convect_to_CompactN_position();
-
-	// ... Fill array with 3 * n real numbers representing three-dimensional point positions.
-	unsigned int point_set_id = nsearch.add_point_set(positions.front().data(), positions.size());
-    nsearch.find_neighbors();
-
-    CompactNSearch::PointSet const& ps = nsearch.point_set(point_set_id);
-    std::vector< std::vector<size_t> > m_neighbors;
+	update_point_sets();
 
-    for (size_t i = 0; i < ps.n_points(); ++i)
+    if (!has_fluid_set)
     {
-    	std::vector<size_t> neighbors_of_i;
-    	neighbors_of_i.push_back(i);
-        for (size_t j = 0; j < ps.n_neighbors(point_set_id, i); ++j)
-        {
-        	neighbors_of_i.push_back(ps.neighbor(point_set_id, i, j));
-        }
-        m_neighbors.push_back(neighbors_of_i);
+    	neighbors.clear();
+    	return;
     }
 
-	return m_neighbors;
+    fill_neighbor_list(nsearch->point_set(fluid_set_id), fluid_set_id, true, neighbors);
 }
 
 std::vector<size_t> NeighborSearcher::brute_force_neighbor_search( size_t selected_particle_index )
@@ -263,17 +356,16 @@ std::vector<size_t> NeighborSearcher::brute_force_neighbor_search( size_t select
     return neighbors_of_i;
 }
 
-std::vector< std::vector<size_t> > NeighborSearcher::brute_force_neighbor_search( )
+void NeighborSearcher::brute_force_neighbor_search( NeighborList& neighbors )
 {
     size_t k = particles_ptr->size();
-	std::vector< std::vector<size_t> > m_neighbors;
-	m_neighbors.reserve(k);
+    neighbors.clear();
+    neighbors.offsets.reserve(k + 1);
 
     RealVector3 vec1,vec2;
 
     for(size_t i = 0; i < k; i++ )
     {
-        std::vector<size_t> neighbors_of_i;
         for(size_t j = 0; j < k; j++)
         {
         	vec1 = (*particles_ptr)[i];
@@ -282,12 +374,9 @@ std::vector< std::vector<size_t> > NeighborSearcher::brute_force_neighbor_search
                 vec2 = (*particles_ptr)[j];
                 RealVector3 diff_vec = vec2 - vec1;
                 if(diff_vec.dot(diff_vec) <= neighbor_search_radius*neighbor_search_radius)
-                	neighbors_of_i.push_back(j);
+                	neighbors.push_back(static_cast<uint32_t>(j));
             }
         }
-        m_neighbors.push_back(neighbors_of_i);
+        neighbors.end_row();
     }
-
-    return m_neighbors;
 }
-
@@ -1,11 +1,13 @@
 #pragma once
 
 #include "math_types.hpp"
+#include "NeighborList.hpp"
 
 #include <Eigen/Geometry>
 #include <CompactNSearch/CompactNSearch>
 #include <iostream>
 #include <memory>
+#include <array>
 
 
 using namespace Simulator;
@@ -22,23 +24,58 @@ public:
 
 	std::vector<size_t> 			   find_neighbors_within_radius( size_t selected_particle_index, bool use_compactN );
 	std::vector< std::vector<size_t> > find_neighbors_within_radius( std::vector<size_t> point_set );
-	std::vector< std::vector<size_t> > find_neighbors_within_radius( bool use_compactN );
-	std::vector< std::vector<size_t> > find_neighbors_within_radius( std::vector<RealVector3>& point_set );
+	void find_neighbors_within_radius( NeighborList& neighbors, bool use_compactN );
+	void find_neighbors_within_radius( std::vector<RealVector3>& point_set, NeighborList& neighbors );
 
-	std::vector< std::vector<size_t> > find_boundary_neighbors( );
-	std::vector< std::vector<size_t> > find_neighbors_in_boundary( );
+	void find_boundary_neighbors( NeighborList& neighbors );
+	void find_neighbors_in_boundary( NeighborList& neighbors );
+
+	// indices of points[begin, end) in the order of the z-curve through the cells of the search grid,
+	// used to reorder the particles so that neighbors are also close in memory
+	void z_order( const std::vector<RealVector3>& points, size_t begin, size_t end, std::vector<size_t>& order );
+	// the registered points were permuted, the next search builds the grid again
+	void points_reordered();
 
 private:
-    std::shared_ptr<std::vector<RealVector3>> particles_ptr;
-    std::shared_ptr<std::vector<RealVector3>> boundary_particles_ptr;
+    // not owned, the simulator keeps the positions alive and calls the setters again when they moved
+    std::vector<RealVector3>* particles_ptr = nullptr;
+    std::vector<RealVector3>* boundary_particles_ptr = nullptr;
 	Real neighbor_search_radius;
 
+	/*
+	 *  long-lived search over the registered fluid and boundary point sets.
+	 *  the hash grid is only built once and then updated incrementally in find_neighbors(points_changed),
+	 *  it is only rebuilt when the number of points of a set changes or the radius is reset.
+	 *  if CompactNSearch uses the same precision as the simulator the positions are read in place,
+	 *  otherwise they are converted into fluid_points / boundary_points first.
+	 */
+	std::unique_ptr<CompactNSearch::NeighborhoodSearch> nsearch;
+	std::vector<std::array<CompactNSearch::Real, 3>> fluid_points;
+	std::vector<std::array<CompactNSearch::Real, 3>> boundary_points;
+	CompactNSearch::Real const* fluid_data = nullptr;
+	CompactNSearch::Real const* boundary_data = nullptr;
+	size_t n_fluid_points = 0;
+	size_t n_boundary_points = 0;
+	unsigned int fluid_set_id;
+	unsigned int boundary_set_id;
+	bool has_fluid_set = false;
+	bool has_boundary_set = false;
+	bool points_changed = true;
+
+	void rebuild_point_sets();
+	CompactNSearch::Real const* compactN_data( std::vector<RealVector3>& point_set, std::vector<std::array<CompactNSearch::Real, 3>>& CompactN_particles );
+	void update_point_sets();
+
 	std::vector<size_t> 			   compactN_neighbor_search( size_t selected_particle_index );
-	std::vector< std::vector<size_t> > compactN_neighbor_search();
+	void 							   compactN_neighbor_search( NeighborList& neighbors );
 
 	std::vector<size_t> 			   brute_force_neighbor_search( size_t selected_particle_index );
-	std::vector< std::vector<size_t> > brute_force_neighbor_search();
+	void 							   brute_force_neighbor_search( NeighborList& neighbors );
+
+	// copies the neighbors of all points of a search into the flat list, with_self puts the point itself first
+	void fill_neighbor_list( CompactNSearch::PointSet const& ps, unsigned int neighbor_set_id, bool with_self, NeighborList& neighbors );
 
+	void convect_to_CompactN_position( std::vector<RealVector3>& point_set, std::vector<std::array<CompactNSearch::Real, 3>>& CompactN_particles );
 	std::vector<std::array<CompactNSearch::Real, 3>> convect_to_CompactN_position();
 	std::vector<std::array<CompactNSearch::Real, 3>> convect_to_CompactN_position( std::vector<RealVector3>& point_set );
 
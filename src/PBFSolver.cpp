@@ -0,0 +1,151 @@
+#include "PBFSolver.hpp"
+#include "SPHKernels.hpp"
+
+using namespace Simulator;
+
+PBFSolver::PBFSolver(Real rest_density) : rest_density(rest_density)
+{
+
+}
+
+void PBFSolver::use_lookup_table( bool enable, size_t table_size )
+{
+	lookup_table = enable;
+	m4_table = TabulatedM4Kernel(); // no radius yet, the next projection builds the tables
+	m4_table.set_table_size(table_size);
+}
+
+const TabulatedM4Kernel& PBFSolver::m4_table_of_radius( Real radius )
+{
+	if (m4_table.get_neighbor_search_radius() != radius)
+		m4_table.set_neighbor_search_radius(radius);
+	return m4_table;
+}
+
+void PBFSolver::project( mParticleSet& particles, const NeighborList& neighbors_set, Real radius, int iterations )
+{
+	if (lookup_table)
+		project_with_kernel(m4_table_of_radius(radius), particles, nullptr, neighbors_set, nullptr, iterations);
+	else
+		project_with_kernel(M4Kernel(radius), particles, nullptr, neighbors_set, nullptr, iterations);
+}
+
+void PBFSolver::project( mParticleSet& particles, std::vector<mParticle>& boundary_particles, const NeighborList& neighbors_set, const NeighborList& neighbors_in_boundary, Real radius, int iterations )
+{
+	if (lookup_table)
+		project_with_kernel(m4_table_of_radius(radius), particles, &boundary_particles, neighbors_set, &neighbors_in_boundary, iterations);
+	else
+		project_with_kernel(M4Kernel(radius), particles, &boundary_particles, neighbors_set, &neighbors_in_boundary, iterations);
+}
+
+template <class Kernel>
+void PBFSolver::project_with_kernel( const Kernel& kh, mParticleSet& particles, std::vector<mParticle>* boundary_particles, const NeighborList& neighbors_set, const NeighborList* neighbors_in_boundary, int iterations )
+{
+	for (int itr=0; itr<iterations; ++itr)
+	{
+		compute_lambda(kh, particles, boundary_particles, neighbors_set, neighbors_in_boundary);
+		compute_position_correction(kh, particles, boundary_particles, neighbors_set, neighbors_in_boundary);
+		apply_position_correction(particles);
+	}
+}
+
+template <class Kernel>
+void PBFSolver::compute_lambda( const Kernel& kh, mParticleSet& particles, std::vector<mParticle>* boundary_particles, const NeighborList& neighbors_set, const NeighborList* neighbors_in_boundary )
+{
+	Real m = particles.mass;
+	size_t n = particles.size();
+
+	lambda.resize(n);
+
+	// the density is summed up in the same sweep over the neighbors as the gradients of the constraint
+	#pragma omp parallel for schedule(static)
+	for (size_t i=0; i<n; ++i)
+	{
+		RealVector3& p_i = particles.positions[i];
+
+		AccumReal d = 0.0;
+		AccumReal S_i = 0.0;
+		RealVector3 grad_Cii(0.0, 0.0, 0.0);  // gradient with respect to x_i, minus the sum of all others
+
+		NeighborList::Row fluid_neighbors = neighbors_set[i];
+		for (size_t k=0; k<fluid_neighbors.size(); ++k)
+		{
+			RealVector3& p_j = particles.positions[fluid_neighbors[k]];
+			d += m * kh.compute_kernel( p_i, p_j );
+
+			if (k == 0) // that is, j == i
+				continue;
+
+			RealVector3 grad_Cij = (-m / rest_density) * kh.gradient_of_kernel( p_i, p_j );
+			grad_Cii -= grad_Cij;
+			S_i += grad_Cij.squaredNorm() / m;
+		}
+
+		if (neighbors_in_boundary != nullptr)
+		{
+			for (size_t j : (*neighbors_in_boundary)[i])
+			{
+				mParticle& bp_j = (*boundary_particles)[j];
+				d += bp_j.mass * kh.compute_kernel( p_i, bp_j.position );
+
+				RealVector3 grad_Cij = (-bp_j.mass / rest_density) * kh.gradient_of_kernel( p_i, bp_j.position );
+				grad_Cii -= grad_Cij;
+				S_i += grad_Cij.squaredNorm() / bp_j.mass;
+			}
+		}
+
+		S_i += grad_Cii.squaredNorm() / m;
+		particles.densities[i] = d;
+
+		// only compressed particles are pushed apart
+		Real C_i = Real(d) / rest_density - 1;
+		lambda[i] = (C_i > 0.0) ? -C_i / (S_i + relaxation) : 0.0;
+	}
+}
+
+template <class Kernel>
+void PBFSolver::compute_position_correction( const Kernel& kh, mParticleSet& particles, std::vector<mParticle>* boundary_particles, const NeighborList& neighbors_set, const NeighborList* neighbors_in_boundary )
+{
+	Real m = particles.mass;
+	size_t n = particles.size();
+
+	dx.resize(n);
+
+	// reads lambda and the positions of the neighbors, but only writes dx[i]
+	#pragma omp parallel for schedule(static)
+	for (size_t i=0; i<n; ++i)
+	{
+		RealVector3& p_i = particles.positions[i];
+		Real lambda_i = lambda[i];
+		RealVector3 dx_i(0.0, 0.0, 0.0);
+
+		// the gradient of the kernel vanishes for j == i, so the particle itself is skipped
+		NeighborList::Row fluid_neighbors = neighbors_set[i];
+		for (size_t k=1; k<fluid_neighbors.size(); ++k)
+		{
+			size_t j = fluid_neighbors[k];
+			dx_i += (lambda_i + lambda[j]) * kh.gradient_of_kernel( p_i, particles.positions[j] );
+		}
+
+		if (neighbors_in_boundary != nullptr)
+		{
+			for (size_t j : (*neighbors_in_boundary)[i])
+			{
+				mParticle& bp_j = (*boundary_particles)[j];
+				// boundary particles have no lambda of their own, they take lambda_i
+				dx_i += (lambda_i * bp_j.mass / m + lambda_i) * kh.gradient_of_kernel( p_i, bp_j.position );
+			}
+		}
+
+		dx[i] = dx_i / rest_density;
+	}
+}
+
+void PBFSolver::apply_position_correction( mParticleSet& particles )
+{
+	#pragma omp parallel for schedule(static)
+	for (size_t i=0; i<particles.size(); ++i)
+	{
+		particles.positions[i] += dx[i];
+	}
+}
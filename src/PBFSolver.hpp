@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Particle.hpp"
+#include "math_types.hpp"
+#include "NeighborList.hpp"
+#include "SPHKernels.hpp"
+
+#include <vector>
+
+using namespace Simulator;
+
+/*
+ *  density constraint projection of position based fluids.
+ *  every iteration first computes density and lambda of all particles, then the position corrections,
+ *  and only after both passes the corrections are applied (Jacobi style), so each pass runs in parallel.
+ *  lambda and dx are members, they only grow when the number of particles grows.
+ */
+class PBFSolver {
+public:
+	PBFSolver(Real rest_density);
+
+	// the neighbor lists have to contain the particle itself first, like NeighborSearcher fills them
+	void project( mParticleSet& particles, const NeighborList& neighbors_set, Real radius, int iterations );
+	void project( mParticleSet& particles, std::vector<mParticle>& boundary_particles, const NeighborList& neighbors_set, const NeighborList& neighbors_in_boundary, Real radius, int iterations );
+
+	// evaluates the kernel with TabulatedM4Kernel instead of M4Kernel
+	void use_lookup_table( bool enable, size_t table_size=4096 );
+
+private:
+	Real rest_density;
+	Real relaxation = 0.0001; // added to the denominator of lambda
+
+	std::vector<Real> lambda;
+	std::vector<RealVector3> dx;
+
+	bool lookup_table = false;
+	TabulatedM4Kernel m4_table; // only rebuilt when the radius changes
+	const TabulatedM4Kernel& m4_table_of_radius( Real radius );
+
+	// instantiated with M4Kernel and TabulatedM4Kernel, neighbors_in_boundary may be null for scenes without boundary
+	template <class Kernel>
+	void project_with_kernel( const Kernel& kh, mParticleSet& particles, std::vector<mParticle>* boundary_particles, const NeighborList& neighbors_set, const NeighborList* neighbors_in_boundary, int iterations );
+	template <class Kernel>
+	void compute_lambda( const Kernel& kh, mParticleSet& particles, std::vector<mParticle>* boundary_particles, const NeighborList& neighbors_set, const NeighborList* neighbors_in_boundary );
+	template <class Kernel>
+	void compute_position_correction( const Kernel& kh, mParticleSet& particles, std::vector<mParticle>* boundary_particles, const NeighborList& neighbors_set, const NeighborList* neighbors_in_boundary );
+	void apply_position_correction( mParticleSet& particles );
+};
@@ -2,6 +2,8 @@
 
 #include "math_types.hpp"
 
+#include <vector>
+
 using namespace Simulator;  //why here we use this namespace?
 
 namespace Simulator
@@ -29,6 +31,91 @@ namespace Simulator
 	typedef struct mParticle mParticle;
 
 
+/*
+ *  fluid particles in structure-of-arrays layout, this is what the solvers work on.
+ *  positions stay one contiguous xyz array, so the neighbor search reads them in place.
+ *  all fluid particles have the same mass, so it is only stored once.
+ *  the particles may be reordered for memory locality, original_indices remembers the order they were
+ *  generated in, and the AoS copies for the records are always written in that order.
+ */
+	class mParticleSet {
+	public:
+		std::vector<RealVector3> positions;
+		std::vector<RealVector3> velocities;
+		std::vector<Real> densities;
+		std::vector<Real> pressures;
+		std::vector<size_t> original_indices;
+		Real mass = 0.0;
+
+		size_t size() const { return positions.size(); }
+		bool empty() const { return positions.empty(); }
+
+		void clear()
+		{
+			positions.clear();
+			velocities.clear();
+			densities.clear();
+			pressures.clear();
+			original_indices.clear();
+		}
+
+		void push_back(const mParticle& p)
+		{
+			positions.push_back(p.position);
+			velocities.push_back(p.velocity);
+			densities.push_back(p.density);
+			pressures.push_back(0.0);
+			original_indices.push_back(original_indices.size());
+			mass = p.mass;
+		}
+
+		// particle k after the call is particle order[k] before
+		void reorder(const std::vector<size_t>& order)
+		{
+			reorder_field(positions, order);
+			reorder_field(velocities, order);
+			reorder_field(densities, order);
+			reorder_field(pressures, order);
+			reorder_field(original_indices, order);
+		}
+
+		template <class T>
+		static void reorder_field(std::vector<T>& field, const std::vector<size_t>& order)
+		{
+			std::vector<T> sorted(field.size());
+			for (size_t k=0; k<order.size(); ++k)
+				sorted[k] = field[order[k]];
+			field.swap(sorted);
+		}
+
+		// copy of particle i in the AoS layout, only for reading
+		mParticle particle(size_t i) const
+		{
+			mParticle p;
+			p.position = positions[i];
+			p.velocity = velocities[i];
+			p.density = densities[i];
+			p.mass = mass;
+			return p;
+		}
+
+		// AoS copy in generation order, which is what the simulation record stores
+		void to_particles(std::vector<mParticle>& particles) const
+		{
+			particles.resize(size());
+			for (size_t i=0; i<size(); ++i)
+				particles[original_indices[i]] = particle(i);
+		}
+
+		void from_particles(const std::vector<mParticle>& particles)
+		{
+			clear();
+			for (auto& p : particles)
+				push_back(p);
+		}
+	};
+
+
 /*
  *  parameter used to describe a cubic.
  */
@@ -1,6 +1,6 @@
 #include "ParticleFunc.hpp"
 #include "math_types.hpp"
-#include "KernelHandler.hpp"
+#include "SPHKernels.hpp"
 #include "NeighborSearcher.hpp"
 #include <iostream>
 #include <algorithm>
@@ -8,71 +8,133 @@
 
 using namespace Simulator;
 
+// stores W and the gradient factor of pair k and returns W
+template <class Kernel>
+static inline Real compute_pair_data(const Kernel& kh, NeighborList& neighbors, size_t k, const RealVector3& x_i, const RealVector3& x_j)
+{
+	RealVector3 x_ij = x_i - x_j;
+	Real r = x_ij.norm();
+	Real W = kh.compute_kernel_of_distance(r);
+
+	neighbors.pair_kernels[k] = W;
+	neighbors.pair_gradient_factors[k] = kh.gradient_factor_of_distance(r);
+
+	return W;
+}
+
 ParticleFunc::ParticleFunc(Real rest_density, Real B, Real alpha) : rest_density(rest_density), B(B), alpha(alpha)
 {
 
 }
 
-void ParticleFunc::update_density(std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<mParticle>& samples, std::vector<mParticle>& particles, Real radius )
+void ParticleFunc::use_lookup_table(bool enable, size_t table_size)
+{
+	lookup_table = enable;
+	m4_table = TabulatedM4Kernel(); // no radius yet, the next step builds the tables
+	m4_table.set_table_size(table_size);
+}
+
+const TabulatedM4Kernel& ParticleFunc::m4_table_of_radius(Real radius)
+{
+	if (m4_table.get_neighbor_search_radius() != radius)
+		m4_table.set_neighbor_search_radius(radius);
+	return m4_table;
+}
+
+void ParticleFunc::update_density(const NeighborList& neighbors_of_set, std::vector<mParticle>& samples, mParticleSet& particles, Real radius )
+{
+	if (lookup_table)
+		update_density_with_kernel(m4_table_of_radius(radius), neighbors_of_set, samples, particles);
+	else
+		update_density_with_kernel(M4Kernel(radius), neighbors_of_set, samples, particles);
+}
+
+void ParticleFunc::update_density(NeighborList& neighbors_of_set, mParticleSet& particles, Real radius )
+{
+	if (lookup_table)
+		update_density_with_kernel(m4_table_of_radius(radius), neighbors_of_set, particles);
+	else
+		update_density_with_kernel(M4Kernel(radius), neighbors_of_set, particles);
+}
+
+void ParticleFunc::update_density(NeighborList& neighbors_of_set, NeighborList& neighbors_in_boundary, mParticleSet& particles, std::vector<mParticle>& boundary_particles, Real radius )
+{
+	if (lookup_table)
+		update_density_with_kernel(m4_table_of_radius(radius), neighbors_of_set, neighbors_in_boundary, particles, boundary_particles);
+	else
+		update_density_with_kernel(M4Kernel(radius), neighbors_of_set, neighbors_in_boundary, particles, boundary_particles);
+}
+
+template <class Kernel>
+void ParticleFunc::update_density_with_kernel(const Kernel& kh, const NeighborList& neighbors_of_set, std::vector<mParticle>& samples, mParticleSet& particles )
 {
-	KernelHandler kh(radius);
+	Real m = particles.mass;
+
+	#pragma omp parallel for schedule(static)
 	for (size_t i=0; i<neighbors_of_set.size(); ++i)
 	{
-		Real d = 0.0;
-		for (size_t j=0; j<neighbors_of_set[i].size(); ++j)
+		AccumReal d = 0.0;
+		for (size_t j : neighbors_of_set[i])
 		{
-			Real m = particles[neighbors_of_set[i][j]].mass;
-			std::cout << m << std::endl;
-			d += m * kh.compute_kernel( samples[i].position, particles[neighbors_of_set[i][j]].position, 4 );
+			d += m * kh.compute_kernel( samples[i].position, particles.positions[j] );
 		}
-		particles[i].density = d;
+		samples[i].density = d;
 	}
 }
 
-void ParticleFunc::update_density(std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<mParticle>& particles, Real radius )
+// the pair data of the lists is filled on the way, see NeighborList
+template <class Kernel>
+void ParticleFunc::update_density_with_kernel(const Kernel& kh, NeighborList& neighbors_of_set, mParticleSet& particles )
 {
-	KernelHandler kh(radius);
+	Real m = particles.mass;
+
+	neighbors_of_set.resize_pair_data();
+
+	#pragma omp parallel for schedule(static)
 	for (size_t i=0; i<neighbors_of_set.size(); ++i)
 	{
-		// add itself into neighbors list
-		//neighbors_of_set[i].push_back(i);
+		RealVector3& p_i = particles.positions[i];
 
-		Real d = 0.0;
-		for (size_t j=0; j<neighbors_of_set[i].size(); ++j)
+		AccumReal d = 0.0;
+		for (size_t k=neighbors_of_set.offsets[i]; k<neighbors_of_set.offsets[i+1]; ++k)
 		{
-			Real m = particles[neighbors_of_set[i][j]].mass;
-			d += m * kh.compute_kernel( particles[i].position, particles[neighbors_of_set[i][j]].position, 4 );
+			d += m * compute_pair_data(kh, neighbors_of_set, k, p_i, particles.positions[neighbors_of_set.indices[k]]);
 		}
 
-		particles[i].density = d;
+		particles.densities[i] = d;
+		particles.pressures[i] = std::max(Real(0.0), B * (Real(d) - rest_density));
 	}
 }
 
-void ParticleFunc::update_density(std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<std::vector<size_t>>& neighbors_in_boundary, std::vector<mParticle>& particles, std::vector<mParticle>& boundary_particles, Real radius )
+template <class Kernel>
+void ParticleFunc::update_density_with_kernel(const Kernel& kh, NeighborList& neighbors_of_set, NeighborList& neighbors_in_boundary, mParticleSet& particles, std::vector<mParticle>& boundary_particles )
 {
-	KernelHandler kh(radius);
+	Real m = particles.mass;
+
+	neighbors_of_set.resize_pair_data();
+	neighbors_in_boundary.resize_pair_data();
+
+	// every particle only writes its own density, pressure and pair data, so the loop runs in parallel as is
+	#pragma omp parallel for schedule(static)
 	for (size_t i=0; i<neighbors_of_set.size(); ++i)
 	{
-		Real d = 0.0;
-		RealVector3 p_i = particles[i].position;
+		AccumReal d = 0.0;
+		RealVector3& p_i = particles.positions[i];
 
-		for (size_t j=0; j<neighbors_of_set[i].size(); ++j)
+		for (size_t k=neighbors_of_set.offsets[i]; k<neighbors_of_set.offsets[i+1]; ++k)
 		{
-			size_t k = neighbors_of_set[i][j];
-			mParticle P_k = particles[k];
-			Real m = P_k.mass;
-			d += m * kh.compute_kernel( p_i, P_k.position, 4 );
+			d += m * compute_pair_data(kh, neighbors_of_set, k, p_i, particles.positions[neighbors_of_set.indices[k]]);
 		}
 
-		for (size_t k=0; k<neighbors_in_boundary[i].size(); ++k)
+		for (size_t l=neighbors_in_boundary.offsets[i]; l<neighbors_in_boundary.offsets[i+1]; ++l)
 		{
-			size_t l = neighbors_in_boundary[i][k];
-			Real m = boundary_particles[l].mass;
-			RealVector3 bp_k = boundary_particles[l].position;
-			d += m * kh.compute_kernel( p_i, bp_k, 4 );
+			mParticle& bp_l = boundary_particles[neighbors_in_boundary.indices[l]];
+			d += bp_l.mass * compute_pair_data(kh, neighbors_in_boundary, l, p_i, bp_l.position);
 		}
 
-		particles[i].density = d;
+		// pressure only depends on the density, so it is computed once here instead of per neighbor pair
+		particles.densities[i] = d;
+		particles.pressures[i] = std::max(Real(0.0), B * (Real(d) - rest_density));
 	}
 }
 
@@ -88,7 +150,16 @@ void ParticleFunc::update_boundary_position_shm( std::vector<mParticle>& boundar
 void ParticleFunc::update_boundary_position_moving_dam_break( std::vector<mParticle>& boundary_particles, int start_idx, Real dt, int iter ) // without XSPH
 {
 	if (dt * iter <= 1.) return;
-	if (boundary_particles[start_idx].position[2] > boundary_particles[boundary_particles.size()-1].position[2] - boundary_particles[start_idx].position[2]) return;
+
+	// lowest and highest particle of the gate, found by value since the particles may have been reordered
+	Real min_z = boundary_particles[start_idx].position[2];
+	Real max_z = min_z;
+	for (size_t i=start_idx; i<boundary_particles.size(); ++i)
+	{
+		min_z = std::min(min_z, boundary_particles[i].position[2]);
+		max_z = std::max(max_z, boundary_particles[i].position[2]);
+	}
+	if (min_z > max_z - min_z) return;
 	for (int i=start_idx; i<boundary_particles.size(); ++i)
 	{
 		boundary_particles[i].position[2] += dt;
@@ -116,129 +187,114 @@ void ParticleFunc::update_boundary_position_bullet( std::vector<mParticle>& boun
 }
 
 
-void ParticleFunc::update_velocity( std::vector<mParticle>& particles, Real dt, Eigen::Ref<const RealVector3> a )
+void ParticleFunc::update_velocity( mParticleSet& particles, Real dt, Eigen::Ref<const RealVector3> a )
 {
-	for (auto& p : particles)
+	RealVector3 dv = a * dt;
+
+	#pragma omp parallel for schedule(static)
+	for (size_t i=0; i<particles.size(); ++i)
 	{
-		p.velocity += a * dt;
+		particles.velocities[i] += dv;
 	}
 }
 
-void ParticleFunc::update_velocity( std::vector<mParticle>& particles, Real dt, std::vector<RealVector3>& as )
+void ParticleFunc::update_velocity( mParticleSet& particles, Real dt, std::vector<RealVector3>& as )
 {
+	#pragma omp parallel for schedule(static)
 	for (size_t i=0; i<particles.size(); ++i)
 	{
-		particles[i].velocity += as[i] * dt;
+		particles.velocities[i] += as[i] * dt;
 	}
 }
 
 // without XSPH
-void ParticleFunc::update_position( std::vector<mParticle>& particles, Real dt )
+void ParticleFunc::update_position( mParticleSet& particles, Real dt )
 {
-	for (auto& p : particles)
+	#pragma omp parallel for schedule(static)
+	for (size_t i=0; i<particles.size(); ++i)
 	{
-		p.position += p.velocity * dt;
+		particles.positions[i] += particles.velocities[i] * dt;
 	}
 }
 
 
 // with XSPH
-void ParticleFunc::update_position( std::vector<mParticle>& particles, Real dt, std::vector<std::vector<size_t>>& neighbors_set, Real radius)
+// the smoothed velocities are computed from the old positions first and applied afterwards,
+// so no particle sees a neighbor that has already moved and the result does not depend on the loop order.
+// the kernels are the ones update_density stored in the pair data, the positions have not moved since
+void ParticleFunc::update_position( mParticleSet& particles, Real dt, const NeighborList& neighbors_set )
 {
-	KernelHandler kh(radius);
+	Real m = particles.mass;
+
+	xsph_velocities.resize(particles.size());
 
+	#pragma omp parallel for schedule(static)
 	for (size_t i=0; i<particles.size(); ++i)
 	{
 		RealVector3 sum(0.0, 0.0, 0.0);
-		mParticle p_i = particles[i];
+		RealVector3& v_i = particles.velocities[i];
+		Real d_i = particles.densities[i];
 
-		for (size_t k=0; k<neighbors_set[i].size(); ++k)
+		for (size_t k=neighbors_set.offsets[i]; k<neighbors_set.offsets[i+1]; ++k)
 		{
-			size_t j = neighbors_set[i][k];
-			mParticle p_j = particles[j];
-
-			sum += 2.0 * p_j.mass / (p_i.density + p_j.density) * kh.compute_kernel(p_i.position, p_j.position, 4) * (p_j.velocity - p_i.velocity);
+			size_t j = neighbors_set.indices[k];
+			sum += 2.0 * m / (d_i + particles.densities[j]) * neighbors_set.pair_kernels[k] * (particles.velocities[j] - v_i);
 		}
 
-		RealVector3 v_i_star = p_i.velocity + 0.5 * sum;
+		xsph_velocities[i] = v_i + 0.5 * sum;
+	}
 
-		particles[i].position += v_i_star * dt;
+	#pragma omp parallel for schedule(static)
+	for (size_t i=0; i<particles.size(); ++i)
+	{
+		particles.positions[i] += xsph_velocities[i] * dt;
 	}
 }
 
 
-std::vector<RealVector3> ParticleFunc::update_acceleration( std::vector<mParticle>& particles, std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<RealVector3>& external_forces, Real radius)
+// both read the pair data of the last update_density
+void ParticleFunc::update_acceleration( mParticleSet& particles, const NeighborList& neighbors_of_set, std::vector<RealVector3>& external_forces, std::vector<RealVector3>& as)
 {
-	std::vector<RealVector3> as;
+	as.resize(particles.size());
 
-	KernelHandler kh(radius);
+	Real m_j = particles.mass;
 
+	#pragma omp parallel for schedule(static)
 	for (size_t i=0; i<particles.size(); ++i)
 	{
 		RealVector3 a(0.0, 0.0, 0.0);
 		RealVector3 a1(0.0, 0.0, 0.0);
 		RealVector3 a2(0.0, 0.0, 0.0);
 
-		//std::cout << "a1 before " << i << ": (" << a1[0] << " " << a1[1] << " " << a1[2] << ")" << std::endl;
+		Real d_i = particles.densities[i];
+		Real p_i = particles.pressures[i];
 
-		// add itself
-		//neighbors_of_set[i].push_back(i);
-
-		Real d_i = particles[i].density;
-		//std::cout << "density " << i << ": " << d_i << std::endl;
-
-		//std::cout << "neighbor of " << i << ": " << neighbors_of_set[i].size() << std::endl;
-
-
-		for (size_t j=0; j<neighbors_of_set[i].size(); ++j)
+		for (size_t k=neighbors_of_set.offsets[i]; k<neighbors_of_set.offsets[i+1]; ++k)
 		{
-			RealVector3 gradient = kh.gradient_of_kernel( particles[i].position, particles[neighbors_of_set[i][j]].position, 4 );
-			//std::cout << "gradient (" << i << ", " << j << "): " << "(" << gradient[0] << " " << gradient[1] << " " << gradient[2] << ")" << std::endl;
-			Real p_i, p_j, d_j, m_j;
-
-			d_j = particles[neighbors_of_set[i][j]].density;
+			size_t j = neighbors_of_set.indices[k];
+			RealVector3 gradient = neighbors_of_set.pair_gradient_factors[k] * (particles.positions[i] - particles.positions[j]);
 
-			p_i = std::max(0.0, B * (d_i - rest_density));
-			p_j = std::max(0.0, B * (d_j - rest_density));
-
-			//std::cout << "pressure " << i << ": " << p_i << std::endl;
-			//std::cout << "pressure " << n_idx << ": " << p_j << std::endl;
-
-			m_j = particles[neighbors_of_set[i][j]].mass;
+			Real d_j = particles.densities[j];
+			Real p_j = particles.pressures[j];
 
 			a1 -= gradient * m_j * (p_i / (d_i * d_i) + p_j / (d_j * d_j));
 		}
-		//std::cout << "a1 after " << i << ": (" << a1[0] << " " << a1[1] << " " << a1[2] << ")" << std::endl;
-
-
 
         a2 = external_forces[i] / d_i;
         //a2 = external_forces[i]/particles[i].mass;
 		a = a1 + a2;
 
-
-		// deep copy
-		as.push_back(a);
-
-		// remove itself
-		//neighbors_of_set[i].pop_back();
+		as[i] = a;
 	}
-
-	return as;
 }
 
-std::vector<RealVector3> ParticleFunc::update_acceleration( std::vector<mParticle>& particles, std::vector<mParticle>& boundary_particles, std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<std::vector<size_t>>& neighbors_in_boundary, std::vector<RealVector3>& external_forces, Real radius, bool with_viscosity)
+void ParticleFunc::update_acceleration( mParticleSet& particles, std::vector<mParticle>& boundary_particles, const NeighborList& neighbors_of_set, const NeighborList& neighbors_in_boundary, std::vector<RealVector3>& external_forces, Real radius, bool with_viscosity, std::vector<RealVector3>& as)
 {
-	std::vector<RealVector3> as;
+	as.resize(particles.size());
 
-	KernelHandler kh(radius);
-
-	/*
-	std::vector<std::vector<Real>> viscosity;
-	if (with_viscosity)
-		viscosity = compute_viscosity(particles, densities, radius);
-	*/
+	Real m_j = particles.mass;
 
+	#pragma omp parallel for schedule(static)
 	for (size_t i=0; i<particles.size(); ++i)
 	{
 		RealVector3 a(0.0, 0.0, 0.0);
@@ -246,80 +302,44 @@ std::vector<RealVector3> ParticleFunc::update_acceleration( std::vector<mParticl
 		RealVector3 a2(0.0, 0.0, 0.0);
 		RealVector3 a3(0.0, 0.0, 0.0);
 
-		//std::cout << "a1 before " << i << ": (" << a1[0] << " " << a1[1] << " " << a1[2] << ")" << std::endl;
-
-		mParticle Pi = particles[i];
-		Real d_i = particles[i].density;
-		Real p_i = std::max(0.0, B * (d_i - rest_density));
-		//std::cout << "density " << i << ": " << d_i << std::endl;
-
-		//std::cout << "neighbor of " << i << ": " << neighbors_of_set[i].size() << std::endl;
-
-
-		/*--------- compute viscosity of i -------*/
-		std::vector<Real> v_i;
-		if (with_viscosity)
-			v_i = compute_viscosity(particles, i, neighbors_of_set[i], radius);
+		RealVector3& x_i = particles.positions[i];
+		RealVector3& vel_i = particles.velocities[i];
+		Real d_i = particles.densities[i];
+		Real p_i = particles.pressures[i];
 
-		for (size_t j=0; j<neighbors_of_set[i].size(); ++j)
+		// pressure and viscosity are summed up in the same sweep over the neighbors
+		for (size_t k=neighbors_of_set.offsets[i]; k<neighbors_of_set.offsets[i+1]; ++k)
 		{
-			size_t idx_n = neighbors_of_set[i][j];
-			mParticle Pj = particles[idx_n];
-			RealVector3 gradient = kh.gradient_of_kernel( Pi.position, Pj.position, 4 );
-			//std::cout << "gradient (" << i << ", " << j << "): " << "(" << gradient[0] << " " << gradient[1] << " " << gradient[2] << ")" << std::endl;
-			Real p_j, d_j, m_j;
-
-			d_j = particles[idx_n].density;
-			p_j = std::max(0.0, B * (d_j - rest_density));
-
-			//std::cout << "pressure " << i << ": " << p_i << std::endl;
-			//std::cout << "pressure " << n_idx << ": " << p_j << std::endl;
+			size_t idx_n = neighbors_of_set.indices[k];
+			RealVector3 x_ij = x_i - particles.positions[idx_n];
+			RealVector3 gradient = neighbors_of_set.pair_gradient_factors[k] * x_ij;
 
-
-			m_j = Pj.mass;
+			Real d_j = particles.densities[idx_n];
+			Real p_j = particles.pressures[idx_n];
 
 			if (with_viscosity)
-				a1 -= gradient * m_j * (p_i / (d_i * d_i) + p_j / (d_j * d_j) + v_i[j]);
+				a1 -= gradient * m_j * (p_i / (d_i * d_i) + p_j / (d_j * d_j) + compute_viscosity(vel_i - particles.velocities[idx_n], x_ij, d_i, d_j, radius));
 			else
 				a1 -= gradient * m_j * (p_i / (d_i * d_i) + p_j / (d_j * d_j));
-
 		}
-		//std::cout << "a1 after " << i << ": (" << a1[0] << " " << a1[1] << " " << a1[2] << ")" << std::endl;
 
-		for (size_t k=0; k<neighbors_in_boundary[i].size(); ++k)
+		for (size_t l=neighbors_in_boundary.offsets[i]; l<neighbors_in_boundary.offsets[i+1]; ++l)
 		{
-			size_t idx_nb = neighbors_in_boundary[i][k];
-			mParticle BPk = boundary_particles[idx_nb];
-			RealVector3 gradient = kh.gradient_of_kernel( Pi.position, BPk.position, 4 );
-			//std::cout << "gradient (" << i << ", " << j << "): " << "(" << gradient[0] << " " << gradient[1] << " " << gradient[2] << ")" << std::endl;
-			//std::cout << "pressure " << i << ": " << p_i << std::endl;
-			//std::cout << "pressure " << n_idx << ": " << p_j << std::endl;
+			mParticle& BPk = boundary_particles[neighbors_in_boundary.indices[l]];
+			RealVector3 gradient = neighbors_in_boundary.pair_gradient_factors[l] * (x_i - BPk.position);
 
 			Real mb = BPk.mass;
 
 			a2 -= mb * gradient * (p_i / (d_i * d_i));
 		}
 
-
         //a3 = external_forces[i] / d_i;
-        a3 = external_forces[i] / particles[i].mass;
-
-		//std::cout << "a1 after " << i << ": (" << a1[0] << " " << a1[1] << " " << a1[2] << ")" << std::endl;
-		//std::cout << "a2 after " << i << ": (" << a2[0] << " " << a2[1] << " " << a2[2] << ")" << std::endl;
-		//std::cout << "a3 after " << i << ": (" << a3[0] << " " << a3[1] << " " << a3[2] << ")" << std::endl;
-
+        a3 = external_forces[i] / particles.mass;
 
 		a = a1 + a2 + a3;
 
-
-		// deep copy
-		as.push_back(a);
-
-		// remove itself
-		//neighbors_of_set[i].pop_back();
+		as[i] = a;
 	}
-
-	return as;
 }
 
 void ParticleFunc::initialize_boundary_particle_volumes(std::vector<Real>& boundary_volumes, std::vector<RealVector3>& boundary_positions, Real neighbor_search_radius)
@@ -327,27 +347,28 @@ void ParticleFunc::initialize_boundary_particle_volumes(std::vector<Real>& bound
 //    if(boundary_positions.size()==0)  // if we don't need to generate volume
 //        return volumes;
 
-	if (!boundary_volumes.empty())
-		boundary_volumes.clear();
+	boundary_volumes.resize(boundary_positions.size());
 
 	NeighborSearcher nb(neighbor_search_radius);
 	nb.set_boundary_particles_ptr(boundary_positions);
 
-	KernelHandler kh(neighbor_search_radius);
+	M4Kernel kh(neighbor_search_radius);
 
-	std::vector< std::vector<size_t> > neighbors_of_boundary = nb.find_boundary_neighbors( );
+	NeighborList neighbors_of_boundary;
+	nb.find_boundary_neighbors( neighbors_of_boundary );
 
+	#pragma omp parallel for schedule(static)
 	for (size_t k=0; k<boundary_positions.size(); ++k)
 	{
 		Real V_k = 0.0;
 		RealVector3 bp_k = boundary_positions[k];
-		for (size_t l=0; l<neighbors_of_boundary[k].size(); ++l)
+		for (size_t l : neighbors_of_boundary[k])
 		{
-			RealVector3 bp_l = boundary_positions[neighbors_of_boundary[k][l]];
-			V_k += kh.compute_kernel( bp_k, bp_l, 4 );
-			//std::cout << "k: " << kh.compute_kernel( bp_k, bp_l, 4 ) << std::endl;
+			RealVector3& bp_l = boundary_positions[l];
+			V_k += kh.compute_kernel( bp_k, bp_l );
+			//std::cout << "k: " << kh.compute_kernel( bp_k, bp_l ) << std::endl;
 		}
-		boundary_volumes.push_back(1.0/V_k);
+		boundary_volumes[k] = 1.0/V_k;
 	}
 }
 
@@ -392,34 +413,18 @@ std::vector<std::vector<Real>> ParticleFunc::compute_viscosity(std::vector<mPart
 }
 */
 
-// Instead of computing the whole viscosity matrix, we compute one row each time
-std::vector<Real> ParticleFunc::compute_viscosity(std::vector<mParticle>& particles, size_t idx_i, std::vector<size_t>& neighbors_of_i, Real neighbor_search_radius)
+// Instead of computing the whole viscosity matrix, we compute one entry each time,
+// right where update_acceleration needs it
+Real ParticleFunc::compute_viscosity(const RealVector3& v_ij, const RealVector3& x_ij, Real d_i, Real d_j, Real neighbor_search_radius)
 {
-	std::vector<Real> v_i;
-
-	mParticle Pi = particles[idx_i];
-	for (size_t k=0; k<neighbors_of_i.size(); ++k)
-	{
-		size_t j = neighbors_of_i[k];
-		mParticle Pj = particles[j];
-
-		RealVector3 v_ij = Pi.velocity - Pj.velocity;
-		RealVector3 x_ij = Pi.position - Pj.position;
+	Real dotProduct = v_ij[0] * x_ij[0] + v_ij[1] * x_ij[1] + v_ij[2] * x_ij[2];
 
-		Real dotProduct = v_ij[0] * x_ij[0] + v_ij[1] * x_ij[1] + v_ij[2] * x_ij[2];
+	if (dotProduct >= 0.0)
+		return 0.0;
 
-		if (dotProduct >= 0.0)
-			v_i.push_back(0.0);
-		else {
-			Real h = neighbor_search_radius / 2.0; // assume we use m4 kernel
-			Real u_ij = 2.0 * alpha * h * sqrt(B) / (particles[idx_i].density + particles[j].density);
-			Real squaredNorm_x_ij = x_ij[0] * x_ij[0] + x_ij[1] * x_ij[1] + x_ij[2] * x_ij[2];
+	Real h = neighbor_search_radius / 2.0; // assume we use m4 kernel
+	Real u_ij = 2.0 * alpha * h * sqrt(B) / (d_i + d_j);
+	Real squaredNorm_x_ij = x_ij[0] * x_ij[0] + x_ij[1] * x_ij[1] + x_ij[2] * x_ij[2];
 
-			Real v_ij = -u_ij * dotProduct / (squaredNorm_x_ij + 0.01 * h * h);
-			v_i.push_back(v_ij);
-		}
-	}
-
-	return v_i;
+	return -u_ij * dotProduct / (squaredNorm_x_ij + 0.01 * h * h);
 }
-
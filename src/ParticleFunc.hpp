@@ -2,6 +2,8 @@
 
 #include "Particle.hpp"
 #include "math_types.hpp"
+#include "NeighborList.hpp"
+#include "SPHKernels.hpp"
 
 #include <vector>
 
@@ -11,32 +13,54 @@ class ParticleFunc {
 public:
 	ParticleFunc(Real rest_density, Real B, Real alpha);
 
-	void update_density(std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<mParticle>& samples, std::vector<mParticle>& particles, Real radius );
-	void update_density(std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<mParticle>& particles, Real radius );
-	void update_density(std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<std::vector<size_t>>& neighbors_in_boundary, std::vector<mParticle>& particles, std::vector<mParticle>& boundary_particles, Real radius);
+	// densities of the fluid, the pressures are updated together with them.
+	// the fluid versions also store kernel and gradient factor of every pair in the neighbor lists,
+	// update_acceleration and the XSPH update_position read them back instead of evaluating the kernel again
+	void update_density(const NeighborList& neighbors_of_set, std::vector<mParticle>& samples, mParticleSet& particles, Real radius );
+	void update_density(NeighborList& neighbors_of_set, mParticleSet& particles, Real radius );
+	void update_density(NeighborList& neighbors_of_set, NeighborList& neighbors_in_boundary, mParticleSet& particles, std::vector<mParticle>& boundary_particles, Real radius);
 
-	void update_position( std::vector<mParticle>& particles, Real dt ); // without XSPH
-	void update_position( std::vector<mParticle>& particles, Real dt, std::vector<std::vector<size_t>>& neighbors_set, Real radius); // with XSPH
+	// the densities are computed with TabulatedM4Kernel instead of M4Kernel, and so are the pair data the other loops read.
+	// the boundary volumes stay with the exact kernel
+	void use_lookup_table(bool enable, size_t table_size=4096);
+
+	void update_position( mParticleSet& particles, Real dt ); // without XSPH
+	void update_position( mParticleSet& particles, Real dt, const NeighborList& neighbors_set); // with XSPH
 
 	void update_boundary_position_shm( std::vector<mParticle>& boundary_particles, int start_idx, Real mid, Real amp, Real dt, int iter ); // without XSPH
 	void update_boundary_position_moving_dam_break( std::vector<mParticle>& boundary_particles, int start_idx, Real dt, int iter ); // without XSPH
 	void update_boundary_position_watermill( std::vector<mParticle>& boundary_particles, int start_idx, RealVector3& rotation_center, Real dt, int iter ); // without XSPH
 	void update_boundary_position_bullet( std::vector<mParticle>& boundary_particles, int start_idx, Real dt );
 
-	void update_velocity( std::vector<mParticle>& particles, Real dt, Eigen::Ref<const RealVector3> a); // semi-implicit euler
-	void update_velocity( std::vector<mParticle>& particles, Real dt, std::vector<RealVector3>& as);
+	void update_velocity( mParticleSet& particles, Real dt, Eigen::Ref<const RealVector3> a); // semi-implicit euler
+	void update_velocity( mParticleSet& particles, Real dt, std::vector<RealVector3>& as);
 
-	std::vector<RealVector3> update_acceleration( std::vector<mParticle>& particles, std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<RealVector3>& external_forces, Real radius);
-	std::vector<RealVector3> update_acceleration( std::vector<mParticle>& particles, std::vector<mParticle>& boundary_particles, std::vector<std::vector<size_t>>& neighbors_of_set, std::vector<std::vector<size_t>>& neighbors_in_boundary, std::vector<RealVector3>& external_forces, Real radius, bool with_viscosity);
+	// the accelerations are written into as, which is resized to the number of particles
+	void update_acceleration( mParticleSet& particles, const NeighborList& neighbors_of_set, std::vector<RealVector3>& external_forces, std::vector<RealVector3>& as);
+	void update_acceleration( mParticleSet& particles, std::vector<mParticle>& boundary_particles, const NeighborList& neighbors_of_set, const NeighborList& neighbors_in_boundary, std::vector<RealVector3>& external_forces, Real radius, bool with_viscosity, std::vector<RealVector3>& as);
 
 	void initialize_boundary_particle_volumes(std::vector<Real>& boundary_volumes, std::vector<RealVector3>& boundary_positions, Real neighbor_search_radius);
 
 	//std::vector<std::vector<Real>> compute_viscosity(std::vector<mParticle>& particles, std::vector<Real>& densities, Real neighbor_search_radius);
-	std::vector<Real> compute_viscosity(std::vector<mParticle>& particles, size_t idx_i, std::vector<size_t>& neighbors_of_i, Real neighbor_search_radius);
+	Real compute_viscosity(const RealVector3& v_ij, const RealVector3& x_ij, Real d_i, Real d_j, Real neighbor_search_radius);
 
 private:
 	//pressure_force(mParticle p);
 	Real rest_density;
 	Real B;
 	Real alpha;
+
+	std::vector<RealVector3> xsph_velocities; // buffer of the XSPH position update, kept between the steps
+
+	bool lookup_table = false;
+	TabulatedM4Kernel m4_table; // only rebuilt when the radius changes
+	const TabulatedM4Kernel& m4_table_of_radius(Real radius);
+
+	// the loops of update_density, instantiated with M4Kernel and TabulatedM4Kernel
+	template <class Kernel>
+	void update_density_with_kernel(const Kernel& kh, const NeighborList& neighbors_of_set, std::vector<mParticle>& samples, mParticleSet& particles);
+	template <class Kernel>
+	void update_density_with_kernel(const Kernel& kh, NeighborList& neighbors_of_set, mParticleSet& particles);
+	template <class Kernel>
+	void update_density_with_kernel(const Kernel& kh, NeighborList& neighbors_of_set, NeighborList& neighbors_in_boundary, mParticleSet& particles, std::vector<mParticle>& boundary_particles);
 };
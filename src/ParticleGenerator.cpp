@@ -233,3 +233,48 @@ void ParticleGenerator::generate_sphere(std::vector<mParticle>& particles,
     }
     return;
 }
+
+void ParticleGenerator::generate_cube(mParticleSet& particles, size_t N, Eigen::Ref<RealVector3> origin, Eigen::Ref<RealVector3> v0, Real halfExtent, bool do_clear, bool hollow)
+{
+    std::vector<mParticle> ps;
+    generate_cube(ps, N, origin, v0, halfExtent, true, hollow);
+
+    if (do_clear)
+        particles.clear();
+    for (auto& p : ps)
+        particles.push_back(p);
+}
+
+void ParticleGenerator::generate_two_colliding_cubes(mParticleSet& particles, size_t N, Real radius)
+{
+    std::vector<mParticle> ps;
+    generate_two_colliding_cubes(ps, N, radius);
+    particles.from_particles(ps);
+}
+
+void ParticleGenerator::generate_two_freefall_cubes(mParticleSet& particles, size_t N, Real radius)
+{
+    std::vector<mParticle> ps;
+    generate_two_freefall_cubes(ps, N, radius);
+    particles.from_particles(ps);
+}
+
+void ParticleGenerator::generate_cuboid_box(mParticleSet& particles,
+                         Eigen::Ref<RealVector3> v0,
+                         mCuboid cuboid,
+                         Real radius,
+                         bool do_clear,
+                         bool side_open,
+                         bool rotate,
+                         Real angle,
+                         Real rotation_center_y,
+                         Real rotation_center_z)
+{
+    std::vector<mParticle> ps;
+    generate_cuboid_box(ps, v0, cuboid, radius, true, side_open, rotate, angle, rotation_center_y, rotation_center_z);
+
+    if (do_clear)
+        particles.clear();
+    for (auto& p : ps)
+        particles.push_back(p);
+}
@@ -46,6 +46,26 @@ public:
                          Real radius,
                          bool do_clear=false);
 
+    // the fluid is kept in a mParticleSet, these generate the same particles straight into it
+    void generate_cube(mParticleSet& particles, size_t N,
+                       Eigen::Ref<RealVector3> origin,
+                       Eigen::Ref<RealVector3> v0,
+                       Real halfExtent=1.0,
+                       bool do_clear=true,
+                       bool hollow=false);
+    void generate_two_colliding_cubes(mParticleSet& particles, size_t N, Real radius);
+    void generate_two_freefall_cubes(mParticleSet& particles, size_t N, Real radius);
+    void generate_cuboid_box(mParticleSet& particles,
+                             Eigen::Ref<RealVector3> v0,
+                             mCuboid cuboid,
+                             Real radius,
+                             bool do_clear=false,
+                             bool side_open=false,
+                             bool rotate=false,
+                             Real angle=0,
+                             Real rotation_center_y=0,
+                             Real rotation_center_z=0);
+
 
 private:
 };
@@ -0,0 +1,318 @@
+#pragma once
+
+#include "math_types.hpp"
+
+#include <cmath>
+#include <vector>
+
+namespace Simulator
+{
+	// the numbers are the ones KernelHandler always used for the splines (order of the spline)
+	enum KernelType { M4 = 4, M5 = 5, M6 = 6, WENDLAND_C2 = 8 };
+
+/*
+ *  shape functions of the kernels, w(q) and dw/dq with q = |x_i - x_j| / h.
+ *  support is the radius of the kernel in units of h, sigma the normalization in Dim dimensions.
+ */
+	template <int Dim>
+	struct M4Shape {
+		static Real support() { return 2.0; }
+		static Real sigma()
+		{
+			return (Dim == 1) ? 2.0/3.0 : (Dim == 2) ? 10.0/(7.0*(Real)M_PI) : 1.0/(Real)M_PI;
+		}
+
+		static inline Real w(Real q)
+		{
+			if (q >= 2.0) return 0.0;
+			Real a = 2.0 - q;
+			Real value = 0.25 * a*a*a;
+			if (q < 1.0) { Real b = 1.0 - q; value -= b*b*b; }
+			return value;
+		}
+
+		static inline Real dw(Real q)
+		{
+			if (q >= 2.0) return 0.0;
+			Real a = 2.0 - q;
+			Real slope = -0.75 * a*a;
+			if (q < 1.0) { Real b = 1.0 - q; slope += 3.0 * b*b; }
+			return slope;
+		}
+	};
+
+	template <int Dim>
+	struct M5Shape {
+		static Real support() { return 2.5; }
+		static Real sigma()
+		{
+			return (Dim == 1) ? 1.0/24.0 : (Dim == 2) ? 96.0/(1199.0*(Real)M_PI) : 1.0/(20.0*(Real)M_PI);
+		}
+
+		static inline Real w(Real q)
+		{
+			if (q >= 2.5) return 0.0;
+			Real a = 2.5 - q;
+			Real value = a*a*a*a;
+			if (q < 1.5) { Real b = 1.5 - q; value -= 5.0 * b*b*b*b; }
+			if (q < 0.5) { Real c = 0.5 - q; value += 10.0 * c*c*c*c; }
+			return value;
+		}
+
+		static inline Real dw(Real q)
+		{
+			if (q >= 2.5) return 0.0;
+			Real a = 2.5 - q;
+			Real slope = -4.0 * a*a*a;
+			if (q < 1.5) { Real b = 1.5 - q; slope += 20.0 * b*b*b; }
+			if (q < 0.5) { Real c = 0.5 - q; slope -= 40.0 * c*c*c; }
+			return slope;
+		}
+	};
+
+	template <int Dim>
+	struct M6Shape {
+		static Real support() { return 3.0; }
+		static Real sigma()
+		{
+			return (Dim == 1) ? 1.0/120.0 : (Dim == 2) ? 7.0/(478.0*(Real)M_PI) : 1.0/(120.0*(Real)M_PI);
+		}
+
+		static inline Real w(Real q)
+		{
+			if (q >= 3.0) return 0.0;
+			Real a = 3.0 - q;
+			Real value = a*a*a*a*a;
+			if (q < 2.0) { Real b = 2.0 - q; value -= 6.0 * b*b*b*b*b; }
+			if (q < 1.0) { Real c = 1.0 - q; value += 15.0 * c*c*c*c*c; }
+			return value;
+		}
+
+		static inline Real dw(Real q)
+		{
+			if (q >= 3.0) return 0.0;
+			Real a = 3.0 - q;
+			Real slope = -5.0 * a*a*a*a;
+			if (q < 2.0) { Real b = 2.0 - q; slope += 30.0 * b*b*b*b; }
+			if (q < 1.0) { Real c = 1.0 - q; slope -= 75.0 * c*c*c*c; }
+			return slope;
+		}
+	};
+
+	// Wendland C2 with support 2h, in 1D the C2 function has one power less
+	template <int Dim>
+	struct WendlandC2Shape {
+		static Real support() { return 2.0; }
+		static Real sigma()
+		{
+			return (Dim == 1) ? 5.0/8.0 : (Dim == 2) ? 7.0/(4.0*(Real)M_PI) : 21.0/(16.0*(Real)M_PI);
+		}
+
+		static inline Real w(Real q)
+		{
+			if (q >= 2.0) return 0.0;
+			Real a = 1.0 - 0.5*q;
+			if (Dim == 1)
+				return a*a*a * (1.5*q + 1.0);
+			return a*a*a*a * (2.0*q + 1.0);
+		}
+
+		static inline Real dw(Real q)
+		{
+			if (q >= 2.0) return 0.0;
+			Real a = 1.0 - 0.5*q;
+			if (Dim == 1)
+				return -3.0 * a*a * q;
+			return -5.0 * a*a*a * q;
+		}
+	};
+
+/*
+ *  kernel of fixed type and dimension, the normalization sigma / h^Dim is computed once when the radius is set.
+ *  everything is inline and works on fixed-size vectors, so the evaluation in the particle loops
+ *  compiles down to a few flops without any allocation or switch.
+ */
+	template <template <int> class Shape, int Dim = 3>
+	class SPHKernel {
+	public:
+		typedef Eigen::Matrix<Real, Dim, 1, Eigen::DontAlign> VectorD;
+
+		SPHKernel() { set_neighbor_search_radius(1.0); }
+		SPHKernel(Real radius) { set_neighbor_search_radius(radius); }
+
+		void set_neighbor_search_radius(Real radius)
+		{
+			neighbor_search_radius = radius;
+			h = radius / Shape<Dim>::support();
+			inv_h = 1.0 / h;
+
+			Real h_pow = 1.0;
+			for (int i=0; i<Dim; ++i)
+				h_pow *= h;
+
+			norm_factor = Shape<Dim>::sigma() / h_pow;
+			grad_factor = norm_factor * inv_h;
+		}
+
+		Real get_neighbor_search_radius() const { return neighbor_search_radius; }
+
+		inline Real compute_kernel( const VectorD& source_particle, const VectorD& destination_particle ) const
+		{
+			return compute_kernel_of_distance( (source_particle - destination_particle).norm() );
+		}
+
+		inline Real compute_kernel_of_distance( Real r ) const
+		{
+			return norm_factor * Shape<Dim>::w(r * inv_h);
+		}
+
+		inline VectorD gradient_of_kernel( const VectorD& source_particle, const VectorD& destination_particle ) const
+		{
+			VectorD x_ij = source_particle - destination_particle;
+			return gradient_factor_of_distance( x_ij.norm() ) * x_ij;
+		}
+
+		// the gradient is this factor times x_ij, with r = |x_ij|
+		inline Real gradient_factor_of_distance( Real r ) const
+		{
+			if (r < epsilon)
+				return 0.0;
+
+			return grad_factor * Shape<Dim>::dw(r * inv_h) / r;
+		}
+
+	private:
+		Real neighbor_search_radius;
+		Real h;
+		Real inv_h;
+		Real norm_factor;
+		Real grad_factor;
+		Real epsilon = 0.000001;
+	};
+
+/*
+ *  same kernel, but W and the gradient are read from tables and linearly interpolated,
+ *  so the piecewise polynomials are not evaluated per pair. this pays off most for M5 and M6.
+ *  W is tabulated over q^2 and needs no square root. the gradient table holds dw/dq / q over q,
+ *  which stays finite at q = 0 for all kernels but is not smooth in q^2 there, so the gradient is table(q) * x_ij.
+ */
+	template <template <int> class Shape, int Dim = 3>
+	class TabulatedSPHKernel {
+	public:
+		typedef Eigen::Matrix<Real, Dim, 1, Eigen::DontAlign> VectorD;
+
+		TabulatedSPHKernel() {}
+		TabulatedSPHKernel(Real radius, size_t table_size=4096) : table_size(table_size) { set_neighbor_search_radius(radius); }
+
+		void set_table_size(size_t size) { table_size = size; }
+
+		// builds the tables, so better not call it inside the particle loops
+		void set_neighbor_search_radius(Real radius)
+		{
+			neighbor_search_radius = radius;
+			Real h = radius / Shape<Dim>::support();
+
+			Real h_pow = 1.0;
+			for (int i=0; i<Dim; ++i)
+				h_pow *= h;
+
+			Real norm_factor = Shape<Dim>::sigma() / h_pow;
+			Real grad_factor = norm_factor / (h * h);
+
+			inv_h = 1.0 / h;
+			max_q = Shape<Dim>::support();
+			Real dq = max_q / (table_size - 1);
+			inv_dq = 1.0 / dq;
+
+			inv_h2 = inv_h * inv_h;
+			max_q2 = max_q * max_q;
+			Real dq2 = max_q2 / (table_size - 1);
+			inv_dq2 = 1.0 / dq2;
+
+			W_table.resize(table_size);
+			gradient_table.resize(table_size);
+
+			for (size_t k=0; k<table_size; ++k)
+			{
+				W_table[k] = norm_factor * Shape<Dim>::w( std::sqrt(k * dq2) );
+
+				Real q = k * dq;
+				gradient_table[k] = (k == 0) ? 0.0 : grad_factor * Shape<Dim>::dw(q) / q;
+			}
+			// dw/dq / q at q = 0 is only known as a limit, so it is extrapolated from the next entries
+			if (table_size > 2)
+				gradient_table[0] = 2.0 * gradient_table[1] - gradient_table[2];
+		}
+
+		Real get_neighbor_search_radius() const { return neighbor_search_radius; }
+
+		inline Real compute_kernel( const VectorD& source_particle, const VectorD& destination_particle ) const
+		{
+			return compute_kernel_of_squared_distance( (source_particle - destination_particle).squaredNorm() );
+		}
+
+		inline Real compute_kernel_of_distance( Real r ) const
+		{
+			return compute_kernel_of_squared_distance( r * r );
+		}
+
+		inline Real compute_kernel_of_squared_distance( Real r2 ) const
+		{
+			return lookup( W_table, r2 * inv_h2, max_q2, inv_dq2 );
+		}
+
+		inline VectorD gradient_of_kernel( const VectorD& source_particle, const VectorD& destination_particle ) const
+		{
+			VectorD x_ij = source_particle - destination_particle;
+			return gradient_factor_of_distance( x_ij.norm() ) * x_ij;
+		}
+
+		// the gradient is this factor times x_ij, with r = |x_ij|
+		inline Real gradient_factor_of_distance( Real r ) const
+		{
+			if (r < epsilon)
+				return 0.0;
+
+			return lookup( gradient_table, r * inv_h, max_q, inv_dq );
+		}
+
+	private:
+		Real neighbor_search_radius = 0.0;
+		size_t table_size = 4096;
+		Real inv_h = 0.0;
+		Real inv_h2 = 0.0;
+		Real max_q = 0.0;
+		Real max_q2 = 0.0;
+		Real inv_dq = 0.0;
+		Real inv_dq2 = 0.0;
+		Real epsilon = 0.000001;
+
+		std::vector<Real> W_table;
+		std::vector<Real> gradient_table;
+
+		// x is q or q^2, with max_x and inv_dx of the matching table
+		inline Real lookup( const std::vector<Real>& table, Real x, Real max_x, Real inv_dx ) const
+		{
+			if (x >= max_x)
+				return 0.0;
+
+			Real t = x * inv_dx;
+			size_t k = static_cast<size_t>(t);
+			if (k >= table_size - 1) // x just below max_x can round up to the last entry
+				return table[table_size - 1];
+
+			Real frac = t - k;
+			return table[k] + frac * (table[k+1] - table[k]);
+		}
+	};
+
+	typedef SPHKernel<M4Shape, 3> 		  M4Kernel;
+	typedef SPHKernel<M5Shape, 3> 		  M5Kernel;
+	typedef SPHKernel<M6Shape, 3> 		  M6Kernel;
+	typedef SPHKernel<WendlandC2Shape, 3> WendlandC2Kernel;
+
+	typedef TabulatedSPHKernel<M4Shape, 3> 		   TabulatedM4Kernel;
+	typedef TabulatedSPHKernel<M5Shape, 3> 		   TabulatedM5Kernel;
+	typedef TabulatedSPHKernel<M6Shape, 3> 		   TabulatedM6Kernel;
+	typedef TabulatedSPHKernel<WendlandC2Shape, 3> TabulatedWendlandC2Kernel;
+}
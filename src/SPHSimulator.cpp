@@ -7,6 +7,10 @@
 #include <CompactNSearch/CompactNSearch>
 
 #include <random>
+#include <numeric>
+#include <utility>
+#include <cstdio>
+#include <cstring>
 
 using merely3d::renderable;
 using merely3d::Rectangle;
@@ -25,6 +29,7 @@ SPHSimulator::SPHSimulator(int N, Real uParticle_len, Real dt, Real eta, Real B,
 																				  rest_density(rest_density), //
 																				  N(N), //
 																				  particleFunc(rest_density, B, alpha), //
+																				  pbfSolver(rest_density), //
 																				  solver_type(solver_type) //
 {
 	set_particle_radius(uParticle_len/2);  // uParticle_len = 2.0 * radius
@@ -92,19 +97,9 @@ const std::vector<RealVector3>& SPHSimulator::get_boundary_positions() const
 	return boundary_positions;
 }
 
-void SPHSimulator::set_positions()
-{
-	if (!positions.empty())
-		positions.clear();
-
-	for (auto& p : particles)
-		positions.push_back(RealVector3(p.position));
-}
-
 const std::vector<RealVector3>& SPHSimulator::get_positions() const
 {
-	//update_positions();
-	return positions;
+	return particles.positions;
 }
 
 void SPHSimulator::set_particle_radius(Real r)
@@ -135,15 +130,64 @@ void SPHSimulator::set_neighbor_search_radius(Real r)
 	kernelHandler.set_neighbor_search_radius(r);
 }
 
-void SPHSimulator::update_positions()
+void SPHSimulator::set_z_sort_interval(int k)
 {
-	for (size_t i=0; i<particles.size(); ++i)
+	z_sort_interval = k;
+}
+
+void SPHSimulator::set_kernel_lookup_table(bool enable)
+{
+	particleFunc.use_lookup_table(enable);
+	pbfSolver.use_lookup_table(enable);
+}
+
+void SPHSimulator::update_particle_order()
+{
+	if (z_sort_interval <= 0)
+		return;
+
+	if (z_sort_step % z_sort_interval == 0)
+		z_sort_particles();
+
+	++z_sort_step;
+}
+
+// particles that are close in space end up close in memory, which keeps the neighbor loops cache friendly
+// even after the fluid got mixed up. the records stay in generation order, see mParticleSet
+void SPHSimulator::z_sort_particles()
+{
+	neighborSearcher.z_order(particles.positions, 0, particles.size(), particle_order);
+	particles.reorder(particle_order);
+
+	// boundary particles only move as rigid bodies, so sorting them once is enough.
+	// the static and the moving part are sorted on their own, so moving_start_idx stays valid
+	if (!boundary_sorted && !boundary_particles.empty())
 	{
-        positions[i][0] = particles[i].position[0];
-        positions[i][1] = particles[i].position[1];
-        positions[i][2] = particles[i].position[2];
+		size_t n_static = static_boundary_size();
+		std::vector<size_t> moving_order;
+		neighborSearcher.z_order(boundary_positions, 0, n_static, particle_order);
+		neighborSearcher.z_order(boundary_positions, n_static, boundary_particles.size(), moving_order);
+		particle_order.insert(particle_order.end(), moving_order.begin(), moving_order.end());
+
+		boundary_original_indices.resize(boundary_particles.size());
+		std::iota(boundary_original_indices.begin(), boundary_original_indices.end(), 0);
+
+		mParticleSet::reorder_field(boundary_particles, particle_order);
+		mParticleSet::reorder_field(boundary_original_indices, particle_order);
+
+		set_boundary_positions();
+		neighborSearcher.set_boundary_particles_ptr(boundary_positions);
+		boundary_sorted = true;
 	}
-	neighborSearcher.set_particles_ptr(positions);
+
+	update_positions();
+	neighborSearcher.points_reordered();
+}
+
+// the neighbor search reads the positions of the particle set in place, it only has to know that they moved
+void SPHSimulator::update_positions()
+{
+	neighborSearcher.set_particles_ptr(particles.positions);
 }
 
 
@@ -154,23 +198,181 @@ void SPHSimulator::update_simulation()
 void SPHSimulator::update_sim_record_state()
 {
     SimulationState sim_state;
-    sim_state.particles = particles;
-    sim_rec.states.push_back(sim_state);
+    particles.to_particles(sim_state.particles);
+    record_state(std::move(sim_state));
+}
+
+void SPHSimulator::record_state(SimulationState sim_state)
+{
+    if (record_observer)
+        record_observer(sim_state);
+
+    if (sim_rec_writer.is_open())
+        sim_rec_writer.write_state(std::move(sim_state), sim_rec.sets);
+    else
+        sim_rec.states.push_back(sim_state);
+}
+
+bool SPHSimulator::open_sim_record(std::string fp)
+{
+    return sim_rec_writer.open(fp, sim_rec);
+}
+
+void SPHSimulator::set_record_queue(size_t queue_capacity)
+{
+    sim_rec_writer.start_async(queue_capacity);
+}
+
+void SPHSimulator::set_record_quantization(Real max_position_error, unsigned keyframe_interval)
+{
+    QuantizationSettings settings;
+    settings.max_position_error = max_position_error * sim_rec.unit_particle_length;
+    settings.keyframe_interval = keyframe_interval;
+    sim_rec_writer.set_codec(keyframe_interval > 1 ? DELTA_CODEC : QUANTIZED_CODEC, settings);
+}
+
+void SPHSimulator::set_record_observer(std::function<void(const SimulationState&)> observer)
+{
+    record_observer = observer;
 }
 
 void SPHSimulator::output_sim_record_bin(std::string fp)
 {
+    // the states are already on disk, closing the streamed file appends the index
+    if (sim_rec_writer.is_open())
+    {
+        sim_rec_writer.close();
+        return;
+    }
+
     std::ofstream file(fp);
     cereal::BinaryOutputArchive output(file); // stream to cout
     output(sim_rec);  //not good... maybe directly ar the vector
 }
 
+static const char checkpoint_magic[] = "SPHCKPT1";
+static const uint32_t checkpoint_version = 1;
+
+// RealVector3 is unaligned, so a vector of them is a packed array of 3 * n reals
+static void save_vectors(cereal::BinaryOutputArchive& ar, const std::vector<RealVector3>& v)
+{
+    uint64_t n = v.size();
+    ar(n);
+    ar(cereal::binary_data(v.data(), n * sizeof(RealVector3)));
+}
+
+static void load_vectors(cereal::BinaryInputArchive& ar, std::vector<RealVector3>& v)
+{
+    uint64_t n;
+    ar(n);
+    v.resize(n);
+    ar(cereal::binary_data(v.data(), n * sizeof(RealVector3)));
+}
+
+bool SPHSimulator::save_checkpoint(std::string fp, int step)
+{
+    // the checkpoint says how many states the record has, so they all have to be on disk first
+    sim_rec_writer.flush();
+    uint64_t recorded_states = sim_rec_writer.is_open() ? sim_rec_writer.number_of_states() : sim_rec.states.size();
+
+    std::string tmp_fp = fp + ".tmp";
+    {
+        std::ofstream file(tmp_fp, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            std::cout << "could not open " << tmp_fp << " for the checkpoint" << std::endl;
+            return false;
+        }
+        file.write(checkpoint_magic, 8);
+
+        cereal::BinaryOutputArchive ar(file);
+        uint32_t real_size = sizeof(Real);
+        uint64_t n = N;
+        ar(checkpoint_version, real_size);
+        ar(sim_rec.timestep, sim_rec.unit_particle_length, sim_rec.eta, sim_rec.rest_density, sim_rec.B, sim_rec.alpha, sim_rec.solver_type, n);
+        ar(step, recorded_states);
+        ar(z_sort_step, boundary_sorted);
+
+        save_vectors(ar, particles.positions);
+        save_vectors(ar, particles.velocities);
+        ar(particles.densities, particles.pressures, particles.original_indices, particles.mass);
+        ar(boundary_particles, boundary_original_indices);
+        save_scene_state(ar);
+
+        if (!file.good())
+        {
+            std::cout << "writing the checkpoint " << tmp_fp << " failed" << std::endl;
+            return false;
+        }
+    }
+
+    // a run killed while writing keeps the checkpoint before
+    if (std::rename(tmp_fp.c_str(), fp.c_str()) != 0)
+    {
+        std::cout << "could not move the checkpoint to " << fp << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int SPHSimulator::resume_from_checkpoint(std::string checkpoint_fp, std::string record_fp)
+{
+    std::ifstream file(checkpoint_fp, std::ios::binary);
+    char magic[8] = {};
+    file.read(magic, 8);
+    if (!file || std::memcmp(magic, checkpoint_magic, 8) != 0)
+        throw "Not a checkpoint file!";
+
+    cereal::BinaryInputArchive ar(file);
+    uint32_t version, real_size;
+    ar(version, real_size);
+    if (version != checkpoint_version || real_size != sizeof(Real))
+        throw "Checkpoint of another version or precision!";
+
+    SimulationRecord params;
+    uint64_t n;
+    ar(params.timestep, params.unit_particle_length, params.eta, params.rest_density, params.B, params.alpha, params.solver_type, n);
+    if (params.timestep != sim_rec.timestep || params.unit_particle_length != sim_rec.unit_particle_length || params.eta != sim_rec.eta ||
+        params.rest_density != sim_rec.rest_density || params.B != sim_rec.B || params.alpha != sim_rec.alpha ||
+        params.solver_type != sim_rec.solver_type || n != N)
+        throw "Checkpoint was written with other parameters!";
+
+    int step;
+    uint64_t recorded_states;
+    ar(step, recorded_states);
+    ar(z_sort_step, boundary_sorted);
+
+    size_t n_particles = particles.size();
+    size_t n_boundary = boundary_particles.size();
+
+    load_vectors(ar, particles.positions);
+    load_vectors(ar, particles.velocities);
+    ar(particles.densities, particles.pressures, particles.original_indices, particles.mass);
+    ar(boundary_particles, boundary_original_indices);
+    load_scene_state(ar);
+
+    if (particles.size() != n_particles || boundary_particles.size() != n_boundary)
+        throw "Checkpoint belongs to another scene!";
+
+    // the search is built again from the restored positions, its neighbor lists are sorted, so nothing else is kept
+    set_boundary_positions();
+    neighborSearcher.set_boundary_particles_ptr(boundary_positions);
+    update_positions();
+    neighborSearcher.points_reordered();
+
+    if (!sim_rec_writer.resume(record_fp, sim_rec, recorded_states))
+        throw "Could not continue the simulation record!";
+
+    std::cout << "resumed from " << checkpoint_fp << " at step " << step << " with " << recorded_states << " recorded states" << std::endl;
+    return step;
+}
+
 void SPHSimulator::print_all_particles()
 {
     std::cout<<"now print particles set, its size is "<<particles.size()<<std::endl;
     for(size_t i=0;i<particles.size();i++)
     {
-        mParticle particle(particles[i]);
+        mParticle particle(particles.particle(i));
         std::cout<<"position is"<< std::endl<<particle.position<<std::endl;
         std::cout<<"velocity is"<<  std::endl<<particle.velocity<<std::endl;
         std::cout<<"density is"<< std::endl<<particle.density<<std::endl;
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <functional>
 #include <Eigen/Geometry>
 #include <CompactNSearch/CompactNSearch>
 #include <cereal/types/vector.hpp>
@@ -14,8 +15,10 @@
 #include "KernelHandler.hpp"
 #include "Particle.hpp"
 #include "ParticleFunc.hpp"
+#include "PBFSolver.hpp"
 #include "ParticleGenerator.hpp"
 #include "sim_record.hpp"
+#include "sim_record_writer.hpp"
 
 using namespace Simulator;
 
@@ -41,10 +44,12 @@ public:
     void set_boundary_positions();
     //void set_boundary_volumes();
     void set_boundary_attribute();
-    void set_positions();
     void set_particle_radius(Real r);
     void set_N(size_t n);
     void set_neighbor_search_radius(Real r);
+    void set_z_sort_interval(int k); // 0 never reorders the particles
+    // the WCSPH and PBF loops read the kernel from the tables of TabulatedM4Kernel instead of evaluating M4Kernel
+    void set_kernel_lookup_table(bool enable);
 
 	void sample_density();
 
@@ -62,22 +67,39 @@ public:
 
     /*-----use cereal output particles to json file-----*/
     virtual void update_sim_record_state();
+    // from now on every recorded state goes straight to the file instead of into sim_rec.states
+    bool open_sim_record(std::string fp);
+    // the opened record is written by a background thread, queue_capacity states can wait for it
+    void set_record_queue(size_t queue_capacity);
+    // quantizes the recorded states, max_position_error is in units of the particle spacing.
+    // with a keyframe_interval above 1 only every keyframe_interval-th state is stored whole, the others as deltas
+    void set_record_quantization(Real max_position_error, unsigned keyframe_interval = 0);
+    // called with every recorded state before it is written, e.g. to mesh the frames while the simulation goes on
+    void set_record_observer(std::function<void(const SimulationState&)> observer);
+    const SimulationRecord& get_sim_record() const { return sim_rec; }
     void output_sim_record_bin(std::string fp);
     void print_all_particles();
    /*------cereal task over----------------------------*/
 
+    /*-----checkpoints to continue a run-----*/
+    // everything the next steps depend on, step is the one simulated next. written to fp.tmp first, then renamed to fp
+    bool save_checkpoint(std::string fp, int step);
+    // restores a checkpoint of the same scene and parameters and continues the record at the state it had then.
+    // returns the step to continue with, throws if the checkpoint does not fit this simulation
+    int resume_from_checkpoint(std::string checkpoint_fp, std::string record_fp);
+
 protected:
 	NeighborSearcher neighborSearcher;
 	KernelHandler 	 kernelHandler;
 	ParticleFunc 	 particleFunc;
+	PBFSolver 		 pbfSolver;
 	ParticleGenerator particleGenerator;
 
-    std::vector<RealVector3> positions;   //why we need this positions... neng
 	std::vector<RealVector3> boundary_positions;
 
 	//std::vector<Real> boundary_volumes;
 
-	std::vector<mParticle> particles;
+	mParticleSet particles;
 	std::vector<mParticle> boundary_particles;
 
     //Real unit_particle_length;
@@ -90,4 +112,24 @@ protected:
 
     /*----------this is for cereal-------------*/
     SimulationRecord sim_rec;
+    SimulationRecordWriter sim_rec_writer;
+    std::function<void(const SimulationState&)> record_observer;
+
+    // streamed to the record file if it is open, kept in sim_rec.states otherwise
+    void record_state(SimulationState sim_state);
+
+    /*----------reordering along the z-curve-------------*/
+    int z_sort_interval = 100;
+    int z_sort_step = 0;
+    bool boundary_sorted = false;
+    std::vector<size_t> particle_order;
+    std::vector<size_t> boundary_original_indices; // generation order of the boundary particles, empty until they are sorted
+
+    void update_particle_order(); // call at the start of a step, sorts every z_sort_interval steps
+    void z_sort_particles();
+    virtual size_t static_boundary_size() const { return boundary_particles.size(); }
+
+    // state of a scene that is not in the particles, e.g. how far the moving boundary got
+    virtual void save_scene_state(cereal::BinaryOutputArchive& ar) const { (void) ar; }
+    virtual void load_scene_state(cereal::BinaryInputArchive& ar) { (void) ar; }
 };
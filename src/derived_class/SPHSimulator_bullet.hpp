@@ -19,9 +19,6 @@ public:
             if (!particles.empty())
                 particles.clear();
 
-            if (!positions.empty())
-                positions.clear();
-
             if (!boundary_particles.empty())
                 boundary_particles.clear();
 
@@ -55,10 +52,9 @@ public:
             particleGenerator.generate_cuboid_box(boundary_particles,v,moving_cuboid,particle_radius,false);
 
 
-            set_positions();
             set_boundary_positions();
 
-            neighborSearcher.set_particles_ptr(positions);
+            neighborSearcher.set_particles_ptr(particles.positions);
             neighborSearcher.set_boundary_particles_ptr(boundary_positions);
     }
 };
@@ -21,9 +21,6 @@ public:
             if (!particles.empty())
                 particles.clear();
 
-            if (!positions.empty())
-                positions.clear();
-
             if (!boundary_particles.empty())
                 boundary_particles.clear();
 
@@ -48,10 +45,9 @@ public:
             origin = RealVector3(0.0, particle_radius*(test_cuboid.y_n-N-6), 3*particle_radius);
             particleGenerator.generate_cube(particles, N, origin, zero, particle_radius*N, false, false);
 
-            set_positions();
             set_boundary_positions();
 
-            neighborSearcher.set_particles_ptr(positions);
+            neighborSearcher.set_particles_ptr(particles.positions);
             neighborSearcher.set_boundary_particles_ptr(boundary_positions);
     }
 };
@@ -19,9 +19,6 @@ public:
             if (!particles.empty())
                 particles.clear();
 
-            if (!positions.empty())
-                positions.clear();
-
             if (!boundary_particles.empty())
                 boundary_particles.clear();
 
@@ -54,10 +51,9 @@ public:
             origin = RealVector3(0.0, 0.0, 10*particle_radius);
             particleGenerator.generate_cube(particles, N, origin, zero, particle_radius*N, false, false);
 
-            set_positions();
             set_boundary_positions();
 
-            neighborSearcher.set_particles_ptr(positions);
+            neighborSearcher.set_particles_ptr(particles.positions);
             neighborSearcher.set_boundary_particles_ptr(boundary_positions);
     }
 };
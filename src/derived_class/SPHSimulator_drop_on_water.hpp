@@ -19,9 +19,6 @@ public:
             if (!particles.empty())
                 particles.clear();
 
-            if (!positions.empty())
-                positions.clear();
-
             if (!boundary_particles.empty())
                 boundary_particles.clear();
 
@@ -77,10 +74,9 @@ public:
             sim_rec.sets.insert(sim_rec.sets.end(), set1.begin(), set1.end());
             //
 
-            set_positions();
             set_boundary_positions();
 
-            neighborSearcher.set_particles_ptr(positions);
+            neighborSearcher.set_particles_ptr(particles.positions);
             neighborSearcher.set_boundary_particles_ptr(boundary_positions);
     }
 };
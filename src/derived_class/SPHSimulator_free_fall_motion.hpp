@@ -27,12 +27,8 @@ public:
             if (!particles.empty())
                 particles.clear();
 
-            if (!positions.empty())
-                positions.clear();
-
             particleGenerator.generate_two_freefall_cubes(particles, N, particle_radius*N);
-            set_positions();
-            neighborSearcher.set_particles_ptr(positions);
+            neighborSearcher.set_particles_ptr(particles.positions);
     }
 
 };
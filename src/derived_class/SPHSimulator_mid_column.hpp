@@ -21,9 +21,6 @@ public:
             if (!particles.empty())
                 particles.clear();
 
-            if (!positions.empty())
-                positions.clear();
-
             if (!boundary_particles.empty())
                 boundary_particles.clear();
 
@@ -62,10 +59,9 @@ public:
             //particleGenerator.generate_cube(particles, N, origin, zero, zero, particle_radius*N, false, false);
             particleGenerator.generate_cube(particles, N, origin, zero, particle_radius*N, false, false);
 
-            set_positions();
             set_boundary_positions();
 
-            neighborSearcher.set_particles_ptr(positions);
+            neighborSearcher.set_particles_ptr(particles.positions);
             neighborSearcher.set_boundary_particles_ptr(boundary_positions);
     }
 };
@@ -44,16 +44,35 @@ public:
 	virtual void update_sim_record_state() override
 	{
 		SimulationState sim_state;
-    	sim_state.particles = particles;
-		sim_state.moving_boundary_particles = std::vector<mParticle>(boundary_particles.begin()+moving_start_idx, boundary_particles.end());
-   		sim_rec.states.push_back(sim_state);
+    	particles.to_particles(sim_state.particles);
+		sim_state.moving_boundary_particles.resize(boundary_particles.size() - moving_start_idx);
+
+		// moving boundary in generation order, like the fluid
+		for (size_t i=moving_start_idx; i<boundary_particles.size(); ++i)
+		{
+			size_t original_i = boundary_original_indices.empty() ? i : boundary_original_indices[i];
+			sim_state.moving_boundary_particles[original_i - moving_start_idx] = boundary_particles[i];
+		}
+   		record_state(std::move(sim_state));
 	}
 
 protected:
+	virtual size_t static_boundary_size() const override { return moving_start_idx; }
+
+	virtual void save_scene_state(cereal::BinaryOutputArchive& ar) const override
+	{
+		ar(count, moving_start_idx, mid_point, amp, rotation_center[0], rotation_center[1], rotation_center[2]);
+	}
+
+	virtual void load_scene_state(cereal::BinaryInputArchive& ar) override
+	{
+		ar(count, moving_start_idx, mid_point, amp, rotation_center[0], rotation_center[1], rotation_center[2]);
+	}
+
 	int count = 0;
 	int moving_start_idx;
-	double mid_point;
-	double amp;
+	double mid_point = 0.0;
+	double amp = 0.0;
 	RealVector3 rotation_center;
 
 	int mode;
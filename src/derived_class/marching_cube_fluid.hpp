@@ -3,13 +3,15 @@
 
 #include "marching_cube.hpp"
 #include "sim_record.hpp"
+#include "sim_record_reader.hpp"
 #include "Particle.hpp"
 #include "visual.hpp"
 #include "math_types.hpp"
 #include "NeighborSearcher.hpp"
-#include "KernelHandler.hpp"
+#include "SPHKernels.hpp"
 #include "ParticleFunc.hpp"
 #include "marching_cubes_lut.hpp"
+#include "mesh_record.hpp"
 
 #include <math.h>       /* sqrt */
 #include <iostream>
@@ -29,7 +31,7 @@ public:
 
 	marching_cube_fluid(float unit_length, Real c, std::string input_file) : marching_cube(unit_length), c(c), pf(1000, 1000, 0.08)
 	{
-		load_particle_series(input_file);
+		open_particle_series(input_file);
 		load_next_particles();
 		min_x = min_y = min_z = MAX;
 		max_x = max_y = max_z = MIN;
@@ -39,18 +41,86 @@ public:
 		kh.set_neighbor_search_radius(search_radius);
     }
 
-	~marching_cube_fluid() noexcept
+	// reads no record, the states are passed to set_state one by one (see marching_cube_pipeline.hpp)
+	marching_cube_fluid(float unit_length, Real c, const SimulationRecord& header) : marching_cube(unit_length), c(c), pf(1000, 1000, 0.08)
+	{
+		search_radius = header.unit_particle_length * header.eta * 2;
+		particle_unit = header.unit_particle_length;
+		min_x = min_y = min_z = MAX;
+		max_x = max_y = max_z = MIN;
+
+		ns.set_neighbor_search_radius(search_radius);
+		kh.set_neighbor_search_radius(search_radius);
+	}
+
+	// the grid of a frame only depends on its particles and the grid of the frame before,
+	// so it can be followed ahead of the meshing, which then runs on any other instance
+	struct GridBounds {
+		Real min_x, max_x, min_y, max_y, min_z, max_z;
+	};
+
+	void set_state(const SimulationState& state)
 	{
-		voxel_vertices.shrink_to_fit();
-		voxels.clear();
+		current_state = state;
+		split_particles();
+	}
 
-		mesh_vertex_vector.clear();
-		mesh_triangle_vector.clear();
+	// set_grid_size for the first frame, update_grid_size for the ones after it
+	GridBounds follow_grid(bool first_frame)
+	{
+		if (first_frame)
+			set_grid_size();
+		else
+			update_grid_size();
+		return GridBounds{min_x, max_x, min_y, max_y, min_z, max_z};
+	}
 
-	    particles_series.shrink_to_fit();
+	// meshes the state of set_state on the grid follow_grid gave for it, like the constructor and update_marching_cube do
+	void mesh_state(const GridBounds& grid, bool first_frame)
+	{
+		min_x = grid.min_x; max_x = grid.max_x;
+		min_y = grid.min_y; max_y = grid.max_y;
+		min_z = grid.min_z; max_z = grid.max_z;
+		update_grid_lengths();
+
+		if (first_frame)
+		{
+			start_marching_cube();
+			return;
+		}
+		pick_up_particles();
+		march();
+	}
+
+	// reconstruct on the sparse narrow band around the particles instead of the dense grid of the bounding box
+	void set_sparse(bool sparse)
+	{
+		sparse_requested = sparse;
+		use_sparse_phi = sparse_requested || use_anisotropic;
+	}
+
+	// anisotropic kernels after Yu and Turk, "Reconstructing Surfaces of Particle-Based Fluids Using Anisotropic Kernels".
+	// every particle gets a smoothed center and a matrix G from the weighted covariance of its neighbors, its kernel
+	// is det(G) W(|G r|), flattened along the surface and stretched along thin sheets. the field is splatted, so it
+	// always uses the sparse grid, and the normals are taken from its gradient on the grid
+	void set_anisotropic(bool anisotropic)
+	{
+		use_anisotropic = anisotropic;
+		use_sparse_phi = sparse_requested || use_anisotropic;
+	}
+
+	void output_mesh_data(mMeshData& md)
+	{
+		output_marching_indices(md.faces);
+		output_marching_vertices_and_normals(md.vertices_and_normals);
+		md.bounding_box = Vector3f(total_x_length, total_y_length, total_z_length);
+		md.origin = origin;
+	}
+
+	~marching_cube_fluid() noexcept
+	{
 	    current_particles.shrink_to_fit();
 	    grid_position.shrink_to_fit();
-	    particle_positions.shrink_to_fit();
 	}
 
 
@@ -62,14 +132,14 @@ public:
 
 		update_grid_size();
 		pick_up_particles();
+		march();
+    }
+
+    void march()
+    {
         initialize_vertices();
 
     	compute_vertices_phi(); // for each vertices, compute its phi value
-    	mark_vertices();
-        initialize_edges();
-    	initialize_voxels();
-    	generate_bitcode();
-        //
     	bitcode_to_mesh_vertices();
     }
 
@@ -78,7 +148,7 @@ public:
     {
         total_lost = 0;
 
-        auto dps = discarded_particles_series[count];
+        const auto& dps = current_discarded_particles;
 
         if (!dps.empty())
         {
@@ -98,13 +168,28 @@ public:
 
     void load_next_particles()
     {
-        if (count >= particles_series.size())
+        if (count >= sim_reader.number_of_states())
         {
             end = true;
             return;
         }
 
-        current_particles = particles_series[count];
+        // only this frame is decoded from the record
+        sim_reader.read_state(count, current_state);
+        split_particles();
+    }
+
+    void split_particles()
+    {
+        current_particles.clear();
+        current_discarded_particles.clear();
+        for (auto& p : current_state.particles)
+        {
+            if (p.density >= 185.0)
+                current_particles.push_back(p);
+            else
+                current_discarded_particles.push_back(p);
+        }
     }
 
     void update_grid_size()
@@ -151,6 +236,11 @@ public:
         max_y = max_y + max_y_unit * 2.0 * du;
         max_z = max_z + max_z_unit * 2.0 * du;
 
+        update_grid_lengths();
+    }
+
+    void update_grid_lengths()
+    {
         total_x_length = static_cast<float>(max_x - min_x);
         total_y_length = static_cast<float>(max_y - min_y);
         total_z_length = static_cast<float>(max_z - min_z);
@@ -158,7 +248,6 @@ public:
         origin = Vector3f(static_cast<float>(max_x + min_x)*0.5f, static_cast<float>(max_y + min_y)*0.5f, static_cast<float>(min_z));
 
         update_voxel();
-
     }
 
 
@@ -203,13 +292,7 @@ public:
         max_y = max_y_unit;
         max_z = max_z_unit;
 
-        total_x_length = static_cast<float>(max_x_unit-min_x_unit);
-        total_y_length = static_cast<float>(max_y_unit-min_y_unit);
-        total_z_length = static_cast<float>(max_z_unit-min_z_unit);
-
-        origin = Vector3f(static_cast<float>(max_x_unit+min_x_unit)*0.5f, static_cast<float>(max_y_unit+min_y_unit)*0.5f, static_cast<float>(min_z_unit));
-
-        update_voxel();
+        update_grid_lengths();
     }
 
     void update_voxel()
@@ -227,33 +310,14 @@ public:
     {
         total_lost = 0;
 
-        auto dps = discarded_particles_series[count];
-
-        if (!dps.empty())
-        {
-            for (auto& dp : dps)
-            {
-                if (static_cast<float>(dp.position[0])-origin[0] < total_x_length*0.5f && static_cast<float>(dp.position[1])-origin[1] < total_y_length*0.5f && static_cast<float>(dp.position[2])-origin[2] < total_z_length)
-                {
-                    ;
-                } else {
-                    ++total_lost;
-                }
-            }
-        }
-
-        auto ps = particles_series[count];
-
-        if (!ps.empty())
+        // the discarded and the kept particles are counted the same way, so all particles of the frame are checked
+        for (auto& p : current_state.particles)
         {
-            for (auto& p : ps)
+            if (static_cast<float>(p.position[0])-origin[0] < total_x_length*0.5f && static_cast<float>(p.position[1])-origin[1] < total_y_length*0.5f && static_cast<float>(p.position[2])-origin[2] < total_z_length)
             {
-                if (static_cast<float>(p.position[0])-origin[0] < total_x_length*0.5f && static_cast<float>(p.position[1])-origin[1] < total_y_length*0.5f && static_cast<float>(p.position[2])-origin[2] < total_z_length)
-                {
-                    ;
-                } else {
-                    ++total_lost;
-                }
+                ;
+            } else {
+                ++total_lost;
             }
         }
     }
@@ -262,79 +326,103 @@ public:
 
 protected:
 	NeighborSearcher ns;
-	KernelHandler kh;
+	M4Kernel kh;
 	ParticleFunc pf;
 
-    std::vector<std::vector<mParticle>> particles_series;
-	std::vector<std::vector<mParticle>> discarded_particles_series;
+	// neighbor buffers reused over all frames
+	NeighborList vertex_neighbors;
+	NeighborList grid_neighbors;
+	NeighborList particle_neighbors;
+
+	// buffers of splat_particles_phi, reused over all frames
+	std::vector<std::array<long,6>> particle_support;
+	std::vector<std::vector<size_t>> block_particles; // particles reaching each block of sparse_phi
+
+    // the record is mapped and read frame by frame, it is never loaded as a whole
+    SimulationRecordReader sim_reader;
+    SimulationState current_state;
+	std::vector<mParticle> current_discarded_particles;
 
     std::vector<mParticle> current_particles;
     std::vector<RealVector3> grid_position;
-    std::vector<RealVector3> particle_positions;
+    mParticleSet fluid_particles; // SoA copy of current_particles the density and phi computation work on
 
     Real search_radius;
     Real particle_unit;
 
     Real min_x, max_x, min_y, max_y, min_z, max_z;
 
+    bool sparse_requested = false;
+    bool use_anisotropic = false;
+    // parameters of the anisotropic kernels, the values of the paper except k_n. the particles with few neighbors
+    // left after split_particles are at edges and splashes, the small kernels of the paper (0.5) made bumps out of them
+    Real anisotropic_smoothing = 0.9;     // lambda, how far the centers move to the weighted mean of their neighbors
+    Real anisotropic_max_ratio = 4.0;     // k_r, largest ratio between the longest and the shortest axis
+    size_t anisotropic_min_neighbors = 25; // N_eps, particles with fewer neighbors get a round kernel
+    Real anisotropic_isolated_scale = 1.0; // k_n, radius of that kernel relative to the isotropic one
+
+    // per fluid particle, filled by compute_anisotropic_kernels
+    std::vector<RealVector3> kernel_centers;
+    std::vector<RealMatrix3> kernel_matrices; // G
+    std::vector<Real> kernel_determinants;    // det(G)
+    std::vector<Real> kernel_radii;           // support of the kernel, the isotropic one is search_radius
+
 
     virtual void bitcode_to_mesh_vertices() override
     {
        marching_cube::bitcode_to_mesh_vertices();
 
-        // prepare data for further neighbor search (and further for normal computation)
-        std::vector<RealVector3> mesh_vertex_pos;
-        for(auto it = mesh_vertex_vector.begin(); it != mesh_vertex_vector.end(); ++it)
+        if (use_anisotropic)
         {
-            mesh_vertex_pos.push_back(RealVector3(it->position[0], it->position[1], it->position[2]));
+            compute_phi_gradient_normals();
         }
+        else
+        {
+            // prepare data for further neighbor search (and further for normal computation)
+            std::vector<RealVector3> mesh_vertex_pos;
+            mesh_vertex_pos.reserve(mesh_vertex_vector.size());
+            for(const auto& v : mesh_vertex_vector)
+            {
+                mesh_vertex_pos.push_back(RealVector3(v.position[0], v.position[1], v.position[2]));
+            }
 
-        update_particle_positions();
-        std::vector<std::vector<size_t>> neighbor_indices = ns.find_neighbors_within_radius(mesh_vertex_pos);
+            update_particle_positions();
+            ns.find_neighbors_within_radius(mesh_vertex_pos, vertex_neighbors);
 
-        compute_vertex_normal(mesh_vertex_pos, neighbor_indices);
+            compute_vertex_normal(mesh_vertex_pos, vertex_neighbors);
+        }
 
-        for(auto it = mesh_triangle_vector.begin(); it != mesh_triangle_vector.end(); ++it)
+        for(auto& t : mesh_triangle_vector)
         {
-            auto it_vtx = mesh_vertex_vector.begin();
-            auto it1 = it_vtx;
-            std::advance(it1, it->vertex_ids[0]);
-
-            auto it2 = it_vtx;
-            std::advance(it2, it->vertex_ids[1]);
-
-            auto it3 = it_vtx;
-            std::advance(it3, it->vertex_ids[2]);
+            const mMesh_vertex& v1 = mesh_vertex_vector[t.vertex_ids[0]];
+            const mMesh_vertex& v2 = mesh_vertex_vector[t.vertex_ids[1]];
+            const mMesh_vertex& v3 = mesh_vertex_vector[t.vertex_ids[2]];
 
-            Vector3f e1 = it2->position - it1->position ;
-            Vector3f e2 = it3->position - it1->position ;
+            Vector3f e1 = v2.position - v1.position ;
+            Vector3f e2 = v3.position - v1.position ;
 
-            if (it1->normal.dot(e1.cross(e2)) < 0.0)
-            {
-                unsigned int tmp = it->vertex_ids[0];
-                it->vertex_ids[0] = it->vertex_ids[1];
-                it->vertex_ids[1] = tmp;
-            }
+            if (v1.normal.dot(e1.cross(e2)) < 0.0)
+                std::swap(t.vertex_ids[0], t.vertex_ids[1]);
         }
     }
 
-    void compute_vertex_normal(std::vector<RealVector3>& mesh_vertex_pos, std::vector<std::vector<size_t>>& neighbor_indices)
+    void compute_vertex_normal(std::vector<RealVector3>& mesh_vertex_pos, const NeighborList& neighbor_indices)
     {
-        size_t i = 0;
-        for(auto it = mesh_vertex_vector.begin(); it != mesh_vertex_vector.end(); ++it)
+        // every vertex only writes its own normal
+        #pragma omp parallel for schedule(static)
+        for(size_t i = 0; i < mesh_vertex_vector.size(); ++i)
         {
-            it->normal = Vector3f(0.0f, 0.0f, 0.0f);
+            Vector3f& normal = mesh_vertex_vector[i].normal;
+            normal = Vector3f(0.0f, 0.0f, 0.0f);
             for (size_t j=0; j<neighbor_indices[i].size(); ++j)
             {
                 size_t idx = neighbor_indices[i][j];
 
-                RealVector3 gd = kh.gradient_of_kernel(mesh_vertex_pos[i], particle_positions[idx]);
+                RealVector3 gd = kh.gradient_of_kernel(mesh_vertex_pos[i], fluid_particles.positions[idx]);
                 Vector3f gf(static_cast<float>(gd[0]), static_cast<float>(gd[1]), static_cast<float>(gd[2]));
-                it->normal -= gf;
+                normal -= gf;
             }
-            it->normal.normalize();
-
-            ++i;
+            normal.normalize();
         }
     }
 
@@ -342,59 +430,35 @@ protected:
     void save_grid_position()
     {
 
-    	if (!grid_position.empty())
-    		grid_position.clear();
-
-    	for (unsigned int i=0; i<voxel_vertices.size(); ++i)
-    	{
-    		grid_position.push_back(RealVector3(static_cast<Real>(voxel_vertices[i].position[0]), static_cast<Real>(voxel_vertices[i].position[1]), static_cast<Real>(voxel_vertices[i].position[2])));
-    	}
+    	grid_position.resize(vertex_phi.size());
+
+    	// same order as vertex_phi
+    	const size_t plane = voxel_verticesx_n*voxel_verticesy_n;
+    	#pragma omp parallel for schedule(static)
+    	for (size_t k=0; k<voxel_verticesz_n; ++k)
+    		for (size_t j=0; j<voxel_verticesy_n; ++j)
+    			for (size_t i=0; i<voxel_verticesx_n; ++i)
+    			{
+    				Vector3f p = grid_vertex_position(i, j, k);
+    				grid_position[i + j*voxel_verticesx_n + k*plane] = RealVector3(static_cast<Real>(p[0]), static_cast<Real>(p[1]), static_cast<Real>(p[2]));
+    			}
     }
 
     void update_particle_positions()
     {
-    	if (!particle_positions.empty())
-    		particle_positions.clear();
-
-    	if (particle_positions.empty())
-    	{
-        	for (int i=0; i<current_particles.size(); ++i)
-        	{
-        		particle_positions.push_back(current_particles[i].position);
-        	}
-    	}
-
-    	ns.set_particles_ptr(particle_positions);
+    	fluid_particles.from_particles(current_particles);
+
+    	ns.set_particles_ptr(fluid_particles.positions);
     }
 
-    void load_particle_series(std::string fs)
+    void open_particle_series(std::string fs)
     {
-    	Visualization simData(fs);
-
-    	particles_series.clear();
-		discarded_particles_series.clear();
+    	if (!sim_reader.open(fs))
+    		throw "Could not read the simulation record!";
 
     	// set neighbor search radius
-    	search_radius = simData.sim_rec.unit_particle_length * simData.eta * 2;
-    	particle_unit = simData.sim_rec.unit_particle_length;
-
-    	for (int i=0; i<simData.total_frame_num; ++i)
-    	{
-
-			std::vector<mParticle> ps;
-			std::vector<mParticle> dps;
-			for (auto& p : simData.sim_rec.states[i].particles)
-			{
-				if (p.density >= 185.0)
-					ps.push_back(p);
-				else {
-					dps.push_back(p);
-				}
-			}
-
-    		particles_series.push_back(ps);
-			discarded_particles_series.push_back(dps);
-    	}
+    	search_radius = sim_reader.header().unit_particle_length * sim_reader.header().eta * 2;
+    	particle_unit = sim_reader.header().unit_particle_length;
     }
 
 
@@ -403,25 +467,37 @@ protected:
     virtual void compute_vertex_normal(const Vector3f& vertex, Vector3f& normal) override
     {
         // since we cannot directly use this to compute know, so we just override and make it empty,
+        // the normals are computed in bitcode_to_mesh_vertices. zero, so the winding of the base class does not
+        // depend on uninitialized memory for the triangles whose winding the real normals can not decide
+        normal = Vector3f(0.0f, 0.0f, 0.0f);
     }
 
     virtual void compute_vertices_phi() override
     {
+        if (use_sparse_phi)
+        {
+            splat_particles_phi();
+            return;
+        }
+
         update_particle_positions();
         save_grid_position(); // for compactNsearch. since compactNsearch need a vector of points position as input
-        std::vector<std::vector<size_t>> neighbor_indices = ns.find_neighbors_within_radius(grid_position);
+        ns.find_neighbors_within_radius(grid_position, grid_neighbors);
+        const NeighborList& neighbor_indices = grid_neighbors;
 
         // recompute density, ignore boundary particles
-        std::vector< std::vector<size_t> > tmp_n = ns.find_neighbors_within_radius( true );
+        ns.find_neighbors_within_radius( particle_neighbors, true );
 
-        pf.update_density(tmp_n, current_particles, search_radius);
+        pf.update_density(particle_neighbors, fluid_particles, search_radius);
 
-        size_t len = voxel_vertices.size();
+        // the sum of every vertex is in neighbor order on one thread, so the result does not depend on the number of threads
+        size_t len = vertex_phi.size();
+        #pragma omp parallel for schedule(static)
         for (size_t i=0; i<len; ++i)
         {
-            RealVector3 grid_vertex = grid_position[i];
+            const RealVector3& grid_vertex = grid_position[i];
 
-            voxel_vertices[i].phi = -c;
+            vertex_phi[i] = -c;
 
 
             for (size_t j=0; j<neighbor_indices[i].size(); ++j)
@@ -430,9 +506,7 @@ protected:
 
                 int idx = neighbor_indices[i][j];
 
-                mParticle p = current_particles[idx];
-
-                voxel_vertices[i].phi += p.mass / p.density * kh.compute_kernel(grid_vertex, p.position);
+                vertex_phi[i] += fluid_particles.mass / fluid_particles.densities[idx] * kh.compute_kernel(grid_vertex, fluid_particles.positions[idx]);
 
 
             }
@@ -442,8 +516,215 @@ protected:
         return;
     }
 
+    // same phi as compute_vertices_phi, but every particle adds its kernel to the grid vertices within its support,
+    // so only the blocks of sparse_phi near the particles are allocated and the grid is never searched.
+    // the blocks are allocated first, with the particles reaching them in order, then filled in parallel, one block per thread
+    void splat_particles_phi()
+    {
+        update_particle_positions();
+
+        // recompute density, ignore boundary particles
+        ns.find_neighbors_within_radius( particle_neighbors, true );
+
+        pf.update_density(particle_neighbors, fluid_particles, search_radius);
+
+        if (use_anisotropic)
+            compute_anisotropic_kernels();
+
+        sparse_phi.clear(-c);
+
+        const long B = static_cast<long>(mSparsePhi::block_n);
+        const Vector3f lowest = grid_vertex_position(0, 0, 0);
+        const double du = static_cast<double>(unit_voxel_length);
+        const long vertices_n[3] = { static_cast<long>(voxel_verticesx_n), static_cast<long>(voxel_verticesy_n), static_cast<long>(voxel_verticesz_n) };
+
+        for (auto& particles : block_particles)
+            particles.clear();
+        particle_support.resize(fluid_particles.size());
+
+        for (size_t p=0; p<fluid_particles.size(); ++p)
+        {
+            const RealVector3& x = use_anisotropic ? kernel_centers[p] : fluid_particles.positions[p];
+            const Real radius = use_anisotropic ? kernel_radii[p] : search_radius;
+
+            // grid vertices around the support, one more on each side, the kernel is zero at the ones outside
+            std::array<long,6>& support = particle_support[p]; // lowest x, y, z and highest x, y, z
+            bool on_grid = true;
+            for (int a=0; a<3; ++a)
+            {
+                support[a] = std::max(0L, static_cast<long>(floor((x[a] - radius - lowest[a]) / du)));
+                support[a+3] = std::min(vertices_n[a] - 1, static_cast<long>(ceil((x[a] + radius - lowest[a]) / du)));
+                on_grid = on_grid && support[a] <= support[a+3];
+            }
+            if (!on_grid)
+                continue;
+
+            for (long bz=support[2]/B; bz<=support[5]/B; ++bz)
+                for (long by=support[1]/B; by<=support[4]/B; ++by)
+                    for (long bx=support[0]/B; bx<=support[3]/B; ++bx)
+                    {
+                        size_t block = sparse_phi.block_offset(bx, by, bz) / (B*B*B);
+                        if (block >= block_particles.size())
+                            block_particles.resize(block + 1);
+                        block_particles[block].push_back(p);
+                    }
+        }
+
+        const size_t n_blocks = sparse_phi.block_keys.size();
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t block=0; block<n_blocks; ++block)
+        {
+            size_t bx, by, bz;
+            mSparsePhi::block_of_key(sparse_phi.block_keys[block], bx, by, bz);
+            const long block_lo[3] = { static_cast<long>(bx)*B, static_cast<long>(by)*B, static_cast<long>(bz)*B };
+            double* phi = &sparse_phi.phi[block*B*B*B];
+
+            // the particles are in order, so every vertex sums them up like the serial loop would
+            for (size_t p : block_particles[block])
+            {
+                const std::array<long,6>& support = particle_support[p];
+                const RealVector3& x = use_anisotropic ? kernel_centers[p] : fluid_particles.positions[p];
+                const Real weight = fluid_particles.mass / fluid_particles.densities[p];
+
+                for (long k=std::max(support[2], block_lo[2]); k<=std::min(support[5], block_lo[2]+B-1); ++k)
+                    for (long j=std::max(support[1], block_lo[1]); j<=std::min(support[4], block_lo[1]+B-1); ++j)
+                        for (long i=std::max(support[0], block_lo[0]); i<=std::min(support[3], block_lo[0]+B-1); ++i)
+                        {
+                            Vector3f g = grid_vertex_position(i, j, k);
+                            RealVector3 grid_vertex(static_cast<Real>(g[0]), static_cast<Real>(g[1]), static_cast<Real>(g[2]));
+                            Real w;
+                            if (use_anisotropic)
+                                w = kernel_determinants[p] * kh.compute_kernel_of_distance((kernel_matrices[p] * (grid_vertex - x)).norm());
+                            else
+                                w = kh.compute_kernel(grid_vertex, x);
+                            if (w > 0.0)
+                                phi[(i - block_lo[0]) + B*((j - block_lo[1]) + B*(k - block_lo[2]))] += weight * w;
+                        }
+            }
+        }
+    }
+
+    // smoothed center and G of every fluid particle, from its neighbors within search_radius weighted with 1 - (r/search_radius)^3
+    void compute_anisotropic_kernels()
+    {
+        const size_t n = fluid_particles.size();
+        kernel_centers.resize(n);
+        kernel_matrices.resize(n);
+        kernel_determinants.resize(n);
+        kernel_radii.resize(n);
+
+        #pragma omp parallel for schedule(static)
+        for (size_t i=0; i<n; ++i)
+        {
+            const RealVector3& xi = fluid_particles.positions[i];
+
+            // the particle itself has weight 1
+            Real weight_sum = 1.0;
+            RealVector3 mean = xi;
+            size_t n_neighbors = 1;
+            for (uint32_t j : particle_neighbors[i])
+            {
+                Real q = (fluid_particles.positions[j] - xi).norm() / search_radius;
+                if (j == i || q >= 1.0)
+                    continue;
+                Real w = 1.0 - q*q*q;
+                weight_sum += w;
+                mean += w * fluid_particles.positions[j];
+                ++n_neighbors;
+            }
+            mean /= weight_sum;
+
+            kernel_centers[i] = (1.0 - anisotropic_smoothing) * xi + anisotropic_smoothing * mean;
+
+            if (n_neighbors < anisotropic_min_neighbors)
+            {
+                kernel_matrices[i] = RealMatrix3::Identity() / anisotropic_isolated_scale;
+                kernel_determinants[i] = 1.0 / (anisotropic_isolated_scale * anisotropic_isolated_scale * anisotropic_isolated_scale);
+                kernel_radii[i] = search_radius * anisotropic_isolated_scale;
+                continue;
+            }
+
+            RealMatrix3 covariance = (xi - mean) * (xi - mean).transpose();
+            for (uint32_t j : particle_neighbors[i])
+            {
+                Real q = (fluid_particles.positions[j] - xi).norm() / search_radius;
+                if (j == i || q >= 1.0)
+                    continue;
+                RealVector3 d = fluid_particles.positions[j] - mean;
+                covariance += (1.0 - q*q*q) * d * d.transpose();
+            }
+            covariance /= weight_sum;
+
+            // the axes are the eigenvalues, the short ones are clamped to the longest / k_r,
+            // then they are scaled to a product of 1, so the kernel keeps its volume
+            Eigen::SelfAdjointEigenSolver<RealMatrix3> solver(covariance);
+            RealVector3 axes = solver.eigenvalues(); // increasing
+            Real longest = std::max(axes[2], Real(1e-12));
+            for (int a=0; a<3; ++a)
+                axes[a] = std::max(axes[a], longest / anisotropic_max_ratio);
+            axes /= std::cbrt(axes[0] * axes[1] * axes[2]);
+
+            const RealMatrix3& R = solver.eigenvectors();
+            kernel_matrices[i] = R * axes.cwiseInverse().asDiagonal() * R.transpose();
+            kernel_determinants[i] = 1.0;
+            kernel_radii[i] = search_radius * axes[2];
+        }
+    }
+
+    double sparse_phi_at(long i, long j, long k) const
+    {
+        const long B = static_cast<long>(mSparsePhi::block_n);
+        const double* block = sparse_phi.find_block(i / B, j / B, k / B);
+        return block ? block[(i % B) + B*((j % B) + B*(k % B))] : sparse_phi.background_phi;
+    }
 
+    // central differences, one sided at the border of the grid
+    Vector3f phi_gradient_at(long i, long j, long k) const
+    {
+        const long n[3] = { static_cast<long>(voxel_verticesx_n), static_cast<long>(voxel_verticesy_n), static_cast<long>(voxel_verticesz_n) };
+        const long v[3] = { i, j, k };
+        Vector3f gradient;
+        for (int a=0; a<3; ++a)
+        {
+            long lower[3] = { i, j, k };
+            long upper[3] = { i, j, k };
+            lower[a] = std::max(0L, v[a] - 1);
+            upper[a] = std::min(n[a] - 1, v[a] + 1);
+            double d = sparse_phi_at(upper[0], upper[1], upper[2]) - sparse_phi_at(lower[0], lower[1], lower[2]);
+            gradient[a] = static_cast<float>(d / ((upper[a] - lower[a]) * static_cast<double>(unit_voxel_length)));
+        }
+        return gradient;
+    }
+
+    // phi grows to the inside, so the normal is the negative gradient, interpolated from the corners of the voxel of the vertex
+    void compute_phi_gradient_normals()
+    {
+        const Vector3f lowest = grid_vertex_position(0, 0, 0);
+        const long n[3] = { static_cast<long>(voxel_verticesx_n), static_cast<long>(voxel_verticesy_n), static_cast<long>(voxel_verticesz_n) };
 
+        #pragma omp parallel for schedule(static)
+        for (size_t v=0; v<mesh_vertex_vector.size(); ++v)
+        {
+            Vector3f u = (mesh_vertex_vector[v].position - lowest) / unit_voxel_length;
+            long base[3];
+            float t[3];
+            for (int a=0; a<3; ++a)
+            {
+                base[a] = std::min(std::max(0L, static_cast<long>(floor(u[a]))), n[a] - 2);
+                t[a] = std::min(std::max(u[a] - static_cast<float>(base[a]), 0.0f), 1.0f);
+            }
+
+            Vector3f gradient(0.0f, 0.0f, 0.0f);
+            for (int corner=0; corner<8; ++corner)
+            {
+                int dx = corner & 1, dy = (corner >> 1) & 1, dz = corner >> 2;
+                float w = (dx ? t[0] : 1.0f - t[0]) * (dy ? t[1] : 1.0f - t[1]) * (dz ? t[2] : 1.0f - t[2]);
+                if (w > 0.0f)
+                    gradient += w * phi_gradient_at(base[0] + dx, base[1] + dy, base[2] + dz);
+            }
+            mesh_vertex_vector[v].normal = -gradient.normalized();
+        }
+    }
 
 };
 
@@ -29,11 +29,11 @@ public:
     // this function now only used to compute the unit sphere.
     virtual void compute_vertices_phi() override
     {
-        size_t len = voxel_vertices.size();
+        size_t len = vertex_phi.size();
         for(size_t i=0; i<len; ++i)
         {
-            float dist = voxel_vertices[i].position.norm();
-            voxel_vertices[i].phi = 1 - dist;
+            float dist = grid_vertex_position(i).norm();
+            vertex_phi[i] = 1 - dist;
         }
         return;
     }
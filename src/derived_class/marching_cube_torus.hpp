@@ -17,15 +17,16 @@ public:
 
 //protected:
    virtual void compute_vertices_phi() override{
-        size_t len = voxel_vertices.size();
+        size_t len = vertex_phi.size();
         for(size_t i=0; i< len; ++i)
         {
-            float x = voxel_vertices[i].position[0];
-            float y = voxel_vertices[i].position[1];
-            float z = voxel_vertices[i].position[2];
+            Vector3f position = grid_vertex_position(i);
+            float x = position[0];
+            float y = position[1];
+            float z = position[2];
 
             float temp = sqrt(x*x+y*y)-R;
-            voxel_vertices[i].phi = r*r-temp*temp-z*z;
+            vertex_phi[i] = r*r-temp*temp-z*z;
         }
         return;
     }
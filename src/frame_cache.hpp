@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace Simulator
+{
+/*
+ *  keeps the last used frames of a record in memory (least recently used ones are dropped first) and loads the
+ *  frames that are shown next on a background thread: read_ahead frames, step apart, after the last frame asked for.
+ *  all frames are loaded on that thread, so the loader does not have to be thread safe (SimulationRecordReader is not)
+ *  and reads the frames in playback order. a frame that is not in memory yet is asked for first, get waits for it.
+ *  when the loader throws, the exception is kept for that frame only and thrown by the next get of it,
+ *  the other frames are still loaded and the failed one is tried again after that get.
+ */
+    template <class Frame>
+    class FrameCache {
+    public:
+        typedef std::function<std::shared_ptr<const Frame>( size_t )> Loader;
+
+        FrameCache( size_t n_frames, size_t capacity, size_t read_ahead, Loader loader )
+            : n_frames(n_frames), capacity(std::max<size_t>(capacity, 2)), loader(loader)
+        {
+            // the frames read ahead must not push each other out
+            this->read_ahead = std::min(read_ahead, this->capacity - 2);
+            thread = std::thread(&FrameCache::load_loop, this);
+        }
+
+        ~FrameCache()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            work.notify_all();
+            thread.join();
+        }
+
+        FrameCache( const FrameCache& ) = delete;
+        FrameCache& operator=( const FrameCache& ) = delete;
+
+        // step is the number of frames between two shown frames, negative when playing backwards and 0 to not read ahead.
+        // the frame stays valid as long as it is held, even if the cache drops it
+        std::shared_ptr<const Frame> get( size_t index, int step )
+        {
+            if (index >= n_frames)
+                throw "Frame index out of range!";
+
+            std::unique_lock<std::mutex> lock(mutex);
+            window_start = index;
+            window_step = step;
+
+            auto it = frames.find(index);
+            if (it == frames.end())
+            {
+                wanted = index;
+                work.notify_one();
+                loaded.wait(lock, [this, index, &it]{ return errors.count(index) || (it = frames.find(index)) != frames.end(); });
+                wanted = none;
+
+                auto failed = errors.find(index);
+                if (failed != errors.end())
+                {
+                    std::exception_ptr error = failed->second;
+                    errors.erase(failed);
+                    lock.unlock();
+                    work.notify_one();
+                    std::rethrow_exception(error);
+                }
+            }
+            lru.splice(lru.begin(), lru, it->second.lru);
+            std::shared_ptr<const Frame> frame = it->second.frame;
+
+            lock.unlock();
+            work.notify_one(); // the frames to read ahead moved
+            return frame;
+        }
+
+    private:
+        static const size_t none = static_cast<size_t>(-1);
+
+        struct Entry {
+            std::shared_ptr<const Frame> frame;
+            std::list<size_t>::iterator lru;
+        };
+
+        const size_t n_frames;
+        const size_t capacity;
+        size_t read_ahead;
+        Loader loader;
+
+        std::unordered_map<size_t, Entry> frames;
+        std::list<size_t> lru; // most recently used first
+
+        std::mutex mutex;
+        std::condition_variable work;
+        std::condition_variable loaded;
+        size_t wanted = none;
+        size_t window_start = 0;
+        int window_step = 0;
+        std::unordered_map<size_t, std::exception_ptr> errors; // thrown by the loader, passed on to the get of that frame
+        bool stop = false;
+        std::thread thread;
+
+        size_t next_to_load() const
+        {
+            if (wanted != none && frames.find(wanted) == frames.end() && !errors.count(wanted))
+                return wanted;
+
+            for (size_t k=1; k<=read_ahead && window_step != 0; ++k)
+            {
+                long long i = static_cast<long long>(window_start) + static_cast<long long>(k) * window_step;
+                if (i < 0 || i >= static_cast<long long>(n_frames))
+                    break;
+                if (frames.find(static_cast<size_t>(i)) == frames.end() && !errors.count(static_cast<size_t>(i)))
+                    return static_cast<size_t>(i);
+            }
+            return none;
+        }
+
+        void load_loop()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                size_t index = none;
+                work.wait(lock, [this, &index]{ return stop || (index = next_to_load()) != none; });
+                if (stop)
+                    return;
+
+                lock.unlock();
+                std::shared_ptr<const Frame> frame;
+                try {
+                    frame = loader(index);
+                } catch (...) {
+                    lock.lock();
+                    errors[index] = std::current_exception();
+                    loaded.notify_all();
+                    continue;
+                }
+                lock.lock();
+
+                lru.push_front(index);
+                frames[index] = Entry{ frame, lru.begin() };
+                while (frames.size() > capacity)
+                {
+                    frames.erase(lru.back());
+                    lru.pop_back();
+                }
+                loaded.notify_all();
+            }
+        }
+    };
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <streambuf>
+#include <cstring>
+#include <cstddef>
+
+// read-only stream over a part of a mapped file, so cereal decodes a chunk in place
+struct MappedBuffer : public std::streambuf {
+    MappedBuffer( const char* begin, size_t size )
+    {
+        char* p = const_cast<char*>(begin);
+        setg(p, p, p + size);
+    }
+};
+
+template <class T>
+static T read_raw( const char* data )
+{
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return value;
+}
@@ -1,10 +1,11 @@
 #include "marching_cube.hpp"
 #include "marching_cubes_lut.hpp"
-#include <bitset>
+#include <limits>
 #include <iostream>
 #include <algorithm>
 #include <cstdlib>
 #include <vector>
+#include <cmath>
 
 using namespace std;
 
@@ -42,88 +43,56 @@ marching_cube::marching_cube(float unit_length):unit_voxel_length(unit_length)
     voxel_verticesx_n = voxelx_n+1;
     voxel_verticesy_n = voxely_n+1;
     voxel_verticesz_n = voxelz_n+1;
-    voxel_vertices.reserve(voxel_verticesx_n*voxel_verticesy_n*voxel_verticesz_n);
-    edges_vector_x.reserve(voxelx_n*(voxely_n+1)*(voxelz_n+1));
-    edges_vector_y.reserve((voxelx_n+1)*voxely_n*(voxelz_n+1));
-    edges_vector_z.reserve((voxelx_n+1)*(voxely_n+1)*voxelz_n);
 
-
-    cout<<"size of mvoxel_vertex "<<sizeof(mVoxel_vertex)<<endl;
-    cout<<"size of mvoxel "<<sizeof(mVoxel)<<endl;
     cout<<"size of mMesh_vertex "<<sizeof(mMesh_vertex)<<endl;
     cout<<"size of mMesh_triangle "<<sizeof(mMesh_triangle)<<endl;
 }
 
 marching_cube::~marching_cube()
 {
-	voxel_vertices.shrink_to_fit();
-	voxels.clear();
-
-	mesh_vertex_vector.clear();
-	mesh_triangle_vector.clear();
 }
 
 void marching_cube::start_marching_cube(){
     this->initialize_vertices();
     this->compute_vertices_phi(); // for each vertices, compute its phi value
-    this->mark_vertices();
-    this->initialize_edges();
-    this->initialize_voxels();
-    this->generate_bitcode();
-    //
     this->bitcode_to_mesh_vertices();
 
-    cout<<"total memeory for mvoxel_vertex is "<<sizeof(mVoxel_vertex)*voxel_vertices.size()<<endl;
-    cout<<"total memeory for mvoxel_edge is "<<sizeof(mVoxel_edge)*(  edges_vector_x.size()
-                                                                    + edges_vector_y.size()
-                                                                    + edges_vector_z.size()) << endl;
-
-    cout<<"total memeory for mvoxel is "<<sizeof(mVoxel)*voxels.size()<<endl;
+    cout<<"total memeory for vertex phi is "<<sizeof(double)*(vertex_phi.size() + sparse_phi.phi.size())<<endl;
+    cout<<"total memeory for edge cache is "<<sizeof(unsigned int)*(  bottom_edges.x_edges.size() + bottom_edges.y_edges.size()
+                                                                    + top_edges.x_edges.size() + top_edges.y_edges.size()
+                                                                    + z_edges.size()) << endl;
     cout<<"total memeory for mesh_vertex is "<<sizeof(mMesh_vertex)*mesh_vertex_vector.size()<<endl;
     cout<<"total memeory for mesh_triangle is "<<sizeof(mMesh_triangle)*mesh_triangle_vector.size()<<endl;
-
-    //release mvoxel_vertex space
-    //std::vector<mVoxel_vertex>().swap(voxel_vertices);
 }
 
 void marching_cube::output_marching_vertices(std::vector<float>& output_vertices){
     // now assign mesh_vertex_vector to output vertex
+    output_vertices.clear();
+    output_vertices.reserve(mesh_vertex_vector.size()*3);
 
-    // wtf ...
-    //if (output_vertices.empty())
-    //	output_vertices.reserve(len*3);
-
-    if (!output_vertices.empty())
-        output_vertices.clear();
-
-    for(auto it = mesh_vertex_vector.begin(); it!=mesh_vertex_vector.end();++it)
+    for(const auto& v : mesh_vertex_vector)
     {
-        output_vertices.push_back((*it).position[0]);
-        output_vertices.push_back((*it).position[1]);
-        output_vertices.push_back((*it).position[2]);
+        output_vertices.push_back(v.position[0]);
+        output_vertices.push_back(v.position[1]);
+        output_vertices.push_back(v.position[2]);
     }
     return;
 }
 
 void marching_cube::output_marching_vertices_and_normals(std::vector<float>& output_vertices_and_normals){
     // now assign mesh vertex and its normal to output
+    output_vertices_and_normals.clear();
+    output_vertices_and_normals.reserve(mesh_vertex_vector.size()*6);
 
-
-    //if (output_vertices_and_normals.empty())
-    // 	output_vertices_and_normals.reserve(len*6);
-
-    if (!output_vertices_and_normals.empty())
-    	output_vertices_and_normals.clear();
-
-    for(auto it = mesh_vertex_vector.begin(); it!=mesh_vertex_vector.end();++it)
+    for(const auto& v : mesh_vertex_vector)
     {
-        output_vertices_and_normals.push_back((*it).position[0]);
-        output_vertices_and_normals.push_back((*it).position[1]);
-        output_vertices_and_normals.push_back((*it).position[2]);
+        output_vertices_and_normals.push_back(v.position[0]);
+        output_vertices_and_normals.push_back(v.position[1]);
+        output_vertices_and_normals.push_back(v.position[2]);
 
-        output_vertices_and_normals.push_back(it->normal[0]);
-        output_vertices_and_normals.push_back(it->normal[1]);
-        output_vertices_and_normals.push_back(it->normal[2]);
+        output_vertices_and_normals.push_back(v.normal[0]);
+        output_vertices_and_normals.push_back(v.normal[1]);
+        output_vertices_and_normals.push_back(v.normal[2]);
     }
     return;
 }
@@ -131,335 +100,290 @@ void marching_cube::output_marching_vertices_and_normals(std::vector<float>& out
 
 void marching_cube::output_marching_indices(std::vector<unsigned int>& output_indices){
     // now assign mesh_triangle_vector to output triangle
+    output_indices.clear();
+    output_indices.reserve(mesh_triangle_vector.size()*3);
 
-    //if (output_indices.empty())
-    //	output_indices.reserve(len*3);
-
-    if (!output_indices.empty())
-        output_indices.clear();
-
-    for(auto it = mesh_triangle_vector.begin();it!=mesh_triangle_vector.end();++it)
+    for(const auto& t : mesh_triangle_vector)
     {
-        output_indices.push_back(it->vertex_ids[0]);
-        output_indices.push_back(it->vertex_ids[1]);
-        output_indices.push_back(it->vertex_ids[2]);
+        output_indices.push_back(t.vertex_ids[0]);
+        output_indices.push_back(t.vertex_ids[1]);
+        output_indices.push_back(t.vertex_ids[2]);
     }
     return;
 }
 
-void marching_cube::linear_interpolate_vertex_pos(const mVoxel_vertex& vertex1,
-                                                  const mVoxel_vertex& vertex2,
+Vector3f marching_cube::grid_vertex_position(size_t i, size_t j, size_t k) const
+{
+    float step_size = unit_voxel_length;
+    float x_half_extent = step_size*voxelx_n/2.0;
+    float y_half_extent = step_size*voxely_n/2.0;
+
+    float x = (i)*step_size-x_half_extent + origin[0];
+    float y = (j)*step_size-y_half_extent + origin[1];
+    float z = (k)*step_size + origin[2];
+    return Vector3f(x,y,z);
+}
+
+Vector3f marching_cube::grid_vertex_position(size_t index) const
+{
+    size_t plane = voxel_verticesx_n*voxel_verticesy_n;
+    return grid_vertex_position(index % voxel_verticesx_n, (index % plane) / voxel_verticesx_n, index / plane);
+}
+
+void marching_cube::linear_interpolate_vertex_pos(const Vector3f& position1, double phi1,
+                                                  const Vector3f& position2, double phi2,
                                                   Vector3f& result_pos){
-    result_pos = (-vertex1.phi/(vertex2.phi - vertex1.phi))*(vertex2.position - vertex1.position)+vertex1.position;
+    result_pos = (-phi1/(phi2 - phi1))*(position2 - position1)+position1;
 }
 
-void marching_cube::insect_vertex_to_edges( mVoxel_edge& edge){
-    if(edge.has_mesh_vertex)  // if this edge already has a vertex, do nothing but return directly
-        return;
-    else{
-        unsigned int len = mesh_vertex_vector.size();
-        unsigned int vertex_id = len;
+static const unsigned int no_mesh_vertex = std::numeric_limits<unsigned int>::max();
 
-        // compute its postion, now we just use midpoint
-        //Vector3f vertex_pos = (edge.vertex1_ptr->position + edge.vertex2_ptr->position)/2.0f;
+// returns the mesh vertex on the edge between the grid vertices, it is only created the first time the edge is asked for
+unsigned int marching_cube::edge_vertex(unsigned int& cached_id, size_t vertex_index1, double phi1, size_t vertex_index2, double phi2)
+{
+    if (cached_id != no_mesh_vertex)
+        return cached_id;
 
-        // use linear interpolate
-        Vector3f vertex_pos;
-        linear_interpolate_vertex_pos(*(edge.vertex1_ptr), *(edge.vertex2_ptr),vertex_pos);
+    unsigned int vertex_id = static_cast<unsigned int>(mesh_vertex_vector.size());
 
-        Vector3f vertex_normal;
-        compute_vertex_normal(vertex_pos,vertex_normal);
+    // use linear interpolate
+    Vector3f vertex_pos;
+    linear_interpolate_vertex_pos(grid_vertex_position(vertex_index1), phi1, grid_vertex_position(vertex_index2), phi2, vertex_pos);
 
-        mMesh_vertex mv(vertex_pos,vertex_normal,vertex_id);
-        mesh_vertex_vector.push_back(mv);
-        edge.meshVertexptr = &(mesh_vertex_vector.back()); // note in vector index is from 0.
-        edge.has_mesh_vertex = true;
-    }
-    return;
+    Vector3f vertex_normal;
+    compute_vertex_normal(vertex_pos,vertex_normal);
+
+    mesh_vertex_vector.emplace_back(vertex_pos,vertex_normal,vertex_id);
+    cached_id = vertex_id;
+    return vertex_id;
 }
 
+/*
+ *  marches the grid one slice of voxels (between two planes of grid vertices along z) after the other.
+ *  a mesh vertex on an edge is shared by the voxels around the edge, which all are in the slice or in the slices
+ *  right below and above it, so only the edges of the two planes of the slice and the z edges between them are kept.
+ *  the slices, voxels and the edges of a triangle are visited in the same order as always, so are the vertex ids.
+ */
 void marching_cube::bitcode_to_mesh_vertices(){
 
-	if (!mesh_vertex_vector.empty())
-		mesh_vertex_vector.clear();
+    mesh_vertex_vector.clear();
+    mesh_triangle_vector.clear();
 
-	if (!mesh_triangle_vector.empty())
-		mesh_triangle_vector.clear();
-
-    for(auto it = voxels.begin(); it!=voxels.end();++it)
+    if (use_sparse_phi)
     {
-        const char* cur_voxel_lut = marching_cubes_lut[it->bitcode];
-
-        for(size_t j = 0; j < 16; j=j+3) //because in the marching_cubes_lut is 256*16
-                                            // j = j+3, because 3 entries build a triangle
-        {
-            if(cur_voxel_lut[j]==-1)
-                break; // if we see the -1, means we already read all triangle in this voxel
-            else
-            {
-                 //mVoxel& vv = *it;
-                mVoxel_edge& edge1 = *(it->voxel_edges_ptrs[cur_voxel_lut[j]]);
-                mVoxel_edge& edge2 = *(it->voxel_edges_ptrs[cur_voxel_lut[j+1]]);
-                mVoxel_edge& edge3 = *(it->voxel_edges_ptrs[cur_voxel_lut[j+2]]);
-
-               // compute postion for insect vertiecs, accroding 3 edges
-                insect_vertex_to_edges(edge1);
-                insect_vertex_to_edges(edge2);
-                insect_vertex_to_edges(edge3);
-
-
-                // form triangle by using these 3 vertex in these 3 edges;
-                mMesh_vertex* v1 = edge1.meshVertexptr;
-                mMesh_vertex* v2 = edge2.meshVertexptr;
-                mMesh_vertex* v3 = edge3.meshVertexptr;
-
-                 // about the count-clock wise ??  I think the count-clock wise is according to the normal direction..
-                 mMesh_triangle mt;
-                 mt.vertex_ids[0] = v1->id;
-                 mt.vertex_ids[1] = v2->id;
-                 mt.vertex_ids[2] = v3->id;
-
-                 // if normal is on the opposite direction with the cross product of vertices(that is, dot product < 0)
-                 Vector3f e1 = v2->position - v1->position ;
-                 Vector3f e2 = v3->position - v1->position ;
-
-                 if (v1->normal.dot(e1.cross(e2)) < 0.0)
-                 {
-                	 unsigned int tmp = mt.vertex_ids[0];
-                	 mt.vertex_ids[0] = mt.vertex_ids[1];
-                	 mt.vertex_ids[1] = tmp;
-                 }
-
-                 mesh_triangle_vector.push_back(mt);
-            }
-        }
+        march_sparse();
+        return;
     }
-}
-
 
+    bottom_edges.x_edges.assign(voxelx_n*voxel_verticesy_n, no_mesh_vertex);
+    bottom_edges.y_edges.assign(voxel_verticesx_n*voxely_n, no_mesh_vertex);
 
-void marching_cube::mark_vertices(){
-    size_t len = voxel_vertices.size();
-    for(size_t i=0;i<len;++i )
+    for(size_t z = 0; z<voxelz_n; ++z)
     {
-        if(voxel_vertices[i].phi > 0.0f)
-            voxel_vertices[i].is_inside = true;
-        else
-            voxel_vertices[i].is_inside = false;
-    }
-}
+        top_edges.x_edges.assign(voxelx_n*voxel_verticesy_n, no_mesh_vertex);
+        top_edges.y_edges.assign(voxel_verticesx_n*voxely_n, no_mesh_vertex);
+        z_edges.assign(voxel_verticesx_n*voxel_verticesy_n, no_mesh_vertex);
 
-void marching_cube::generate_bitcode(){
-    for(auto it = voxels.begin(); it!=voxels.end();++it)
-    {
-        mVoxel& vox = *it;
-        bitset<8> bitcode(0x00); // initialize to all 0
-        for(size_t j = 0; j<8;++j) // since for each voxel we have 8 vertices
-        {
-            mVoxel_vertex* vertex_ptr = vox.vertex_ptrs[j];
-            if(vertex_ptr->is_inside)
-                bitcode[j] = 1;
-        }
-        vox.bitcode =static_cast<unsigned int>(bitcode.to_ulong());
+        march_slice(z);
+
+        std::swap(bottom_edges, top_edges); // the top plane is the bottom plane of the next slice
     }
-    return;
 }
 
-// here we initialize each voxels, assign vertices to voxel
-void marching_cube::initialize_voxels()
+void marching_cube::march_slice(size_t z)
 {
-	if (!voxels.empty())
-		voxels.clear();
+    const size_t nx = voxel_verticesx_n;
+    const size_t plane = voxel_verticesx_n*voxel_verticesy_n;
 
-    for(size_t z = 0; z<voxelz_n;++z)
+    for(size_t y = 0; y<voxely_n; ++y)
     {
-        for(size_t y = 0; y<voxely_n;++y)
+        for(size_t x = 0; x<voxelx_n; ++x)
         {
-            for(size_t x = 0; x<voxelx_n ;++x)
+            // the 8 vertices of the voxel, 0-3 in the bottom plane and 4-7 above them
+            const size_t v0 = x + y*nx + z*plane;
+            const size_t corners[8] = { v0, v0+1, v0+nx+1, v0+nx,
+                                        v0+plane, v0+plane+1, v0+plane+nx+1, v0+plane+nx };
+
+            double corner_phi[8];
+            unsigned int bitcode = 0;
+            for(unsigned int j = 0; j<8; ++j)
             {
-                mVoxel v;
-                bool is_useful_voxel = false;
-
-                size_t voxel_front_left_bottom_index = x+y*voxel_verticesx_n+z*voxel_verticesx_n*voxel_verticesy_n;
-                v.vertex_ptrs[0]=&(voxel_vertices[voxel_front_left_bottom_index]);
-                v.vertex_ptrs[1]=&(voxel_vertices[voxel_front_left_bottom_index+1]);
-                v.vertex_ptrs[2]=&(voxel_vertices[voxel_front_left_bottom_index+voxel_verticesx_n+1]);
-                v.vertex_ptrs[3]=&(voxel_vertices[voxel_front_left_bottom_index+voxel_verticesx_n]);
-
-                size_t voxel_front_left_top_index = voxel_front_left_bottom_index+voxel_verticesy_n*voxel_verticesx_n;
-                v.vertex_ptrs[4]=&(voxel_vertices[voxel_front_left_top_index]);
-                v.vertex_ptrs[5]=&(voxel_vertices[voxel_front_left_top_index+1]);
-                v.vertex_ptrs[6]=&(voxel_vertices[voxel_front_left_top_index+voxel_verticesx_n+1]);
-                v.vertex_ptrs[7]=&(voxel_vertices[voxel_front_left_top_index+voxel_verticesx_n]);
-
-                // determine if it is a useful voxel
-                if(v.vertex_ptrs[0]->is_inside)
-                {// if the first vertex is inside, then we try to find if other vertiecs are outside
-                    for(int i=1;i<8;++i)
-                    {
-                        if(!v.vertex_ptrs[i]->is_inside)
-                        {// if outside, it is a useful voxel
-                            is_useful_voxel = true;
-                            break;
-                        }
-                        else
-                        {
-                            is_useful_voxel = false;
-                        }
-                    }
-                }
-                else
-                {
-                    for(int i=1;i<8;++i)
-                    {
-                        if(v.vertex_ptrs[i]->is_inside)
-                        {
-                            is_useful_voxel = true;
-                            break;
-                        }
-                        else
-                        {
-                            is_useful_voxel = false;
-                        }
-                    }
-                }
-
-                if(is_useful_voxel)
-                {//only store useful voxel
-                    size_t voxel_index_x = x+y*voxelx_n+z*voxelx_n*voxel_verticesy_n;
-                    v.voxel_edges_ptrs[0] = &edges_vector_x[voxel_index_x];
-                    v.voxel_edges_ptrs[2] = &edges_vector_x[voxel_index_x + voxelx_n];
-                    v.voxel_edges_ptrs[4] = &edges_vector_x[voxel_index_x + voxelx_n*(voxely_n+1)];
-                    v.voxel_edges_ptrs[6] = &edges_vector_x[voxel_index_x + voxelx_n*(voxely_n+1) + voxelx_n];
-
-                    size_t voxel_index_y = x+y*voxel_verticesx_n+z*voxely_n*voxel_verticesx_n;
-                    v.voxel_edges_ptrs[3] = &edges_vector_y[voxel_index_y];
-                    v.voxel_edges_ptrs[1] = &edges_vector_y[voxel_index_y+1];
-                    v.voxel_edges_ptrs[5] = &edges_vector_y[voxel_index_y+1 + (voxelx_n+1)*voxely_n ];
-                    v.voxel_edges_ptrs[7] = &edges_vector_y[voxel_index_y+ (voxelx_n+1)*voxely_n ];
-
-                    size_t voxel_index_z = x+y*voxel_verticesx_n+z*voxel_verticesy_n*voxel_verticesx_n;
-                    v.voxel_edges_ptrs[8] = &edges_vector_z[voxel_index_z];
-                    v.voxel_edges_ptrs[9] = &edges_vector_z[voxel_index_z+1];
-                    v.voxel_edges_ptrs[10] = &edges_vector_z[voxel_index_z+1+voxelx_n+1];
-                    v.voxel_edges_ptrs[11] = &edges_vector_z[voxel_index_z+voxelx_n+1];
-                    voxels.push_back(v);
-                }
+                corner_phi[j] = vertex_phi[corners[j]];
+                if(corner_phi[j] > 0.0)
+                    bitcode |= 1u << j;
             }
+            if(bitcode == 0 || bitcode == 255) // all vertices inside or all outside, no surface in this voxel
+                continue;
+
+            // the cached mesh vertex of every edge of the voxel
+            const size_t ex = x + y*voxelx_n;
+            const size_t ey = x + y*nx;
+            unsigned int* const edge_ids[12] = {
+                &bottom_edges.x_edges[ex],  &bottom_edges.y_edges[ey+1],  &bottom_edges.x_edges[ex+voxelx_n],  &bottom_edges.y_edges[ey],
+                &top_edges.x_edges[ex],     &top_edges.y_edges[ey+1],     &top_edges.x_edges[ex+voxelx_n],     &top_edges.y_edges[ey],
+                &z_edges[ey],               &z_edges[ey+1],               &z_edges[ey+nx+1],                   &z_edges[ey+nx] };
+
+            voxel_to_triangles(bitcode, corners, corner_phi, edge_ids);
         }
     }
-    return;
 }
 
+// the two grid vertices of every edge of a voxel, the lower one first, and the axis of the edge
+static const unsigned char edge_corners[12][2] = {
+    {0,1}, {1,2}, {3,2}, {0,3},
+    {4,5}, {5,6}, {7,6}, {4,7},
+    {0,4}, {1,5}, {2,6}, {3,7} };
+static const unsigned char edge_axis[12] = { 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2 };
 
-void marching_cube::initialize_vertices(){
-	if (!voxel_vertices.empty())
-	{
-		voxel_vertices.clear();
-	}
-
-    voxel_vertices.reserve(voxel_verticesz_n * voxel_verticesy_n * voxel_verticesx_n);    
+void marching_cube::voxel_to_triangles(unsigned int bitcode, const size_t corners[8], const double corner_phi[8], unsigned int* const edge_ids[12])
+{
+    const char* cur_voxel_lut = marching_cubes_lut[bitcode];
 
-    float step_size = unit_voxel_length;
-    float x_half_extent = step_size*voxelx_n/2.0;
-    float y_half_extent = step_size*voxely_n/2.0;
-    //
-    for (size_t k=0; k<voxel_verticesz_n; ++k)
+    for(size_t j = 0; j < 16; j=j+3) //because in the marching_cubes_lut is 256*16
+                                        // j = j+3, because 3 entries build a triangle
     {
-        for (size_t j=0; j<voxel_verticesy_n; ++j)
+        if(cur_voxel_lut[j]==-1)
+            break; // if we see the -1, means we already read all triangle in this voxel
+
+        mMesh_triangle mt;
+        for(size_t e = 0; e < 3; ++e)
         {
-            for (size_t i=0; i<voxel_verticesx_n; ++i)
-            {
-                mVoxel_vertex p;
+            int edge = cur_voxel_lut[j+e];
+            int c1 = edge_corners[edge][0];
+            int c2 = edge_corners[edge][1];
+            mt.vertex_ids[e] = edge_vertex(*edge_ids[edge], corners[c1], corner_phi[c1], corners[c2], corner_phi[c2]);
+        }
 
-                float x = (i)*step_size-x_half_extent + origin[0];
-                float y = (j)*step_size-y_half_extent + origin[1];
-                float z = (k)*step_size + origin[2];
+        // the triangles of the lut all face the corners with phi > 0, which are inside here, so they are turned around.
+        // this used to be decided by the normal of the first vertex, which flipped the triangles that are
+        // too small for the sign of the cross product where a grid vertex is (almost) on the surface
+        std::swap(mt.vertex_ids[0], mt.vertex_ids[1]);
 
-                p.position = Vector3f(x,y,z);
-                p.phi = -1;
-                p.is_inside = false;
-                voxel_vertices.push_back(p);
-            }
-        }
+        mesh_triangle_vector.push_back(mt);
     }
-    return;
 }
 
-
-void marching_cube::initialize_edges(){
-    if(voxel_vertices.empty())
-    {
-        cout<<"Oppps! voxel_vertices is empty, you should at first initialize_vertices"<<endl;
-        return;
-    }
-    // first initialize all edge along x axis
-    if(!edges_vector_x.empty())
+/*
+ *  marches only the voxels with a corner in an allocated block of sparse_phi, all others are outside.
+ *  the voxels are grouped in blocks like the vertices, the voxels of block b have their lowest corner in vertex block b
+ *  and the others in the blocks after it, so the voxel blocks to march are the allocated ones and the blocks before them.
+ *  they are marched in z, y, x order, the mesh vertices on the edges are shared through a hash map.
+ */
+void marching_cube::march_sparse()
+{
+    const size_t B = mSparsePhi::block_n;
+    const size_t nx = voxel_verticesx_n;
+    const size_t plane = voxel_verticesx_n*voxel_verticesy_n;
+    const size_t voxel_blocks_n[3] = { (voxelx_n+B-1)/B, (voxely_n+B-1)/B, (voxelz_n+B-1)/B };
+    std::vector<uint64_t> voxel_blocks;
+    voxel_blocks.reserve(sparse_phi.block_keys.size()*8);
+    for(uint64_t key : sparse_phi.block_keys)
     {
-        edges_vector_x.clear();
-        edges_vector_x.reserve(voxelx_n*(voxely_n+1)*(voxelz_n+1));
+        size_t b[3];
+        mSparsePhi::block_of_key(key, b[0], b[1], b[2]);
+        for(size_t d = 0; d < 8; ++d)
+        {
+            size_t bx = b[0] - (d & 1), by = b[1] - ((d >> 1) & 1), bz = b[2] - (d >> 2);
+            // the ones below 0 wrap around and are skipped as well
+            if(bx < voxel_blocks_n[0] && by < voxel_blocks_n[1] && bz < voxel_blocks_n[2])
+                voxel_blocks.push_back(mSparsePhi::key(bx, by, bz));
+        }
     }
+    std::sort(voxel_blocks.begin(), voxel_blocks.end());
+    voxel_blocks.erase(std::unique(voxel_blocks.begin(), voxel_blocks.end()), voxel_blocks.end());
+
+    sparse_edges.clear();
 
-    for (size_t k=0; k<voxelz_n+1; ++k) // note, for edges paralel with x axis, its number at y and z is the same as vertice
+    for(uint64_t key : voxel_blocks)
     {
-        for (size_t j=0; j<voxely_n+1; ++j)
+        size_t bx, by, bz;
+        mSparsePhi::block_of_key(key, bx, by, bz);
+
+        // the vertex blocks the corners can be in, [dz][dy][dx]
+        const double* blocks[2][2][2];
+        for(size_t d = 0; d < 8; ++d)
+            blocks[d >> 2][(d >> 1) & 1][d & 1] = sparse_phi.find_block(bx + (d & 1), by + ((d >> 1) & 1), bz + (d >> 2));
+
+        for(size_t lz = 0; lz < B && bz*B+lz < voxelz_n; ++lz)
+        for(size_t ly = 0; ly < B && by*B+ly < voxely_n; ++ly)
+        for(size_t lx = 0; lx < B && bx*B+lx < voxelx_n; ++lx)
         {
-            for (size_t i=0; i<voxelx_n; ++i)
+            const size_t v0 = (bx*B+lx) + (by*B+ly)*nx + (bz*B+lz)*plane;
+            const size_t corners[8] = { v0, v0+1, v0+nx+1, v0+nx,
+                                        v0+plane, v0+plane+1, v0+plane+nx+1, v0+plane+nx };
+            // offsets of the corners from the lowest one, in the order of corners
+            static const unsigned char corner_offsets[8][3] = {
+                {0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}, {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1} };
+
+            double corner_phi[8];
+            unsigned int bitcode = 0;
+            for(unsigned int j = 0; j<8; ++j)
             {
-                mVoxel_edge edge;
-                edge.has_mesh_vertex = false;
-                size_t vertex_index = i + j*voxel_verticesx_n + k*voxel_verticesx_n*voxel_verticesy_n;
-                edge.vertex1_ptr = &voxel_vertices[vertex_index];
-                edge.vertex2_ptr = &voxel_vertices[vertex_index+1];
-                edges_vector_x.push_back(edge);
+                size_t cx = lx + corner_offsets[j][0], cy = ly + corner_offsets[j][1], cz = lz + corner_offsets[j][2];
+                const double* block = blocks[cz / B][cy / B][cx / B];
+                corner_phi[j] = block ? block[(cx % B) + B*((cy % B) + B*(cz % B))] : sparse_phi.background_phi;
+                if(corner_phi[j] > 0.0)
+                    bitcode |= 1u << j;
             }
-        }
-    }
+            if(bitcode == 0 || bitcode == 255)
+                continue;
 
-    // initialized all edge along y axis
-    if(!edges_vector_y.empty())
-    {
-        edges_vector_y.clear();
-        edges_vector_y.reserve((voxelx_n+1)*voxely_n*(voxelz_n+1));
-    }
-    for (size_t k=0; k<voxelz_n+1; ++k)
-    {
-        for (size_t j=0; j<voxely_n; ++j)
-        {
-            for (size_t i=0; i<voxelx_n+1; ++i)
+            unsigned int* edge_ids[12];
+            for(size_t e = 0; e < 12; ++e)
             {
-                mVoxel_edge edge;
-                edge.has_mesh_vertex = false;
-                size_t vertex_index = i + j*voxel_verticesx_n + k*voxel_verticesx_n*voxel_verticesy_n;
-                edge.vertex1_ptr = &voxel_vertices[vertex_index];
-                edge.vertex2_ptr = &voxel_vertices[vertex_index+1*voxel_verticesx_n];
-                edges_vector_y.push_back(edge);
+                uint64_t edge_key = 3*static_cast<uint64_t>(corners[edge_corners[e][0]]) + edge_axis[e];
+                edge_ids[e] = &sparse_edges.emplace(edge_key, std::numeric_limits<unsigned int>::max()).first->second;
             }
+
+            voxel_to_triangles(bitcode, corners, corner_phi, edge_ids);
         }
     }
+}
 
-    // initialized all edge along z axis
-    if(!edges_vector_z.empty())
-    {
-        edges_vector_z.clear();
-        edges_vector_z.reserve((voxelx_n+1)*(voxely_n+1)*voxelz_n);
-    }
-    for (size_t k=0; k<voxelz_n; ++k)
+void marching_cube::initialize_vertices(){
+    if (use_sparse_phi)
     {
-        for (size_t j=0; j<voxely_n+1; ++j)
-        {
-            for (size_t i=0; i<voxelx_n+1; ++i)
-            {
-                mVoxel_edge edge;
-                edge.has_mesh_vertex = false;
-                size_t vertex_index = i + j*voxel_verticesx_n + k*voxel_verticesx_n*voxel_verticesy_n;
-                edge.vertex1_ptr = &voxel_vertices[vertex_index];
-                edge.vertex2_ptr = &voxel_vertices[vertex_index+voxel_verticesx_n*voxel_verticesy_n];
-                edges_vector_z.push_back(edge);
-            }
-        }
+        vertex_phi.clear();
+        vertex_phi.shrink_to_fit();
+        sparse_phi.clear(-1.0);
+        return;
     }
 
+    // the positions follow from the indices, only phi is stored
+    vertex_phi.assign(voxel_verticesz_n * voxel_verticesy_n * voxel_verticesx_n, -1.0);
+}
+
+
+void mSparsePhi::clear(double background)
+{
+    background_phi = background;
+    block_offsets.clear();
+    block_keys.clear();
+    phi.clear();
+}
 
+size_t mSparsePhi::block_offset(size_t bx, size_t by, size_t bz)
+{
+    uint64_t block_key = key(bx, by, bz);
+    auto found = block_offsets.find(block_key);
+    if (found != block_offsets.end())
+        return found->second;
+
+    size_t offset = phi.size();
+    phi.resize(offset + block_n*block_n*block_n, background_phi);
+    block_offsets.emplace(block_key, offset);
+    block_keys.push_back(block_key);
+    return offset;
 }
 
+double& mSparsePhi::at(size_t i, size_t j, size_t k)
+{
+    size_t offset = block_offset(i / block_n, j / block_n, k / block_n);
+    return phi[offset + (i % block_n) + block_n*((j % block_n) + block_n*(k % block_n))];
+}
+
+const double* mSparsePhi::find_block(size_t bx, size_t by, size_t bz) const
+{
+    auto found = block_offsets.find(key(bx, by, bz));
+    return found == block_offsets.end() ? nullptr : &phi[found->second];
+}
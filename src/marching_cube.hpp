@@ -2,7 +2,8 @@
 #define MARCHING_CUBE_H
 #include <vector>
 #include <array>
-#include <list>
+#include <unordered_map>
+#include <cstdint>
 #include <Eigen/Geometry>
 
 using Eigen::Vector3f;
@@ -25,34 +26,34 @@ struct mMeshtriangle{
 typedef struct mMeshtriangle mMesh_triangle;
 
 
-
-struct mVoxelvertex{
-    Vector3f position; // position of this vertex
-    double phi;  // its phi value, which describle the distance to the surface
-    bool is_inside;
+// ids of the mesh vertices on the edges of two neighboring planes of grid vertices, see bitcode_to_mesh_vertices
+struct mEdgeCache{
+    std::vector<unsigned int> x_edges; // edges along x in the plane, (voxelx_n) * (voxely_n+1)
+    std::vector<unsigned int> y_edges; // edges along y in the plane, (voxelx_n+1) * (voxely_n)
 };
-typedef struct mVoxelvertex mVoxel_vertex;
-
 
-struct mVoxelEdge{// each edge has 2 vertices
-    mVoxel_vertex * vertex1_ptr;
-    mVoxel_vertex * vertex2_ptr;
-    bool has_mesh_vertex;
-    mMesh_vertex * meshVertexptr;
 
-    mVoxelEdge():has_mesh_vertex(false){}
+// phi of the grid vertices near the surface only, in blocks of block_n^3 vertices that are allocated when a value is
+// added to one of their vertices. all other vertices have background_phi
+struct mSparsePhi{
+    static const size_t block_n = 8;
+    double background_phi = -1.0;
+    std::unordered_map<uint64_t, size_t> block_offsets; // key of the block -> offset of its first vertex in phi
+    std::vector<uint64_t> block_keys;                    // in the order the blocks were allocated
+    std::vector<double> phi;                             // x fastest within a block
+
+    static uint64_t key(size_t bx, size_t by, size_t bz) { return (uint64_t(bz) << 42) | (uint64_t(by) << 21) | uint64_t(bx); }
+    static void block_of_key(uint64_t key, size_t& bx, size_t& by, size_t& bz)
+    {
+        const uint64_t mask = (uint64_t(1) << 21) - 1;
+        bx = key & mask; by = (key >> 21) & mask; bz = key >> 42;
+    }
+
+    void clear(double background);
+    size_t block_offset(size_t bx, size_t by, size_t bz); // allocates the block
+    double& at(size_t i, size_t j, size_t k);           // allocates the block of the vertex
+    const double* find_block(size_t bx, size_t by, size_t bz) const; // nullptr if not allocated
 };
-typedef struct mVoxelEdge mVoxel_edge;
-
-struct mVoxel{
-    std::array<mVoxel_vertex *,8> vertex_ptrs;  // each voxel has 8 vertices
-    std::array<mVoxel_edge *, 12> voxel_edges_ptrs;
-    unsigned int bitcode;
-};
-typedef struct mVoxel mVoxel;
-
-
-
 
 
 
@@ -97,26 +98,39 @@ protected:
     virtual void compute_vertex_normal(const Vector3f& vertex, Vector3f& normal) = 0;
     virtual void compute_vertices_phi() = 0;
     void initialize_vertices();
-    void initialize_voxels();
-    void initialize_edges();
-    void mark_vertices();
-    void generate_bitcode();
     virtual void bitcode_to_mesh_vertices();
-    virtual void insect_vertex_to_edges( mVoxel_edge& edge);
-    void linear_interpolate_vertex_pos(const mVoxel_vertex &vertex1, const mVoxel_vertex &vertex2, Vector3f& result_pos);
+    void linear_interpolate_vertex_pos(const Vector3f& position1, double phi1, const Vector3f& position2, double phi2, Vector3f& result_pos);
+
+    // grid vertex (i, j, k) is vertex_phi[i + j*voxel_verticesx_n + k*voxel_verticesx_n*voxel_verticesy_n],
+    // its position is not stored but computed from the indices
+    Vector3f grid_vertex_position(size_t i, size_t j, size_t k) const;
+    Vector3f grid_vertex_position(size_t index) const;
+
+    // phi of every grid vertex, which describle the distance to the surface, > 0 is inside
+    std::vector<double> vertex_phi;
+
+    // if set, compute_vertices_phi fills sparse_phi instead of vertex_phi and only the voxels
+    // at allocated blocks are marched, so the cost follows the surface instead of the bounding box
+    bool use_sparse_phi = false;
+    mSparsePhi sparse_phi;
 
 
-    std::vector<mVoxel_vertex> voxel_vertices;
-    std::list<mVoxel> voxels;
-    std::vector<mVoxel_edge> edges_vector_x;
-    std::vector<mVoxel_edge> edges_vector_y;
-    std::vector<mVoxel_edge> edges_vector_z;
+    // store internel triangle face and mesh vertex, the id of a vertex is its index
+    std::vector<mMesh_vertex> mesh_vertex_vector;
+    std::vector<mMesh_triangle> mesh_triangle_vector;
 
+private:
+    // only the edges of the slice of voxels that is marched are kept, the planes below and above it and the edges between them
+    mEdgeCache bottom_edges;
+    mEdgeCache top_edges;
+    std::vector<unsigned int> z_edges; // (voxelx_n+1) * (voxely_n+1)
 
+    std::unordered_map<uint64_t, unsigned int> sparse_edges; // key is 3 * index of the lower grid vertex + axis
 
-    // store internel triangle face and mesh vertex
-    std::list<mMesh_vertex> mesh_vertex_vector;
-    std::list<mMesh_triangle> mesh_triangle_vector;
+    unsigned int edge_vertex(unsigned int& cached_id, size_t vertex_index1, double phi1, size_t vertex_index2, double phi2);
+    void voxel_to_triangles(unsigned int bitcode, const size_t corners[8], const double corner_phi[8], unsigned int* const edge_ids[12]);
+    void march_slice(size_t z);
+    void march_sparse();
 };
 
 #endif // MARCHING_CUBE_H
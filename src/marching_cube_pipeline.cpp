@@ -0,0 +1,111 @@
+#include "marching_cube_pipeline.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+MarchingCubePipeline::MarchingCubePipeline( float unit_voxel_length, Real c, const SimulationRecord& header, size_t n_workers, size_t capacity, bool sparse, bool anisotropic )
+    : unit_voxel_length(unit_voxel_length), c(c), grid_tracker(unit_voxel_length, c, header), queue_capacity(std::max<size_t>(capacity, 1))
+{
+    n_workers = std::max<size_t>(n_workers, 1);
+    for (size_t i=0; i<n_workers; ++i)
+    {
+        meshers.emplace_back(new marching_cube_fluid(unit_voxel_length, c, header));
+        meshers.back()->set_sparse(sparse);
+        meshers.back()->set_anisotropic(anisotropic);
+    }
+    for (size_t i=0; i<n_workers; ++i)
+        workers.emplace_back(&MarchingCubePipeline::worker_loop, this, std::ref(*meshers[i]));
+}
+
+bool MarchingCubePipeline::open( const std::string& file_path, MeshCodec codec )
+{
+    std::lock_guard<std::mutex> lock(output_mutex);
+    return writer.open(file_path, unit_voxel_length, static_cast<float>(c), codec);
+}
+
+void MarchingCubePipeline::add_state( const SimulationState& state )
+{
+    if (workers.empty() || !workers[0].joinable())
+        return;
+    if (!writer.is_open())
+        throw "Mesh file is not open!";
+
+    // the grid only depends on the frames before, the states come in order, so it is followed right here
+    Job job;
+    job.frame = n_added++;
+    grid_tracker.set_state(state);
+    job.grid = grid_tracker.follow_grid(job.frame == 0);
+    job.state = state;
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    queue_not_full.wait(lock, [this]{ return queue.size() < queue_capacity; });
+    queue.push_back(std::move(job));
+
+    lock.unlock();
+    queue_not_empty.notify_one();
+}
+
+void MarchingCubePipeline::worker_loop( marching_cube_fluid& mesher )
+{
+#ifdef _OPENMP
+    // the parallel loops of marching_cube_fluid run in every worker, so the workers share the threads of openmp.
+    // the setting only applies to the calling thread
+    omp_set_num_threads(std::max(1, omp_get_max_threads() / static_cast<int>(meshers.size())));
+#endif
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true)
+    {
+        queue_not_empty.wait(lock, [this]{ return stop_workers || !queue.empty(); });
+        if (queue.empty()) // only when stopped, the queue is drained first
+            return;
+
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        queue_not_full.notify_one();
+
+        mMeshData md;
+        mesher.set_state(job.state);
+        mesher.mesh_state(job.grid, job.frame == 0);
+        mesher.output_mesh_data(md);
+        if (simplification.enabled())
+            simplify_mesh(md, simplification);
+
+        {
+            // the frames are written in order, a frame done before an earlier one stays in done_frames until that one is written
+            std::lock_guard<std::mutex> output_lock(output_mutex);
+            std::cout << "meshed frame " << job.frame << std::endl;
+            done_frames[job.frame] = std::move(md);
+            while (!done_frames.empty() && done_frames.begin()->first == n_written)
+            {
+                writer.write_frame(done_frames.begin()->second);
+                done_frames.erase(done_frames.begin());
+                ++n_written;
+            }
+        }
+        lock.lock();
+    }
+}
+
+bool MarchingCubePipeline::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stop_workers = true;
+    }
+    queue_not_empty.notify_all();
+
+    for (auto& worker : workers)
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+
+    std::lock_guard<std::mutex> lock(output_mutex);
+    return writer.close();
+}
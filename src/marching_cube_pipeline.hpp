@@ -0,0 +1,81 @@
+#pragma once
+
+#include "marching_cube_fluid.hpp"
+#include "mesh_record.hpp"
+#include "mesh_decimation.hpp"
+#include "mesh_record_writer.hpp"
+#include "sim_record.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ *  meshes the fluid of a series of states with marching_cube_fluid on a pool of worker threads,
+ *  while the states are still coming in (e.g. from a running simulation).
+ *  the grid of a frame follows the grid of the frame before. that part is cheap and done in order by add_state,
+ *  the expensive part (phi on the grid, marching, normals) runs on whichever worker is free,
+ *  the openmp threads of its parallel loops are split between the workers.
+ *  so the meshes are the same as the ones save_fluid_mesh gets by meshing the frames one after another.
+ *  a mesh is written to the mesh file as soon as it and all frames before it are done, only the frames that
+ *  are done before an earlier one are held in memory.
+ */
+class MarchingCubePipeline {
+public:
+    // at most queue_capacity states wait for a worker, add_state blocks when the workers fall behind.
+    // sparse meshes on the narrow band around the particles, anisotropic with the kernels of marching_cube_fluid::set_anisotropic
+    MarchingCubePipeline(float unit_voxel_length, Real c, const SimulationRecord& header, size_t n_workers, size_t queue_capacity,
+                         bool sparse = false, bool anisotropic = false);
+    ~MarchingCubePipeline() { finish(); }
+
+    MarchingCubePipeline( const MarchingCubePipeline& ) = delete;
+    MarchingCubePipeline& operator=( const MarchingCubePipeline& ) = delete;
+
+    // the indexed mesh file the frames are written to (see mesh_record.hpp), has to be opened before the first add_state
+    bool open( const std::string& file_path, MeshCodec codec = QUANTIZED_MESH_CODEC );
+    // states have to be added in order and from one thread
+    void add_state( const SimulationState& state );
+    // welding and decimation of every mesh before it is written, off by default.
+    // has to be set before the first add_state
+    void set_simplification( const mMeshSimplification& settings ) { simplification = settings; }
+    // waits until all added states are meshed and written, then appends the index of the mesh file.
+    // false if the file could not be written
+    bool finish();
+
+    size_t number_of_frames() const { return n_added; }
+
+private:
+    struct Job {
+        size_t frame;
+        SimulationState state;
+        marching_cube_fluid::GridBounds grid;
+    };
+
+    float unit_voxel_length;
+    Real c;
+    marching_cube_fluid grid_tracker; // only follows the grid, never meshes
+    size_t n_added = 0;
+    std::vector<std::unique_ptr<marching_cube_fluid>> meshers;
+    std::vector<std::thread> workers;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_not_empty;
+    std::condition_variable queue_not_full;
+    std::deque<Job> queue;
+    size_t queue_capacity;
+    bool stop_workers = false;
+
+    mMeshSimplification simplification;
+
+    std::mutex output_mutex;
+    MeshRecordWriter writer;
+    size_t n_written = 0;
+    std::map<size_t, mMeshData> done_frames; // meshed before an earlier frame, under output_mutex
+
+    void worker_loop( marching_cube_fluid& mesher );
+};
@@ -7,7 +7,17 @@ namespace Simulator
 {
     // You should probably use double while building your simulator. At the end, you can try switching to
     // float for increased performance at the cost of precision (which may cause stability issues. Or not).
+    // the float build is switched on with the cmake option SIMULATOR_SINGLE_PRECISION, which also builds
+    // CompactNSearch in float. records are written with Real, so they can only be read by a build of the same precision.
+#ifdef SIMULATOR_USE_FLOAT
+    typedef float Real;
+#else
     typedef double Real;
+#endif
+
+    // sums over all neighbors (density, kernel corrections) are accumulated in double in both builds,
+    // the terms of single neighbors are small compared to the self contribution and would get lost in float.
+    typedef double AccumReal;
 
     // There are some issues with Eigen and aligned types that we'd rather
     // not have to deal with, so we specify that we do not want any alignment.
@@ -0,0 +1,179 @@
+#include "mesh_codec.hpp"
+
+#include <cereal/types/vector.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// zigzag varints, small values of either sign take a single byte
+static void put_varint( std::vector<uint8_t>& bytes, int64_t value )
+{
+    uint64_t v = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    while (v >= 0x80)
+    {
+        bytes.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    bytes.push_back(static_cast<uint8_t>(v));
+}
+
+static int64_t get_varint( const std::vector<uint8_t>& bytes, size_t& pos )
+{
+    uint64_t v = 0;
+    for (int shift=0; pos < bytes.size() && shift < 64; shift += 7)
+    {
+        uint8_t b = bytes[pos++];
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+    throw "Mesh frame has a broken varint!";
+}
+
+static uint16_t snorm_to_16( float x )
+{
+    x = std::max(-1.0f, std::min(1.0f, x));
+    return static_cast<uint16_t>(std::lround((x * 0.5f + 0.5f) * 65535.0f));
+}
+
+static float snorm_from_16( uint16_t q )
+{
+    return static_cast<float>(q) / 65535.0f * 2.0f - 1.0f;
+}
+
+static void octahedral_encode( const float* n, uint16_t* out )
+{
+    float l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+    if (l1 <= 0.0f)
+    {
+        out[0] = out[1] = snorm_to_16(0.0f); // no normal, comes back as +z
+        return;
+    }
+    float u = n[0] / l1, v = n[1] / l1;
+    if (n[2] < 0.0f) // the lower half is folded over the diagonals
+    {
+        float fu = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float fv = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = fu; v = fv;
+    }
+    out[0] = snorm_to_16(u);
+    out[1] = snorm_to_16(v);
+}
+
+static void octahedral_decode( const uint16_t* q, float* n )
+{
+    float u = snorm_from_16(q[0]), v = snorm_from_16(q[1]);
+    Vector3f d(u, v, 1.0f - std::fabs(u) - std::fabs(v));
+    if (d[2] < 0.0f)
+    {
+        d[0] = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        d[1] = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+    }
+    d.normalize();
+    n[0] = d[0]; n[1] = d[1]; n[2] = d[2];
+}
+
+static void encode_quantized_mesh( cereal::BinaryOutputArchive& output, const mMeshData& mesh )
+{
+    const size_t n_vertices = mesh.vertices_and_normals.size() / 6;
+
+    // the grid box of the frame, x and y are centered on the origin, z starts at it
+    Vector3f box_min = mesh.origin - Vector3f(0.5f * mesh.bounding_box[0], 0.5f * mesh.bounding_box[1], 0.0f);
+    Vector3f box_max = box_min + mesh.bounding_box;
+    for (size_t i=0; i<n_vertices; ++i)
+    {
+        Vector3f p(mesh.vertices_and_normals[6*i], mesh.vertices_and_normals[6*i+1], mesh.vertices_and_normals[6*i+2]);
+        box_min = box_min.cwiseMin(p);
+        box_max = box_max.cwiseMax(p);
+    }
+    Vector3f box_size = box_max - box_min;
+
+    std::vector<uint16_t> positions(3 * n_vertices);
+    std::vector<uint16_t> normals(2 * n_vertices);
+    for (size_t i=0; i<n_vertices; ++i)
+    {
+        const float* v = &mesh.vertices_and_normals[6*i];
+        for (int k=0; k<3; ++k)
+        {
+            float t = box_size[k] > 0.0f ? (v[k] - box_min[k]) / box_size[k] : 0.0f;
+            positions[3*i+k] = static_cast<uint16_t>(std::lround(std::max(0.0f, std::min(1.0f, t)) * 65535.0f));
+        }
+        octahedral_encode(v + 3, &normals[2*i]);
+    }
+
+    std::vector<uint8_t> indices;
+    indices.reserve(mesh.faces.size() + mesh.faces.size() / 4);
+    int64_t next = 0;
+    for (unsigned int id : mesh.faces)
+    {
+        put_varint(indices, static_cast<int64_t>(id) - next);
+        next = std::max(next, static_cast<int64_t>(id) + 1);
+    }
+
+    uint64_t n_faces = mesh.faces.size() / 3;
+    output(mesh.origin[0], mesh.origin[1], mesh.origin[2], mesh.bounding_box[0], mesh.bounding_box[1], mesh.bounding_box[2]);
+    output(box_min[0], box_min[1], box_min[2], box_size[0], box_size[1], box_size[2]);
+    output(n_faces, positions, normals, indices);
+}
+
+static void decode_quantized_mesh( cereal::BinaryInputArchive& input, mMeshData& mesh )
+{
+    Vector3f box_min, box_size;
+    uint64_t n_faces;
+    std::vector<uint16_t> positions, normals;
+    std::vector<uint8_t> indices;
+    input(mesh.origin[0], mesh.origin[1], mesh.origin[2], mesh.bounding_box[0], mesh.bounding_box[1], mesh.bounding_box[2]);
+    input(box_min[0], box_min[1], box_min[2], box_size[0], box_size[1], box_size[2]);
+    input(n_faces, positions, normals, indices);
+
+    const size_t n_vertices = positions.size() / 3;
+    if (normals.size() != 2 * n_vertices)
+        throw "Mesh frame has broken normals!";
+
+    mesh.vertices_and_normals.resize(6 * n_vertices);
+    for (size_t i=0; i<n_vertices; ++i)
+    {
+        float* v = &mesh.vertices_and_normals[6*i];
+        for (int k=0; k<3; ++k)
+            v[k] = box_min[k] + static_cast<float>(positions[3*i+k]) / 65535.0f * box_size[k];
+        octahedral_decode(&normals[2*i], v + 3);
+    }
+
+    mesh.faces.resize(3 * n_faces);
+    size_t pos = 0;
+    int64_t next = 0;
+    for (unsigned int& id : mesh.faces)
+    {
+        int64_t value = next + get_varint(indices, pos);
+        if (value < 0 || value >= static_cast<int64_t>(n_vertices))
+            throw "Mesh frame has a broken index!";
+        id = static_cast<unsigned int>(value);
+        next = std::max(next, value + 1);
+    }
+}
+
+void encode_mesh( cereal::BinaryOutputArchive& output, const mMeshData& mesh, MeshCodec codec )
+{
+    uint8_t codec_id = static_cast<uint8_t>(codec);
+    output(codec_id);
+
+    if (codec == QUANTIZED_MESH_CODEC)
+        encode_quantized_mesh(output, mesh);
+    else
+        output(mesh);
+}
+
+void decode_mesh( cereal::BinaryInputArchive& input, mMeshData& mesh )
+{
+    uint8_t codec_id;
+    input(codec_id);
+
+    if (codec_id == QUANTIZED_MESH_CODEC)
+        decode_quantized_mesh(input, mesh);
+    else if (codec_id == RAW_MESH_CODEC)
+        input(mesh);
+    else
+        throw "Unknown mesh codec!";
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "mesh_record.hpp"
+
+#include <cereal/archives/binary.hpp>
+
+// how a frame is stored in a mesh file, the id is written in front of every frame
+enum MeshCodec { RAW_MESH_CODEC = 0, QUANTIZED_MESH_CODEC = 1 };
+
+/*
+ *  compact encoding of a mesh, about 10 bytes per vertex and 4 per face instead of 24 and 12:
+ *    positions are quantized to 16 bits per axis in the grid box of the frame (origin and bounding_box),
+ *    grown to the vertices if one is outside of it. the error is below 1/65535 of the box along each axis.
+ *    normals are octahedral encoded (the unit sphere folded onto a square) with 16 bits per coordinate, error below 0.01 degree.
+ *    indices are zigzag varints relative to the vertex after the highest one used so far. the marching cubes
+ *    add their vertices in the order the faces use them, so most indices take one byte.
+ *  faces and the order of the vertices are kept as they are.
+ */
+void encode_mesh( cereal::BinaryOutputArchive& output, const mMeshData& mesh, MeshCodec codec );
+void decode_mesh( cereal::BinaryInputArchive& input, mMeshData& mesh );
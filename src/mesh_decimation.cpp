@@ -0,0 +1,421 @@
+#include "mesh_decimation.hpp"
+
+#include <Eigen/Dense>
+
+#include <vector>
+#include <array>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+typedef std::array<uint32_t, 3> Face;
+
+static Vector3f vertex_position( const std::vector<float>& vertices_and_normals, size_t i )
+{
+    return Vector3f(vertices_and_normals[6*i], vertices_and_normals[6*i+1], vertices_and_normals[6*i+2]);
+}
+
+static Vector3f vertex_normal( const std::vector<float>& vertices_and_normals, size_t i )
+{
+    return Vector3f(vertices_and_normals[6*i+3], vertices_and_normals[6*i+4], vertices_and_normals[6*i+5]);
+}
+
+// writes the used vertices and the faces back into the mesh, in their old order
+static void compact_mesh( mMeshData& mesh, const std::vector<Vector3f>& positions, const std::vector<Vector3f>& normals, const std::vector<Face>& faces )
+{
+    const uint32_t unused = UINT32_MAX;
+    std::vector<uint32_t> new_index(positions.size(), unused);
+    uint32_t n_used = 0;
+    for (const Face& f : faces)
+        for (uint32_t v : f)
+            if (new_index[v] == unused)
+                new_index[v] = 0;
+    for (size_t v=0; v<positions.size(); ++v)
+        if (new_index[v] != unused)
+            new_index[v] = n_used++;
+
+    mesh.vertices_and_normals.assign(6 * static_cast<size_t>(n_used), 0.0f);
+    for (size_t v=0; v<positions.size(); ++v)
+    {
+        if (new_index[v] == unused)
+            continue;
+        float* out = &mesh.vertices_and_normals[6 * static_cast<size_t>(new_index[v])];
+        for (int a=0; a<3; ++a)
+        {
+            out[a] = positions[v][a];
+            out[a+3] = normals[v][a];
+        }
+    }
+
+    mesh.faces.clear();
+    mesh.faces.reserve(3 * faces.size());
+    for (const Face& f : faces)
+        for (uint32_t v : f)
+            mesh.faces.push_back(new_index[v]);
+}
+
+size_t weld_mesh_vertices( mMeshData& mesh, float distance )
+{
+    const size_t n_vertices = mesh.vertices_and_normals.size() / 6;
+    const size_t n_faces = mesh.faces.size() / 3;
+    if (n_vertices == 0 || distance <= 0.0f)
+        return 0;
+
+    // a vertex is merged into the first vertex within distance, found through a hash grid with cells of that size
+    auto cell_key = [distance]( const Vector3f& p, int dx, int dy, int dz ) {
+        int64_t i = static_cast<int64_t>(std::floor(p[0] / distance)) + dx;
+        int64_t j = static_cast<int64_t>(std::floor(p[1] / distance)) + dy;
+        int64_t k = static_cast<int64_t>(std::floor(p[2] / distance)) + dz;
+        return static_cast<uint64_t>(i * 73856093) ^ static_cast<uint64_t>(j * 19349663) ^ static_cast<uint64_t>(k * 83492791);
+    };
+
+    std::unordered_multimap<uint64_t, uint32_t> cells;
+    cells.reserve(n_vertices);
+    std::vector<uint32_t> merged_into(n_vertices);
+    std::vector<Vector3f> positions(n_vertices), normals(n_vertices, Vector3f(0.0f, 0.0f, 0.0f));
+
+    for (size_t v=0; v<n_vertices; ++v)
+    {
+        positions[v] = vertex_position(mesh.vertices_and_normals, v);
+
+        uint32_t target = static_cast<uint32_t>(v);
+        for (int d=0; d<27 && target == v; ++d)
+        {
+            auto range = cells.equal_range(cell_key(positions[v], d % 3 - 1, (d / 3) % 3 - 1, d / 9 - 1));
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                if ((positions[it->second] - positions[v]).norm() < distance)
+                {
+                    target = it->second;
+                    break;
+                }
+            }
+        }
+
+        merged_into[v] = target;
+        normals[target] += vertex_normal(mesh.vertices_and_normals, v);
+        if (target == v)
+            cells.emplace(cell_key(positions[v], 0, 0, 0), target);
+    }
+
+    for (Vector3f& n : normals)
+        if (n.squaredNorm() > 0.0f)
+            n.normalize();
+
+    std::vector<Face> faces;
+    faces.reserve(n_faces);
+    for (size_t f=0; f<n_faces; ++f)
+    {
+        Face face = { merged_into[mesh.faces[3*f]], merged_into[mesh.faces[3*f+1]], merged_into[mesh.faces[3*f+2]] };
+        if (face[0] != face[1] && face[1] != face[2] && face[2] != face[0])
+            faces.push_back(face);
+    }
+
+    compact_mesh(mesh, positions, normals, faces);
+    return n_faces - faces.size();
+}
+
+namespace
+{
+    // sum of squared distances to a set of planes, v^T Q v with v = (x, y, z, 1)
+    typedef Eigen::Matrix4d Quadric;
+
+    struct Collapse {
+        double cost;
+        uint32_t u, v;
+        uint32_t u_version, v_version;
+        Vector3f position;
+
+        bool operator<( const Collapse& other ) const { return cost > other.cost; } // cheapest on top of the queue
+    };
+
+    class Decimator {
+    public:
+        Decimator( mMeshData& mesh, float max_error ) : mesh(mesh), max_cost(static_cast<double>(max_error) * max_error) {}
+
+        size_t run();
+
+    private:
+        mMeshData& mesh;
+        const double max_cost;
+
+        std::vector<Vector3f> positions;
+        std::vector<Vector3f> normals;
+        std::vector<Quadric> quadrics;
+        std::vector<uint32_t> versions;     // changed whenever the vertex moves, older collapses of it are skipped
+        std::vector<bool> vertex_alive;
+        std::vector<bool> locked;           // on the border of the mesh, never moved
+        std::vector<std::vector<uint32_t>> vertex_faces;
+
+        std::vector<Face> faces;
+        std::vector<bool> face_alive;
+
+        std::priority_queue<Collapse> queue;
+
+        void push_collapse( uint32_t u, uint32_t v );
+        bool is_valid( uint32_t u, uint32_t v, const Vector3f& position ) const;
+        void collapse( const Collapse& c );
+    };
+}
+
+void Decimator::push_collapse( uint32_t u, uint32_t v )
+{
+    // a vertex on the border can only take in a vertex from inside, and stays where it is
+    if (locked[u] && locked[v])
+        return;
+    if (locked[v])
+        std::swap(u, v);
+
+    Quadric q = quadrics[u] + quadrics[v];
+    auto cost_at = [&q]( const Eigen::Vector3d& p ) {
+        Eigen::Vector4d x(p[0], p[1], p[2], 1.0);
+        return std::max(0.0, x.dot(q * x));
+    };
+
+    // the point with the smallest error, or the best of the ends and the middle if it is not well defined
+    Eigen::Vector3d pu = positions[u].cast<double>(), pv = positions[v].cast<double>();
+    Eigen::Vector3d best = locked[u] ? pu : Eigen::Vector3d(0.5 * (pu + pv));
+    double best_cost = cost_at(best);
+
+    Eigen::Matrix3d A = q.topLeftCorner<3,3>();
+    Eigen::FullPivLU<Eigen::Matrix3d> lu(A);
+    if (!locked[u] && lu.isInvertible() && std::abs(lu.determinant()) > 1e-12 * std::pow(A.norm(), 3))
+    {
+        Eigen::Vector3d optimum = lu.solve(-q.topRightCorner<3,1>());
+        // a far away optimum of an almost flat region is not taken, the vertex should stay around the edge
+        if ((optimum - best).norm() <= (pu - pv).norm())
+        {
+            double c = cost_at(optimum);
+            if (c < best_cost) { best = optimum; best_cost = c; }
+        }
+    }
+    for (const Eigen::Vector3d& p : { pu, pv })
+    {
+        if (locked[u])
+            break;
+        double c = cost_at(p);
+        if (c < best_cost) { best = p; best_cost = c; }
+    }
+
+    if (best_cost > max_cost)
+        return;
+
+    Collapse c;
+    c.cost = best_cost;
+    c.u = u; c.v = v;
+    c.u_version = versions[u]; c.v_version = versions[v];
+    c.position = best.cast<float>();
+    queue.push(c);
+}
+
+bool Decimator::is_valid( uint32_t u, uint32_t v, const Vector3f& position ) const
+{
+    // link condition: the vertices next to both u and v have to be the third vertices of the faces of the edge,
+    // otherwise the collapse pinches the surface
+    std::vector<uint32_t> neighbors_u, neighbors_v;
+    size_t shared_faces = 0;
+    for (uint32_t f : vertex_faces[u])
+    {
+        bool has_v = false;
+        for (uint32_t w : faces[f])
+        {
+            has_v = has_v || w == v;
+            if (w != u) neighbors_u.push_back(w);
+        }
+        if (has_v) ++shared_faces;
+    }
+    for (uint32_t f : vertex_faces[v])
+        for (uint32_t w : faces[f])
+            if (w != v) neighbors_v.push_back(w);
+
+    std::sort(neighbors_u.begin(), neighbors_u.end());
+    neighbors_u.erase(std::unique(neighbors_u.begin(), neighbors_u.end()), neighbors_u.end());
+    std::sort(neighbors_v.begin(), neighbors_v.end());
+    neighbors_v.erase(std::unique(neighbors_v.begin(), neighbors_v.end()), neighbors_v.end());
+
+    std::vector<uint32_t> common;
+    std::set_intersection(neighbors_u.begin(), neighbors_u.end(), neighbors_v.begin(), neighbors_v.end(), std::back_inserter(common));
+    if (shared_faces != 2 || common.size() != 2)
+        return false;
+
+    // no face that stays may turn over or become degenerate
+    for (uint32_t x : { u, v })
+    {
+        for (uint32_t f : vertex_faces[x])
+        {
+            const Face& face = faces[f];
+            if (std::find(face.begin(), face.end(), u) != face.end() && std::find(face.begin(), face.end(), v) != face.end())
+                continue;
+
+            Vector3f p[3], moved[3];
+            for (int k=0; k<3; ++k)
+            {
+                p[k] = positions[face[k]];
+                moved[k] = face[k] == x ? position : p[k];
+            }
+            Vector3f before = (p[1] - p[0]).cross(p[2] - p[0]);
+            Vector3f after = (moved[1] - moved[0]).cross(moved[2] - moved[0]);
+            if (after.dot(before) <= 0.25f * before.norm() * after.norm() || after.squaredNorm() <= 0.0f)
+                return false;
+        }
+    }
+    return true;
+}
+
+void Decimator::collapse( const Collapse& c )
+{
+    const uint32_t u = c.u, v = c.v;
+
+    positions[u] = c.position;
+    Vector3f n = normals[u] + normals[v];
+    if (n.squaredNorm() > 0.0f)
+        normals[u] = n.normalized();
+    quadrics[u] += quadrics[v];
+    ++versions[u];
+    ++versions[v];
+    vertex_alive[v] = false;
+
+    // the faces of the edge go, the other faces of v are moved to u
+    std::vector<uint32_t> faces_u;
+    for (uint32_t f : vertex_faces[u])
+    {
+        Face& face = faces[f];
+        if (std::find(face.begin(), face.end(), v) != face.end())
+            face_alive[f] = false;
+        else
+            faces_u.push_back(f);
+    }
+    for (uint32_t f : vertex_faces[v])
+    {
+        if (!face_alive[f])
+            continue;
+        for (uint32_t& w : faces[f])
+            if (w == v) w = u;
+        faces_u.push_back(f);
+    }
+    vertex_faces[u] = faces_u;
+    vertex_faces[v].clear();
+
+    // the faces of the two vertices next to the edge that were removed
+    for (uint32_t f : vertex_faces[u])
+        for (uint32_t w : faces[f])
+        {
+            auto& list = vertex_faces[w];
+            list.erase(std::remove_if(list.begin(), list.end(), [this]( uint32_t g ) { return !face_alive[g]; }), list.end());
+        }
+
+    // the edges around u have new costs
+    std::vector<uint32_t> neighbors;
+    for (uint32_t f : vertex_faces[u])
+        for (uint32_t w : faces[f])
+            if (w != u) neighbors.push_back(w);
+    std::sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+    for (uint32_t w : neighbors)
+        push_collapse(std::min(u, w), std::max(u, w));
+}
+
+size_t Decimator::run()
+{
+    const size_t n_vertices = mesh.vertices_and_normals.size() / 6;
+    const size_t n_faces = mesh.faces.size() / 3;
+    if (n_faces == 0)
+        return 0;
+
+    positions.resize(n_vertices);
+    normals.resize(n_vertices);
+    for (size_t i=0; i<n_vertices; ++i)
+    {
+        positions[i] = vertex_position(mesh.vertices_and_normals, i);
+        normals[i] = vertex_normal(mesh.vertices_and_normals, i);
+    }
+
+    faces.resize(n_faces);
+    face_alive.assign(n_faces, true);
+    vertex_faces.assign(n_vertices, std::vector<uint32_t>());
+    quadrics.assign(n_vertices, Quadric::Zero());
+    versions.assign(n_vertices, 0);
+    vertex_alive.assign(n_vertices, true);
+    locked.assign(n_vertices, false);
+
+    for (size_t f=0; f<n_faces; ++f)
+    {
+        faces[f] = { mesh.faces[3*f], mesh.faces[3*f+1], mesh.faces[3*f+2] };
+
+        // the plane of the face, added to the quadrics of its vertices
+        Eigen::Vector3d p0 = positions[faces[f][0]].cast<double>();
+        Eigen::Vector3d normal = (positions[faces[f][1]].cast<double>() - p0).cross(positions[faces[f][2]].cast<double>() - p0);
+        if (normal.norm() > 0.0)
+        {
+            normal.normalize();
+            Eigen::Vector4d plane(normal[0], normal[1], normal[2], -normal.dot(p0));
+            Quadric q = plane * plane.transpose();
+            for (uint32_t v : faces[f])
+                quadrics[v] += q;
+        }
+        for (uint32_t v : faces[f])
+            vertex_faces[v].push_back(static_cast<uint32_t>(f));
+    }
+
+    // every edge once, the ones with a single face are on the border and their vertices are locked
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    edges.reserve(3 * n_faces);
+    for (const Face& face : faces)
+        for (int k=0; k<3; ++k)
+            edges.push_back(std::make_pair(std::min(face[k], face[(k+1)%3]), std::max(face[k], face[(k+1)%3])));
+    std::sort(edges.begin(), edges.end());
+    for (size_t i=0; i<edges.size(); )
+    {
+        size_t j = i;
+        while (j < edges.size() && edges[j] == edges[i])
+            ++j;
+        if (j - i != 2)
+            locked[edges[i].first] = locked[edges[i].second] = true;
+        i = j;
+    }
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    for (const auto& e : edges)
+        push_collapse(e.first, e.second);
+
+    while (!queue.empty())
+    {
+        Collapse c = queue.top();
+        queue.pop();
+
+        if (!vertex_alive[c.u] || !vertex_alive[c.v] || c.u_version != versions[c.u] || c.v_version != versions[c.v])
+            continue;
+        if (!is_valid(c.u, c.v, c.position))
+            continue;
+
+        collapse(c);
+    }
+
+    std::vector<Face> kept;
+    kept.reserve(n_faces);
+    for (size_t f=0; f<n_faces; ++f)
+        if (face_alive[f])
+            kept.push_back(faces[f]);
+
+    compact_mesh(mesh, positions, normals, kept);
+    return n_faces - kept.size();
+}
+
+size_t decimate_mesh( mMeshData& mesh, float max_error )
+{
+    if (max_error <= 0.0f)
+        return 0;
+
+    Decimator decimator(mesh, max_error);
+    return decimator.run();
+}
+
+void simplify_mesh( mMeshData& mesh, const mMeshSimplification& settings )
+{
+    if (settings.weld_distance > 0.0f)
+        weld_mesh_vertices(mesh, settings.weld_distance);
+    if (settings.max_error > 0.0f)
+        decimate_mesh(mesh, settings.max_error);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "mesh_record.hpp"
+
+#include <cstddef>
+
+/*
+ *  optional post-processing of the meshes before they are written (see MarchingCubePipeline).
+ *  marching cubes puts a vertex on every crossed edge of the grid, so flat water gets as many triangles as a wave,
+ *  and vertices close to a grid corner come out as near-duplicates with slivers between them.
+ *  welding merges vertices closer than weld_distance and drops the faces that collapse with them
+ *  (two sheets of water closer than that are pinched together where they almost touch),
+ *  decimation collapses edges (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics") as long as
+ *  the new vertex stays within max_error of the planes of all original faces around it.
+ *  the border of open meshes is kept as it is, and no collapse flips a face or makes the mesh non-manifold.
+ */
+struct mMeshSimplification
+{
+    float weld_distance = 0.0f; // 0 to skip welding
+    float max_error = 0.0f;     // in the units of the mesh, 0 to skip decimation
+
+    bool enabled() const { return weld_distance > 0.0f || max_error > 0.0f; }
+};
+
+typedef struct mMeshSimplification mMeshSimplification;
+
+// both return the number of removed faces, the vertices are renumbered and unused ones removed
+size_t weld_mesh_vertices( mMeshData& mesh, float distance );
+size_t decimate_mesh( mMeshData& mesh, float max_error );
+
+void simplify_mesh( mMeshData& mesh, const mMeshSimplification& settings );
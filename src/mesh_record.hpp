@@ -9,6 +9,8 @@
 
 #include <Eigen/Geometry>
 
+#include <cstdint>
+
 using Eigen::Vector3f;
 
 struct mMeshData
@@ -46,3 +48,21 @@ struct mMeshSeries
 };
 
 typedef struct mMeshSeries mMeshSeries;
+
+/*
+ *  indexed mesh file, written by MeshRecordWriter (mesh_record_writer.hpp) and read by MeshRecordReader.
+ *  laid out like the simulation record (sim_record.hpp), all sizes and offsets are uint64, the chunks are cereal binary:
+ *
+ *      mesh_file_magic | uint32 version | uint32 0
+ *      size | unit_voxel_length and c
+ *      size | codec | frame 0
+ *      size | codec | frame 1
+ *      ...
+ *      0 | offsets of all frames | uint64 offset of the index | uint64 number of frames | mesh_index_magic
+ *
+ *  the frames do not depend on each other, so a reader maps the file and decodes only the frame it shows.
+ *  files without the magic are whole cereal mMeshSeries like they used to be written, they are still read.
+ */
+static const char mesh_file_magic[] = "SPHMESH1";
+static const char mesh_index_magic[] = "SPHMESX1";
+static const uint32_t mesh_file_version = 1;
@@ -0,0 +1,164 @@
+#include "mesh_record_reader.hpp"
+#include "mesh_codec.hpp"
+#include "mapped_buffer.hpp"
+
+#include <cereal/types/vector.hpp>
+#include <cereal/archives/binary.hpp>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <exception>
+
+bool MeshRecordReader::open( const std::string& file_path )
+{
+    close();
+
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "could not open the mesh file " << file_path << std::endl;
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+    {
+        file_size = static_cast<size_t>(file_stat.st_size);
+        void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+            data = static_cast<const char*>(mapping);
+        else
+            file_size = 0;
+    }
+    ::close(fd); // the mapping stays valid without the descriptor
+
+    bool indexed = data != nullptr && file_size >= 16 && std::memcmp(data, mesh_file_magic, 8) == 0;
+    bool ok = false;
+
+    try {
+        ok = indexed ? read_indexed_record() : read_whole_record(file_path);
+    } catch (const std::exception& e) {
+        std::cout << "could not read the mesh file " << file_path << ", " << e.what() << std::endl;
+    }
+
+    if (!ok)
+        close();
+    return ok;
+}
+
+void MeshRecordReader::close()
+{
+    if (data != nullptr)
+        munmap(const_cast<char*>(data), file_size);
+
+    data = nullptr;
+    file_size = 0;
+    n_frames = 0;
+    frame_offsets.clear();
+    loaded_series = mMeshSeries();
+}
+
+bool MeshRecordReader::read_indexed_record()
+{
+    uint32_t version = read_raw<uint32_t>(data + 8);
+    if (version == 0 || version > mesh_file_version)
+    {
+        std::cout << "mesh file has version " << version << ", can only read up to version " << mesh_file_version << std::endl;
+        return false;
+    }
+
+    size_t pos = 16;
+    uint64_t header_size = read_raw<uint64_t>(data + pos);
+    if (pos + 8 + header_size > file_size)
+        return false;
+    {
+        MappedBuffer buffer(data + pos + 8, header_size);
+        std::istream is(&buffer);
+        cereal::BinaryInputArchive input(is);
+        input(loaded_series.unit_voxel_length, loaded_series.c);
+    }
+    size_t end_of_header = pos + 8 + header_size;
+
+    bool has_index = file_size >= end_of_header + 24 && std::memcmp(data + file_size - 8, mesh_index_magic, 8) == 0;
+    if (has_index)
+    {
+        uint64_t index_offset = read_raw<uint64_t>(data + file_size - 24);
+        n_frames = read_raw<uint64_t>(data + file_size - 16);
+        if (index_offset < end_of_header || index_offset > file_size - 24)
+            return false;
+
+        MappedBuffer buffer(data + index_offset, file_size - 24 - index_offset);
+        std::istream is(&buffer);
+        cereal::BinaryInputArchive input(is);
+        input(frame_offsets);
+
+        // checked like the frames found without index, so a damaged index can not send read_frame outside of the file
+        for (uint64_t offset : frame_offsets)
+        {
+            if (offset < end_of_header || offset > file_size - 8 ||
+                read_raw<uint64_t>(data + offset) == 0 || read_raw<uint64_t>(data + offset) > file_size - 8 - offset)
+            {
+                std::cout << "mesh file has a broken index" << std::endl;
+                return false;
+            }
+        }
+
+        return frame_offsets.size() == n_frames;
+    }
+
+    // the writer did not finish, the frames that were written completely are found by their sizes
+    std::cout << "mesh file has no index, looking for the written frames" << std::endl;
+    pos = end_of_header;
+    while (pos + 8 <= file_size)
+    {
+        uint64_t size = read_raw<uint64_t>(data + pos);
+        if (size == 0 || pos + 8 + size > file_size)
+            break;
+
+        frame_offsets.push_back(pos);
+        pos += 8 + size;
+    }
+    n_frames = frame_offsets.size();
+    return true;
+}
+
+bool MeshRecordReader::read_whole_record( const std::string& file_path )
+{
+    if (data != nullptr)
+        munmap(const_cast<char*>(data), file_size);
+    data = nullptr;
+    file_size = 0;
+
+    std::ifstream file(file_path, std::ios::binary);
+    cereal::BinaryInputArchive input(file);
+    input(loaded_series);
+
+    n_frames = loaded_series.meshSeries.size();
+    return true;
+}
+
+void MeshRecordReader::read_frame( size_t index, mMeshData& mesh ) const
+{
+    if (index >= n_frames)
+        throw "Mesh frame index out of range!";
+
+    if (data == nullptr)
+    {
+        mesh = loaded_series.meshSeries[index];
+        return;
+    }
+
+    size_t pos = frame_offsets[index];
+    uint64_t size = read_raw<uint64_t>(data + pos);
+
+    MappedBuffer buffer(data + pos + 8, size);
+    std::istream is(&buffer);
+    cereal::BinaryInputArchive input(is);
+    decode_mesh(input, mesh);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "mesh_record.hpp"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ *  reads a mesh file frame by frame. indexed files (see mesh_record.hpp) are mapped into memory and only the
+ *  requested frame is decoded, so opening a file takes no time whatever its size.
+ *  old files (a whole cereal mMeshSeries) are loaded as a whole, like before.
+ *  the frames do not depend on each other and nothing is cached, so several threads can read frames at once.
+ */
+class MeshRecordReader {
+public:
+    MeshRecordReader() {}
+    ~MeshRecordReader() { close(); }
+
+    // owns the mapping, so it is not copied
+    MeshRecordReader( const MeshRecordReader& ) = delete;
+    MeshRecordReader& operator=( const MeshRecordReader& ) = delete;
+
+    bool open( const std::string& file_path );
+    void close();
+
+    size_t number_of_frames() const { return n_frames; }
+    float unit_voxel_length() const { return loaded_series.unit_voxel_length; }
+    float c() const { return loaded_series.c; }
+
+    void read_frame( size_t index, mMeshData& mesh ) const;
+
+private:
+    const char* data = nullptr;
+    size_t file_size = 0;
+    size_t n_frames = 0;
+
+    std::vector<uint64_t> frame_offsets;
+    mMeshSeries loaded_series; // unit_voxel_length and c, and all frames of files without index
+
+    bool read_indexed_record();
+    bool read_whole_record( const std::string& file_path );
+};
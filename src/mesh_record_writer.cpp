@@ -0,0 +1,92 @@
+#include "mesh_record_writer.hpp"
+
+#include <cereal/types/vector.hpp>
+
+#include <iostream>
+
+template <class T>
+static void write_raw( std::ostream& os, const T& value )
+{
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// writes the size in front of a chunk once it is complete
+template <class F>
+static void write_chunk( std::ofstream& file, F write_content )
+{
+    std::streampos start = file.tellp();
+    write_raw(file, static_cast<uint64_t>(0));
+    {
+        cereal::BinaryOutputArchive output(file);
+        write_content(output);
+    }
+    std::streampos end = file.tellp();
+    file.seekp(start);
+    write_raw(file, static_cast<uint64_t>(end - start) - 8);
+    file.seekp(end);
+}
+
+bool MeshRecordWriter::open( const std::string& path, float unit_voxel_length, float c, MeshCodec mesh_codec )
+{
+    close();
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cout << "could not open " << path << " for the meshes" << std::endl;
+        return false;
+    }
+    file_path = path;
+    codec = mesh_codec;
+    frame_offsets.clear();
+
+    file.write(mesh_file_magic, 8);
+    write_raw(file, mesh_file_version);
+    write_raw(file, static_cast<uint32_t>(0));
+
+    write_chunk(file, [unit_voxel_length, c]( cereal::BinaryOutputArchive& output ) { output(unit_voxel_length, c); });
+    return static_cast<bool>(file);
+}
+
+void MeshRecordWriter::write_frame( const mMeshData& mesh )
+{
+    if (!file.is_open())
+        throw "Mesh file is not open!";
+
+    frame_offsets.push_back(static_cast<uint64_t>(file.tellp()));
+    MeshCodec mesh_codec = codec;
+    write_chunk(file, [&mesh, mesh_codec]( cereal::BinaryOutputArchive& output ) { encode_mesh(output, mesh, mesh_codec); });
+}
+
+bool MeshRecordWriter::close()
+{
+    if (!file.is_open())
+        return true;
+
+    uint64_t index_offset = static_cast<uint64_t>(file.tellp()) + 8;
+    write_raw(file, static_cast<uint64_t>(0));
+    {
+        cereal::BinaryOutputArchive output(file);
+        output(frame_offsets);
+    }
+    write_raw(file, index_offset);
+    write_raw(file, static_cast<uint64_t>(frame_offsets.size()));
+    file.write(mesh_index_magic, 8);
+
+    bool written = static_cast<bool>(file);
+    file.close();
+    if (!written)
+        std::cout << "could not write the meshes to " << file_path << std::endl;
+    return written;
+}
+
+bool write_mesh_record( const std::string& file_path, const mMeshSeries& series, MeshCodec codec )
+{
+    MeshRecordWriter writer;
+    if (!writer.open(file_path, series.unit_voxel_length, series.c, codec))
+        return false;
+
+    for (const mMeshData& mesh : series.meshSeries)
+        writer.write_frame(mesh);
+    return writer.close();
+}
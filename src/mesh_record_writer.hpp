@@ -0,0 +1,36 @@
+#pragma once
+
+#include "mesh_record.hpp"
+#include "mesh_codec.hpp"
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ *  writes an indexed mesh file (see mesh_record.hpp) frame by frame instead of keeping all meshes in memory.
+ *  the index of all frames is appended when the writer is closed, like SimulationRecordWriter does for the states.
+ */
+class MeshRecordWriter {
+public:
+    MeshRecordWriter() {}
+    ~MeshRecordWriter() { close(); }
+
+    bool open( const std::string& file_path, float unit_voxel_length, float c, MeshCodec codec );
+    void write_frame( const mMeshData& mesh );
+    // appends the index, false if anything could not be written
+    bool close();
+
+    bool is_open() const { return file.is_open(); }
+    size_t number_of_frames() const { return frame_offsets.size(); }
+
+private:
+    std::ofstream file;
+    std::string file_path;
+    MeshCodec codec = QUANTIZED_MESH_CODEC;
+    std::vector<uint64_t> frame_offsets;
+};
+
+// writes a whole series at once
+bool write_mesh_record( const std::string& file_path, const mMeshSeries& series, MeshCodec codec );
@@ -6,6 +6,7 @@
 
 #include "math_types.hpp"
 #include "sim_record.hpp"
+#include "sim_record_reader.hpp"
 
 #include <cereal/types/vector.hpp>
 #include <cereal/archives/json.hpp>
@@ -30,19 +31,18 @@ int main(int argc, char* argv[])
 		return CLIapp.exit(e);
 	}
 
-    SimulationRecord sim_record;
+    SimulationRecordReader sim_reader;
+    if (!sim_reader.open(file))
+        return -1;
 
-    std::ifstream is(file);
-    cereal::BinaryInputArchive infile(is);
-    infile(sim_record);
-
-    int total_frame = sim_record.states.size();
+    int total_frame = sim_reader.number_of_states();
     std::vector<double> avg_density(total_frame, 0.0);
     std::vector<double> max_density(total_frame, 0.0);
 
-    for (int i=0; i<sim_record.states.size(); ++i)
+    SimulationState state;
+    for (int i=0; i<total_frame; ++i)
     {
-        auto state = sim_record.states[i];
+        sim_reader.read_state(i, state);
         int particle_number = state.particles.size();
 
         for (int j=0; j<particle_number; ++j)
@@ -0,0 +1,491 @@
+#include "record_codec.hpp"
+
+#include <cereal/types/vector.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace Simulator;
+
+// IEEE half precision, rounded to nearest even
+static uint16_t float_to_half( float value )
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    int exponent = static_cast<int>((bits >> 23) & 0xff);
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff) // inf and nan
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+    exponent += 15 - 127;
+    if (exponent >= 31) // too large for half
+        return sign | 0x7c00;
+
+    if (exponent <= 0) // subnormal half, its steps are 2^-24
+        return sign | static_cast<uint16_t>(std::nearbyint(std::fabs(value) * 16777216.0f));
+
+    uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        ++half; // a carry into the exponent is still the right rounding
+    return sign | static_cast<uint16_t>(half);
+}
+
+static float half_to_float( uint16_t half )
+{
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    if (exponent == 0)
+    {
+        float value = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -value : value;
+    }
+
+    uint32_t bits = (exponent == 31) ? (sign | 0x7f800000 | (mantissa << 13))
+                                     : (sign | ((exponent + 127 - 15) << 23) | (mantissa << 13));
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+struct QuantizedAxis {
+    double min;
+    double step;
+
+    uint32_t quantize( double x ) const { return static_cast<uint32_t>(std::lround((x - min) / step)); }
+    double restore( uint32_t q ) const { return min + q * step; }
+};
+
+static QuantizedAxis axis_between( double min, double max, int bits )
+{
+    QuantizedAxis axis;
+    axis.min = min;
+    axis.step = (max > min) ? (max - min) / static_cast<double>((1u << bits) - 1) : 1.0;
+    return axis;
+}
+
+// bits per axis that keep the error of the positions below max_error, 0 if even 21 bits are not enough
+static int position_bits( const std::vector<mParticle>& particles, Real max_error )
+{
+    double max_extent = 0.0;
+    for (int k=0; k<3; ++k)
+    {
+        auto range = std::minmax_element(particles.begin(), particles.end(),
+            [k](const mParticle& a, const mParticle& b) { return a.position[k] < b.position[k]; });
+        max_extent = std::max(max_extent, static_cast<double>(range.second->position[k] - range.first->position[k]));
+    }
+
+    // rounding moves a position by at most half a step per axis
+    for (int bits : {16, 21})
+    {
+        if (0.5 * std::sqrt(3.0) * max_extent / static_cast<double>((1u << bits) - 1) <= max_error)
+            return bits;
+    }
+    return 0;
+}
+
+static void encode_particles( cereal::BinaryOutputArchive& output, const std::vector<mParticle>& particles, int bits )
+{
+    uint64_t n = particles.size();
+    output(n);
+    if (n == 0)
+        return;
+
+    uint8_t stored_bits = static_cast<uint8_t>(bits);
+    output(stored_bits);
+
+    QuantizedAxis axes[3];
+    for (int k=0; k<3; ++k)
+    {
+        auto range = std::minmax_element(particles.begin(), particles.end(),
+            [k](const mParticle& a, const mParticle& b) { return a.position[k] < b.position[k]; });
+        axes[k] = axis_between(range.first->position[k], range.second->position[k], bits);
+        output(axes[k].min, axes[k].step);
+    }
+
+    // 16 bits per axis are stored as three uint16, 21 bits are packed into one uint64
+    if (bits == 16)
+    {
+        std::vector<uint16_t> q(3 * n);
+        for (size_t i=0; i<n; ++i)
+            for (int k=0; k<3; ++k)
+                q[3*i+k] = static_cast<uint16_t>(axes[k].quantize(particles[i].position[k]));
+        output(cereal::binary_data(q.data(), q.size() * sizeof(uint16_t)));
+    }
+    else
+    {
+        std::vector<uint64_t> q(n);
+        for (size_t i=0; i<n; ++i)
+            for (int k=0; k<3; ++k)
+                q[i] |= static_cast<uint64_t>(axes[k].quantize(particles[i].position[k])) << (21 * k);
+        output(cereal::binary_data(q.data(), q.size() * sizeof(uint64_t)));
+    }
+
+    std::vector<uint16_t> velocities(3 * n);
+    for (size_t i=0; i<n; ++i)
+        for (int k=0; k<3; ++k)
+            velocities[3*i+k] = float_to_half(static_cast<float>(particles[i].velocity[k]));
+    output(cereal::binary_data(velocities.data(), velocities.size() * sizeof(uint16_t)));
+
+    auto density_range = std::minmax_element(particles.begin(), particles.end(),
+        [](const mParticle& a, const mParticle& b) { return a.density < b.density; });
+    QuantizedAxis density_axis = axis_between(density_range.first->density, density_range.second->density, 16);
+    output(density_axis.min, density_axis.step);
+
+    std::vector<uint16_t> densities(n);
+    for (size_t i=0; i<n; ++i)
+        densities[i] = static_cast<uint16_t>(density_axis.quantize(particles[i].density));
+    output(cereal::binary_data(densities.data(), densities.size() * sizeof(uint16_t)));
+
+    // the fluid has one mass, the boundary particles have one each
+    bool uniform_mass = std::all_of(particles.begin(), particles.end(),
+        [&particles](const mParticle& p) { return p.mass == particles[0].mass; });
+    output(uniform_mass);
+    if (uniform_mass)
+    {
+        output(particles[0].mass);
+    }
+    else
+    {
+        for (auto& p : particles)
+            output(p.mass);
+    }
+}
+
+static void decode_particles( cereal::BinaryInputArchive& input, std::vector<mParticle>& particles )
+{
+    uint64_t n;
+    input(n);
+    particles.resize(n);
+    if (n == 0)
+        return;
+
+    uint8_t bits;
+    input(bits);
+
+    QuantizedAxis axes[3];
+    for (int k=0; k<3; ++k)
+        input(axes[k].min, axes[k].step);
+
+    if (bits == 16)
+    {
+        std::vector<uint16_t> q(3 * n);
+        input(cereal::binary_data(q.data(), q.size() * sizeof(uint16_t)));
+        for (size_t i=0; i<n; ++i)
+            for (int k=0; k<3; ++k)
+                particles[i].position[k] = static_cast<Real>(axes[k].restore(q[3*i+k]));
+    }
+    else
+    {
+        std::vector<uint64_t> q(n);
+        input(cereal::binary_data(q.data(), q.size() * sizeof(uint64_t)));
+        for (size_t i=0; i<n; ++i)
+            for (int k=0; k<3; ++k)
+                particles[i].position[k] = static_cast<Real>(axes[k].restore(static_cast<uint32_t>((q[i] >> (21 * k)) & 0x1fffff)));
+    }
+
+    std::vector<uint16_t> velocities(3 * n);
+    input(cereal::binary_data(velocities.data(), velocities.size() * sizeof(uint16_t)));
+    for (size_t i=0; i<n; ++i)
+        for (int k=0; k<3; ++k)
+            particles[i].velocity[k] = static_cast<Real>(half_to_float(velocities[3*i+k]));
+
+    QuantizedAxis density_axis;
+    input(density_axis.min, density_axis.step);
+
+    std::vector<uint16_t> densities(n);
+    input(cereal::binary_data(densities.data(), densities.size() * sizeof(uint16_t)));
+    for (size_t i=0; i<n; ++i)
+        particles[i].density = static_cast<Real>(density_axis.restore(densities[i]));
+
+    bool uniform_mass;
+    input(uniform_mass);
+    if (uniform_mass)
+    {
+        Real mass;
+        input(mass);
+        for (auto& p : particles)
+            p.mass = mass;
+    }
+    else
+    {
+        for (auto& p : particles)
+            input(p.mass);
+    }
+}
+
+// zigzag varints, small values of either sign take a single byte
+static void put_varint( std::vector<uint8_t>& bytes, int64_t value )
+{
+    uint64_t v = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    while (v >= 0x80)
+    {
+        bytes.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    bytes.push_back(static_cast<uint8_t>(v));
+}
+
+static int64_t get_varint( const std::vector<uint8_t>& bytes, size_t& pos )
+{
+    uint64_t v = 0;
+    for (int shift=0; shift<64; shift+=7)
+    {
+        if (pos >= bytes.size())
+            throw "Delta state ends too early!";
+        uint8_t b = bytes[pos++];
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+    throw "Delta state has a broken varint!";
+}
+
+// beyond 2^52 steps from the origin a double can not hold the neighbouring grid coordinates anymore
+static bool to_grid( double value, double step, int64_t& q )
+{
+    double x = std::nearbyint(value / step);
+    if (!(std::fabs(x) <= 4503599627370496.0)) // also false for nan
+        return false;
+    q = static_cast<int64_t>(x);
+    return true;
+}
+
+static bool quantize_particles( const std::vector<mParticle>& particles, QuantizedParticles& q )
+{
+    size_t n = particles.size();
+    q.positions.resize(3 * n);
+    q.velocities.resize(3 * n);
+    q.densities.resize(n);
+    q.masses.resize(n);
+
+    for (size_t i=0; i<n; ++i)
+    {
+        for (int k=0; k<3; ++k)
+        {
+            if (!to_grid(particles[i].position[k], q.position_step, q.positions[3*i+k]) ||
+                !to_grid(particles[i].velocity[k], q.velocity_step, q.velocities[3*i+k]))
+                return false;
+        }
+        if (!to_grid(particles[i].density, q.density_step, q.densities[i]))
+            return false;
+        q.masses[i] = particles[i].mass;
+    }
+    return true;
+}
+
+// rounds the state to the grids of the previous state for a delta state, or to new grids for a keyframe
+static bool quantize_state( const SimulationState& state, const QuantizationSettings& settings, const DeltaHistory* previous, DeltaHistory& next )
+{
+    QuantizedParticles* sets[2] = { &next.particles, &next.moving_boundary_particles };
+    const QuantizedParticles* previous_sets[2] = { previous ? &previous->particles : nullptr, previous ? &previous->moving_boundary_particles : nullptr };
+
+    for (int s=0; s<2; ++s)
+    {
+        if (previous_sets[s])
+        {
+            sets[s]->position_step = previous_sets[s]->position_step;
+            sets[s]->velocity_step = previous_sets[s]->velocity_step;
+            sets[s]->density_step = previous_sets[s]->density_step;
+        }
+        else
+        {
+            // like above the error bounds are distances, rounding moves every axis by half a step
+            sets[s]->position_step = 2.0 * settings.max_position_error / std::sqrt(3.0);
+            sets[s]->velocity_step = 2.0 * settings.max_velocity_error / std::sqrt(3.0);
+            sets[s]->density_step = 2.0 * settings.max_density_error;
+        }
+    }
+    return quantize_particles(state.particles, next.particles) &&
+           quantize_particles(state.moving_boundary_particles, next.moving_boundary_particles);
+}
+
+// a keyframe (previous == nullptr) stores every value relative to the one of the particle before
+static void write_delta_particles( cereal::BinaryOutputArchive& output, const QuantizedParticles& q, const QuantizedParticles* previous )
+{
+    uint64_t n = q.masses.size();
+    output(n);
+
+    if (previous == nullptr)
+    {
+        output(q.position_step, q.velocity_step, q.density_step);
+
+        bool uniform_mass = n > 0 && std::all_of(q.masses.begin(), q.masses.end(), [&q](Real m) { return m == q.masses[0]; });
+        output(uniform_mass);
+        if (uniform_mass)
+            output(q.masses[0]);
+        else
+            output(cereal::binary_data(q.masses.data(), q.masses.size() * sizeof(Real)));
+    }
+
+    std::vector<uint8_t> bytes;
+    bytes.reserve(7 * n);
+    auto put_deltas = [&bytes](const std::vector<int64_t>& values, const std::vector<int64_t>* reference, size_t stride)
+    {
+        for (size_t i=0; i<values.size(); ++i)
+        {
+            int64_t base = reference ? (*reference)[i] : (i >= stride ? values[i-stride] : 0);
+            put_varint(bytes, values[i] - base);
+        }
+    };
+    put_deltas(q.positions, previous ? &previous->positions : nullptr, 3);
+    put_deltas(q.velocities, previous ? &previous->velocities : nullptr, 3);
+    put_deltas(q.densities, previous ? &previous->densities : nullptr, 1);
+    output(bytes);
+}
+
+static void read_delta_particles( cereal::BinaryInputArchive& input, std::vector<mParticle>& particles, QuantizedParticles& q, bool keyframe )
+{
+    uint64_t n;
+    input(n);
+
+    if (keyframe)
+    {
+        input(q.position_step, q.velocity_step, q.density_step);
+
+        bool uniform_mass;
+        input(uniform_mass);
+        q.masses.resize(n);
+        if (uniform_mass)
+        {
+            Real mass;
+            input(mass);
+            std::fill(q.masses.begin(), q.masses.end(), mass);
+        }
+        else
+        {
+            input(cereal::binary_data(q.masses.data(), q.masses.size() * sizeof(Real)));
+        }
+        q.positions.assign(3 * n, 0);
+        q.velocities.assign(3 * n, 0);
+        q.densities.assign(n, 0);
+    }
+    else if (n != q.masses.size())
+    {
+        throw "Delta state does not match the state before!";
+    }
+
+    std::vector<uint8_t> bytes;
+    input(bytes);
+    size_t pos = 0;
+    auto get_deltas = [&bytes, &pos, keyframe](std::vector<int64_t>& values, size_t stride)
+    {
+        for (size_t i=0; i<values.size(); ++i)
+        {
+            int64_t base = keyframe ? (i >= stride ? values[i-stride] : 0) : values[i];
+            values[i] = base + get_varint(bytes, pos);
+        }
+    };
+    get_deltas(q.positions, 3);
+    get_deltas(q.velocities, 3);
+    get_deltas(q.densities, 1);
+
+    particles.resize(n);
+    for (size_t i=0; i<n; ++i)
+    {
+        for (int k=0; k<3; ++k)
+        {
+            particles[i].position[k] = static_cast<Real>(q.positions[3*i+k] * q.position_step);
+            particles[i].velocity[k] = static_cast<Real>(q.velocities[3*i+k] * q.velocity_step);
+        }
+        particles[i].density = static_cast<Real>(q.densities[i] * q.density_step);
+        particles[i].mass = q.masses[i];
+    }
+}
+
+void Simulator::encode_state( cereal::BinaryOutputArchive& output, const SimulationState& state, RecordCodec codec,
+                              const QuantizationSettings& settings, DeltaHistory& history )
+{
+    if (codec == DELTA_CODEC || codec == DELTA_KEYFRAME_CODEC)
+    {
+        DeltaHistory next;
+        bool delta = codec == DELTA_CODEC && history.valid && history.states_since_keyframe + 1 < settings.keyframe_interval
+                  && quantize_state(state, settings, &history, next)
+                  && next.particles.masses == history.particles.masses
+                  && next.moving_boundary_particles.masses == history.moving_boundary_particles.masses;
+
+        if (delta || quantize_state(state, settings, nullptr, next))
+        {
+            uint8_t codec_id = static_cast<uint8_t>(delta ? DELTA_CODEC : DELTA_KEYFRAME_CODEC);
+            output(codec_id);
+            write_delta_particles(output, next.particles, delta ? &history.particles : nullptr);
+            write_delta_particles(output, next.moving_boundary_particles, delta ? &history.moving_boundary_particles : nullptr);
+
+            next.states_since_keyframe = delta ? history.states_since_keyframe + 1 : 0;
+            next.valid = true;
+            history = std::move(next);
+            return;
+        }
+
+        // the state does not fit on the grids, the next one has to be a keyframe again
+        history.valid = false;
+        codec = RAW_CODEC;
+    }
+
+    int fluid_bits = 0;
+    int boundary_bits = 0;
+    history.valid = false;
+
+    if (codec == QUANTIZED_CODEC)
+    {
+        fluid_bits = state.particles.empty() ? 16 : position_bits(state.particles, settings.max_position_error);
+        boundary_bits = state.moving_boundary_particles.empty() ? 16 : position_bits(state.moving_boundary_particles, settings.max_position_error);
+
+        // the error bound cannot be kept, so this state is stored as it is
+        if (fluid_bits == 0 || boundary_bits == 0)
+            codec = RAW_CODEC;
+    }
+
+    uint8_t codec_id = static_cast<uint8_t>(codec);
+    output(codec_id);
+
+    if (codec == RAW_CODEC)
+    {
+        output(state);
+        return;
+    }
+
+    encode_particles(output, state.particles, fluid_bits);
+    encode_particles(output, state.moving_boundary_particles, boundary_bits);
+}
+
+void Simulator::decode_state( cereal::BinaryInputArchive& input, SimulationState& state, DeltaHistory& history )
+{
+    uint8_t codec_id;
+    input(codec_id);
+
+    switch (codec_id) {
+    case RAW_CODEC:
+        history.valid = false;
+        input(state);
+        break;
+    case QUANTIZED_CODEC:
+        history.valid = false;
+        decode_particles(input, state.particles);
+        decode_particles(input, state.moving_boundary_particles);
+        break;
+    case DELTA_KEYFRAME_CODEC:
+    case DELTA_CODEC:
+    {
+        bool keyframe = codec_id == DELTA_KEYFRAME_CODEC;
+        if (!keyframe && !history.valid)
+            throw "Delta state without the state before it!";
+
+        history.valid = false; // until the state is decoded completely
+        read_delta_particles(input, state.particles, history.particles, keyframe);
+        read_delta_particles(input, state.moving_boundary_particles, history.moving_boundary_particles, keyframe);
+        history.states_since_keyframe = keyframe ? 0 : history.states_since_keyframe + 1;
+        history.valid = true;
+        break;
+    }
+    default:
+        throw "Unknown codec of the recorded state!";
+    }
+}
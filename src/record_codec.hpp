@@ -0,0 +1,56 @@
+#pragma once
+
+#include "sim_record.hpp"
+#include "math_types.hpp"
+
+#include <cereal/archives/binary.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace Simulator
+{
+    // how a state is stored in an indexed record, the id is written in front of every state.
+    // a writer set to DELTA_CODEC writes a DELTA_KEYFRAME_CODEC state every keyframe_interval states
+    enum RecordCodec { RAW_CODEC = 0, QUANTIZED_CODEC = 1, DELTA_KEYFRAME_CODEC = 2, DELTA_CODEC = 3 };
+
+/*
+ *  compact encodings of the recorded particles.
+ *  quantized, about 15 instead of 64 bytes per particle: positions relative to the bounding box of the frame with
+ *    16 bits per axis if that keeps the error below max_position_error, else 21 bits (else the state is stored raw),
+ *    velocities as half floats, densities with 16 bits between the lowest and highest of the frame, a shared mass once.
+ *  keyframe + delta: positions, velocities and densities are rounded to fixed grids, a keyframe stores the grid
+ *    coordinates relative to the previous particle, the states after it relative to the same particle in the previous
+ *    state, as zigzag varints. the deltas add up exactly, so the error does not grow until the next keyframe.
+ *    a state is also stored as keyframe when the number of particles or their masses changed.
+ */
+    struct QuantizationSettings {
+        Real max_position_error = 0.0001; // distance between the stored and the simulated position
+        Real max_velocity_error = 0.0005; // only used by the delta codec, the quantized codec stores half floats
+        Real max_density_error = 0.01;    // only used by the delta codec
+        unsigned keyframe_interval = 30;
+    };
+
+    // grid coordinates of the previous state, what the delta states are relative to
+    struct QuantizedParticles {
+        double position_step = 0.0;
+        double velocity_step = 0.0;
+        double density_step = 0.0;
+        std::vector<int64_t> positions;
+        std::vector<int64_t> velocities;
+        std::vector<int64_t> densities;
+        std::vector<Real> masses;
+    };
+
+    struct DeltaHistory {
+        QuantizedParticles particles;
+        QuantizedParticles moving_boundary_particles;
+        unsigned states_since_keyframe = 0;
+        bool valid = false; // false until a keyframe was written or read
+    };
+
+    // history is only used by the delta codecs, encoding and decoding update it to the state that was passed
+    void encode_state( cereal::BinaryOutputArchive& output, const SimulationState& state, RecordCodec codec,
+                       const QuantizationSettings& settings, DeltaHistory& history );
+    void decode_state( cereal::BinaryInputArchive& input, SimulationState& state, DeltaHistory& history );
+}
@@ -18,6 +18,8 @@
 #include "marching_cube_fluid.hpp"
 #include "marching_cube.hpp"
 #include "mesh_record.hpp"
+#include "marching_cube_pipeline.hpp"
+#include "sim_record_reader.hpp"
 
 #include <cereal/types/vector.hpp>
 #include <cereal/archives/json.hpp>
@@ -28,6 +30,7 @@
 #include <unistd.h>
 #include <cstring>
 #include <atomic>
+#include <thread>
 
 using Eigen::Vector2f;
 using Eigen::Vector3f;
@@ -35,6 +38,7 @@ using Eigen::Quaternionf;
 using Eigen::AngleAxisf;
 
 using Simulator::Real;
+using Simulator::SimulationRecordReader;
 
 using std::chrono::duration;
 using std::cout;
@@ -63,6 +67,22 @@ int main(int argc, char* argv[])
     double c = 0.6;
     CLIapp.add_option("-c", c, "estimated surface density");
 
+    unsigned n_threads = std::max(1u, std::thread::hardware_concurrency());
+    CLIapp.add_option("-t, --threads", n_threads, "number of frames meshed at the same time, the openmp threads are split between them");
+
+    bool sparse = false;
+    CLIapp.add_flag("-s, --sparse", sparse, "only compute the density field near the particles, for splashes and thin sheets in large boxes");
+
+    bool anisotropic = false;
+    CLIapp.add_flag("-a, --anisotropic", anisotropic, "anisotropic kernels, smooth surfaces at a coarser unit_length (always sparse)");
+
+    mMeshSimplification simplification;
+    CLIapp.add_option("-w, --weld", simplification.weld_distance, "merge mesh vertices closer than this, 0 to keep them all");
+    CLIapp.add_option("-d, --decimate", simplification.max_error, "collapse triangles of every mesh as long as the surface moves less than this, 0 to keep them all");
+
+    bool raw = false;
+    CLIapp.add_flag("--raw", raw, "store the vertices and normals as floats, the default quantizes them to 16 bits (several times smaller)");
+
     CLIapp.option_defaults()->required();
 
     std::string input_file;
@@ -77,29 +97,17 @@ int main(int argc, char* argv[])
         return CLIapp.exit(e);
     }
 
-	mMeshSeries ms;
-
-    static vector<unsigned int> output_indices;
-    static vector<float> output_vertices;
-
-    marching_cube_fluid fluid(unit_voxel_length, c, input_file);
-    fluid.start_marching_cube();
-
-    fluid.output_marching_indices(output_indices);
-    fluid.output_marching_vertices_and_normals(output_vertices);
+    SimulationRecordReader reader;
+    if (!reader.open(input_file))
+        return -1;
 
-    mMeshData md;
-    md.vertices_and_normals = output_vertices;
-    md.faces = output_indices;
-    md.bounding_box = Vector3f(fluid.total_x_length, fluid.total_y_length, fluid.total_z_length);
-    md.origin = fluid.origin;
+    // frames are meshed by n_threads workers, each with its own marching_cube_fluid,
+    // the grid of every frame is still followed in order, so the meshes are the same for any number of threads
+    MarchingCubePipeline pipeline(unit_voxel_length, c, reader.header(), n_threads, 2 * n_threads, sparse, anisotropic);
+    pipeline.set_simplification(simplification);
+    if (!pipeline.open(output_file, raw ? RAW_MESH_CODEC : QUANTIZED_MESH_CODEC))
+        return -1;
 
-    ms.meshSeries.push_back(md);
-
-    ms.c = static_cast<float>(c);
-    ms.unit_voxel_length = unit_voxel_length;
-
-    fluid.count += skip;
     /*
     ////////////////////////////////////////////////////////////////
     // code allow we use ctrl-c to quit the simulation while it still store data.
@@ -110,34 +118,18 @@ int main(int argc, char* argv[])
     sigaction(SIGINT,&sa,NULL);
     //////////////////////////////////////////////////////////////////////////
     */
-    while (!fluid.end)
+    // the states are read in order, so a delta record decodes every state only once
+    SimulationState state;
+    for (size_t i = 0; i < reader.number_of_states(); i += skip)
     {
-        fluid.update_marching_cube();
-        if (fluid.end)
-        	break;
-
-        fluid.output_marching_indices(output_indices);
-        fluid.output_marching_vertices_and_normals(output_vertices);
-
-        mMeshData md2;
-        md2.vertices_and_normals = output_vertices;
-        md2.faces = output_indices;
-        md2.bounding_box = Vector3f(fluid.total_x_length, fluid.total_y_length, fluid.total_z_length);
-        md2.origin = fluid.origin;
-
-        ms.meshSeries.push_back(md2);
-
-        fluid.count += skip;
-        cout<<"iteration "<<fluid.count<<endl;
+        reader.read_state(i, state);
+        pipeline.add_state(state);
         ////////////////////////////////////////////////////////////
         //if( quit.load() ) break;    // exit normally after SIGINT
         ////////////////////////////////////////////////////////////
     }
-
-    std::ofstream os(output_file, std::ios::binary);
-    cereal::BinaryOutputArchive archive( os );
-
-    archive( ms );
+    if (!pipeline.finish())
+        return -1;
     cout<<"cerealing mesh data!"<<endl;
     return 0;
 }
@@ -14,6 +14,9 @@
 #include <string>
 
 #include "SPHSimulator.hpp"
+#include "marching_cube_pipeline.hpp"
+
+#include <memory>
 
 using namespace std;
 
@@ -57,6 +60,55 @@ int main(int argc, char **argv)
     float unit_particle_length = 0.1f;
     CLIapp.add_option("-u, --unit_particle_length", unit_particle_length, " the intervel length between two particles per axis.");
 
+    int z_sort_interval = 100;
+    CLIapp.add_option("-k, --z_sort_interval", z_sort_interval, "reorder the particles along the z-curve every <z_sort_interval> frames, 0 to disable");
+
+    bool kernel_table = false;
+    CLIapp.add_flag("--kernel_table", kernel_table, "read the kernel from a lookup table instead of evaluating it, faster but only close to the exact kernel");
+
+    int record_queue = 2;
+    CLIapp.add_option("-q, --record_queue", record_queue, "number of recorded frames that can wait for the background writer, 0 writes them on the simulation thread");
+
+    float position_error = 0.0f;
+    CLIapp.add_option("-p, --position_error", position_error, "record quantized frames with at most this position error (in units of the particle spacing, 0.001 for instance), 0 records them exactly");
+
+    int keyframe_interval = 0;
+    CLIapp.add_option("--keyframe_interval", keyframe_interval, "with a position error, store every <keyframe_interval>-th recorded frame whole and the frames between as deltas to the frame before, 0 quantizes every frame on its own");
+
+    int checkpoint_interval = 0;
+    CLIapp.add_option("--checkpoint_interval", checkpoint_interval, "write a checkpoint to continue the run from every <checkpoint_interval> frames, 0 to disable");
+
+    std::string checkpoint_file;
+    CLIapp.add_option("--checkpoint", checkpoint_file, "path of the checkpoint, <output_file>.checkpoint by default");
+
+    bool resume = false;
+    CLIapp.add_flag("--resume", resume, "continue from the checkpoint and the record of an earlier run with the same options");
+
+    std::string mesh_file;
+    CLIapp.add_option("--mesh_output", mesh_file, "also mesh the recorded frames while simulating, and write them to this file like save_fluid_mesh");
+
+    float mesh_unit_length = 0.1f;
+    CLIapp.add_option("--mesh_unit_length", mesh_unit_length, "resolution of the meshes, like -u of save_fluid_mesh");
+
+    double mesh_c = 0.6;
+    CLIapp.add_option("--mesh_c", mesh_c, "estimated surface density of the meshes, like -c of save_fluid_mesh");
+
+    unsigned mesh_threads = 1;
+    CLIapp.add_option("--mesh_threads", mesh_threads, "number of threads meshing the frames next to the simulation");
+
+    bool mesh_sparse = false;
+    CLIapp.add_flag("--mesh_sparse", mesh_sparse, "mesh on the narrow band around the particles only, like --sparse of save_fluid_mesh");
+
+    bool mesh_anisotropic = false;
+    CLIapp.add_flag("--mesh_anisotropic", mesh_anisotropic, "mesh with anisotropic kernels, like --anisotropic of save_fluid_mesh");
+
+    mMeshSimplification mesh_simplification;
+    CLIapp.add_option("--mesh_weld", mesh_simplification.weld_distance, "merge mesh vertices closer than this, like --weld of save_fluid_mesh");
+    CLIapp.add_option("--mesh_decimate", mesh_simplification.max_error, "decimate the meshes with this error bound, like --decimate of save_fluid_mesh");
+
+    bool mesh_raw = false;
+    CLIapp.add_flag("--mesh_raw", mesh_raw, "store the meshes with float vertices and normals, like --raw of save_fluid_mesh");
+
     CLIapp.option_defaults()->required();
 
     int N;
@@ -102,6 +154,13 @@ int main(int argc, char **argv)
     cout << "total number of simulation frames = " << total_simulation << endl;
     cout << "unit_particle_length = " 		<< unit_particle_length << endl;
     cout << "output_file = " 				<< output_file << endl;
+    cout << "z_sort_interval = " 			<< z_sort_interval << endl;
+    cout << "kernel_table = " 				<< std::boolalpha << kernel_table << endl;
+    cout << "record_queue = " 				<< record_queue << endl;
+    cout << "position_error = " 			<< position_error << endl;
+    cout << "keyframe_interval = " 			<< keyframe_interval << endl;
+    cout << "checkpoint_interval = " 		<< checkpoint_interval << endl;
+    cout << "mesh_output = " 				<< mesh_file << endl;
     if (solver_type == 0)
     	cout << "solver = WCSPH" << endl;
     else if (solver_type == 1)
@@ -117,22 +176,63 @@ int main(int argc, char **argv)
     sigaction(SIGINT,&sa,NULL);
     //////////////////////////////////////////////////////////////////////////
     // a for loop to generate every thing, and then run...
-    Simulation simulation(N, mode, unit_particle_length, dt, eta, B, alpha, rest_density, output_file, false, with_viscosity, with_XSPH, solver_type);
+    if (checkpoint_file.empty())
+        checkpoint_file = output_file + ".checkpoint";
+    cout << "checkpoint = " 				<< checkpoint_file << (resume ? " (resuming from it)" : "") << endl;
+
+    Simulation simulation(N, mode, unit_particle_length, dt, eta, B, alpha, rest_density, output_file, false, with_viscosity, with_XSPH, solver_type,
+                          resume ? checkpoint_file : std::string());
+    simulation.p_sphSimulator->set_z_sort_interval(z_sort_interval);
+    simulation.p_sphSimulator->set_kernel_lookup_table(kernel_table);
+    if (position_error > 0.0f)
+        simulation.p_sphSimulator->set_record_quantization(position_error, keyframe_interval);
+    if (record_queue > 0)
+        simulation.p_sphSimulator->set_record_queue(record_queue);
+
+    // the frames are meshed while the simulation goes on and written to the mesh file as they are done
+    std::unique_ptr<MarchingCubePipeline> mesh_pipeline;
+    if (!mesh_file.empty() && resume)
+    {
+        cout << "the meshes of a resumed run would miss the frames before the checkpoint, run save_fluid_mesh on the record instead" << endl;
+    }
+    else if (!mesh_file.empty())
+    {
+        mesh_pipeline.reset(new MarchingCubePipeline(mesh_unit_length, mesh_c, simulation.p_sphSimulator->get_sim_record(), mesh_threads, 2 * mesh_threads, mesh_sparse, mesh_anisotropic));
+        mesh_pipeline->set_simplification(mesh_simplification);
+        if (!mesh_pipeline->open(mesh_file, mesh_raw ? RAW_MESH_CODEC : QUANTIZED_MESH_CODEC))
+            return -1;
+        MarchingCubePipeline* pipeline = mesh_pipeline.get();
+        simulation.p_sphSimulator->set_record_observer([pipeline](const SimulationState& state) { pipeline->add_state(state); });
+    }
 
-    for(int i=0;i<total_simulation;++i)
+    for(int i=simulation.start_step;i<total_simulation;++i)
     {
         simulation.p_sphSimulator->update_simulation();
 
         if (i % step_size == 0){
             simulation.p_sphSimulator->update_sim_record_state();
             ////////////////////////////////////////////////////////////
-            if( quit.load() ) break;    // exit normally after SIGINT
+            if( quit.load() ){    // exit normally after SIGINT
+                if (checkpoint_interval > 0)
+                    simulation.p_sphSimulator->save_checkpoint(checkpoint_file, i+1);
+                break;
+            }
             ////////////////////////////////////////////////////////////
         }
 
+        if (checkpoint_interval > 0 && (i+1) % checkpoint_interval == 0)
+            simulation.p_sphSimulator->save_checkpoint(checkpoint_file, i+1);
+
         std::cout<<"iteration "<< i <<std::endl;
     }
 
+    if (mesh_pipeline)
+    {
+        simulation.p_sphSimulator->set_record_observer(nullptr);
+        if (mesh_pipeline->finish())
+            cout << "wrote " << mesh_pipeline->number_of_frames() << " meshes to " << mesh_file << endl;
+    }
+
 
     return 0;
 
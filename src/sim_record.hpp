@@ -3,6 +3,8 @@
 #include <Particle.hpp>
 #include "math_types.hpp"
 
+#include <cstdint>
+
 using namespace Simulator;  //why here we use this namespace?
 
 namespace Simulator
@@ -61,5 +63,26 @@ namespace Simulator
     };
 
     typedef struct SimulationRecord SimulationRecord;
+
+/*
+ *  indexed record file, written by SimulationRecordWriter and read by SimulationRecordReader.
+ *  all sizes and offsets are uint64, the chunks are cereal binary:
+ *
+ *      record_file_magic | uint32 version | uint32 sizeof(Real)
+ *      size | run parameters and boundary_particles
+ *      size | codec | state 0
+ *      size | codec | state 1
+ *      ...
+ *      0 | sets and the offsets of all states | uint64 offset of the index | uint64 number of states | record_index_magic
+ *
+ *  the index at the end lets readers map the file and decode any state without touching the others.
+ *  it is only written when the writer is closed, a file without it is read by walking over the sizes of the states.
+ *  files without the magic are whole cereal SimulationRecords like they used to be written, they are still read.
+ *  the codec of the states (see record_codec.hpp) was added in version 2, in version 1 all states are raw without codec id.
+ *  version 3 added the delta codecs, whose states depend on the states before them back to the last keyframe.
+ */
+    static const char record_file_magic[] = "SPHSIMR1";
+    static const char record_index_magic[] = "SPHSIMX1";
+    static const uint32_t record_file_version = 3;
 }
 
@@ -0,0 +1,201 @@
+#include "sim_record_reader.hpp"
+#include "record_codec.hpp"
+#include "mapped_buffer.hpp"
+
+#include <cereal/types/vector.hpp>
+#include <cereal/archives/binary.hpp>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <exception>
+
+using namespace Simulator;
+
+bool SimulationRecordReader::open( const std::string& file_path )
+{
+    close();
+
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "could not open the simulation record " << file_path << std::endl;
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+    {
+        file_size = static_cast<size_t>(file_stat.st_size);
+        void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+            data = static_cast<const char*>(mapping);
+        else
+            file_size = 0;
+    }
+    ::close(fd); // the mapping stays valid without the descriptor
+
+    bool indexed = data != nullptr && file_size >= 16 && std::memcmp(data, record_file_magic, 8) == 0;
+    bool ok = false;
+
+    try {
+        ok = indexed ? read_indexed_record() : read_whole_record(file_path);
+    } catch (const std::exception& e) {
+        std::cout << "could not read the simulation record " << file_path << ", " << e.what() << std::endl;
+    }
+
+    if (!ok)
+        close();
+    return ok;
+}
+
+void SimulationRecordReader::close()
+{
+    if (data != nullptr)
+        munmap(const_cast<char*>(data), file_size);
+
+    data = nullptr;
+    file_size = 0;
+    n_states = 0;
+    version = 0;
+    record_header = SimulationRecord();
+    state_offsets.clear();
+    loaded_states.clear();
+    delta_history = DeltaHistory();
+}
+
+bool SimulationRecordReader::read_indexed_record()
+{
+    size_t pos = 8;
+    version = read_raw<uint32_t>(data + pos);
+    uint32_t real_size = read_raw<uint32_t>(data + pos + 4);
+    pos += 8;
+
+    if (version == 0 || version > record_file_version)
+    {
+        std::cout << "simulation record has version " << version << ", can only read up to version " << record_file_version << std::endl;
+        return false;
+    }
+    if (real_size != sizeof(Real))
+    {
+        std::cout << "simulation record was written with " << real_size << " byte reals, this build uses " << sizeof(Real) << std::endl;
+        return false;
+    }
+
+    uint64_t header_size = read_raw<uint64_t>(data + pos);
+    if (pos + 8 + header_size > file_size)
+        return false;
+    {
+        MappedBuffer buffer(data + pos + 8, header_size);
+        std::istream is(&buffer);
+        cereal::BinaryInputArchive input(is);
+        SimulationRecord& h = record_header;
+        input(h.timestep, h.unit_particle_length, h.eta, h.rest_density, h.B, h.alpha, h.solver_type, h.boundary_particles);
+    }
+    size_t end_of_header = pos + 8 + header_size;
+
+    bool has_index = file_size >= end_of_header + 24 && std::memcmp(data + file_size - 8, record_index_magic, 8) == 0;
+    if (has_index)
+    {
+        uint64_t index_offset = read_raw<uint64_t>(data + file_size - 24);
+        n_states = read_raw<uint64_t>(data + file_size - 16);
+        if (index_offset < end_of_header || index_offset > file_size - 24)
+            return false;
+
+        MappedBuffer buffer(data + index_offset, file_size - 24 - index_offset);
+        std::istream is(&buffer);
+        cereal::BinaryInputArchive input(is);
+        input(record_header.sets, state_offsets);
+
+        // checked like the states found without index, so a damaged index can not send read_state outside of the file
+        for (uint64_t offset : state_offsets)
+        {
+            if (offset < end_of_header || offset > file_size - 8 ||
+                read_raw<uint64_t>(data + offset) == 0 || read_raw<uint64_t>(data + offset) > file_size - 8 - offset)
+            {
+                std::cout << "simulation record has a broken index" << std::endl;
+                return false;
+            }
+        }
+
+        return state_offsets.size() == n_states;
+    }
+
+    // the writer was not closed, the states that were written completely are found by their sizes
+    std::cout << "simulation record has no index, the run was probably interrupted. looking for the written states" << std::endl;
+    pos = end_of_header;
+    while (pos + 8 <= file_size)
+    {
+        uint64_t size = read_raw<uint64_t>(data + pos);
+        if (size == 0 || pos + 8 + size > file_size)
+            break;
+
+        state_offsets.push_back(pos);
+        pos += 8 + size;
+    }
+    n_states = state_offsets.size();
+    return true;
+}
+
+bool SimulationRecordReader::read_whole_record( const std::string& file_path )
+{
+    if (data != nullptr)
+        munmap(const_cast<char*>(data), file_size);
+    data = nullptr;
+    file_size = 0;
+
+    std::ifstream file(file_path, std::ios::binary);
+    cereal::BinaryInputArchive input(file);
+    input(record_header);
+
+    loaded_states.swap(record_header.states);
+    n_states = loaded_states.size();
+    return true;
+}
+
+void SimulationRecordReader::read_state( size_t index, SimulationState& state ) const
+{
+    if (index >= n_states)
+        throw "State index out of range!";
+
+    if (data == nullptr)
+    {
+        state = loaded_states[index];
+        return;
+    }
+
+    // walk back to the keyframe, or to the last state read if that is closer
+    size_t first = index;
+    if (version >= 2)
+    {
+        while (first > 0 && static_cast<uint8_t>(data[state_offsets[first] + 8]) == DELTA_CODEC &&
+               !(delta_history.valid && delta_history_index == first - 1))
+            --first;
+    }
+
+    for (size_t k=first; k<=index; ++k)
+        decode_indexed_state(k, state);
+}
+
+void SimulationRecordReader::decode_indexed_state( size_t index, SimulationState& state ) const
+{
+    size_t pos = state_offsets[index];
+    uint64_t size = read_raw<uint64_t>(data + pos);
+
+    MappedBuffer buffer(data + pos + 8, size);
+    std::istream is(&buffer);
+    cereal::BinaryInputArchive input(is);
+    if (version < 2)
+    {
+        input(state);
+        return;
+    }
+
+    decode_state(input, state, delta_history);
+    delta_history_index = index;
+}
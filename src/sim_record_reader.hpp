@@ -0,0 +1,54 @@
+#pragma once
+
+#include "sim_record.hpp"
+#include "record_codec.hpp"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Simulator
+{
+/*
+ *  reads a simulation record state by state. indexed records (see sim_record.hpp) are mapped into memory
+ *  and only the requested state is decoded, so files much larger than the memory can be opened.
+ *  old records without the index are loaded as a whole, like before.
+ */
+    class SimulationRecordReader {
+    public:
+        SimulationRecordReader() {}
+        ~SimulationRecordReader() { close(); }
+
+        // owns the mapping, so it is not copied
+        SimulationRecordReader( const SimulationRecordReader& ) = delete;
+        SimulationRecordReader& operator=( const SimulationRecordReader& ) = delete;
+
+        bool open( const std::string& file_path );
+        void close();
+
+        // run parameters, boundary_particles and sets of the record, states is always empty
+        const SimulationRecord& header() const { return record_header; }
+        size_t number_of_states() const { return n_states; }
+
+        // a delta state is decoded from its keyframe on, unless the state before it was the last one read.
+        // this caches the last state, so a reader must not be used by several threads at once
+        void read_state( size_t index, SimulationState& state ) const;
+
+    private:
+        const char* data = nullptr;
+        size_t file_size = 0;
+        size_t n_states = 0;
+        uint32_t version = 0;
+
+        SimulationRecord record_header;
+        std::vector<uint64_t> state_offsets;
+        std::vector<SimulationState> loaded_states; // only used for records without index
+
+        mutable DeltaHistory delta_history;
+        mutable size_t delta_history_index = 0; // state that delta_history belongs to, if it is valid
+
+        bool read_indexed_record();
+        void decode_indexed_state( size_t index, SimulationState& state ) const;
+        bool read_whole_record( const std::string& file_path );
+    };
+}
@@ -0,0 +1,305 @@
+#include "sim_record_writer.hpp"
+
+#include <cereal/types/vector.hpp>
+#include <cereal/archives/binary.hpp>
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <exception>
+#include <cstring>
+
+#include <unistd.h>
+
+using namespace Simulator;
+
+typedef std::chrono::steady_clock Clock;
+
+static double seconds_since( Clock::time_point start )
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <class T>
+static void write_raw( std::ostream& os, const T& value )
+{
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+bool SimulationRecordWriter::open( const std::string& file_path, const SimulationRecord& header )
+{
+    close();
+
+    file.open(file_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cout << "could not open " << file_path << " for the simulation record" << std::endl;
+        return false;
+    }
+
+    reset_state(header);
+
+    file.write(record_file_magic, 8);
+    write_raw(file, record_file_version);
+    write_raw(file, static_cast<uint32_t>(sizeof(Real)));
+
+    std::streampos chunk = begin_chunk();
+    {
+        cereal::BinaryOutputArchive output(file);
+        output(header.timestep, header.unit_particle_length, header.eta, header.rest_density, header.B, header.alpha, header.solver_type, header.boundary_particles);
+    }
+    end_chunk(chunk);
+
+    file.flush();
+    return true;
+}
+
+template <class T>
+static bool read_raw( std::istream& is, T& value )
+{
+    return static_cast<bool>(is.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+bool SimulationRecordWriter::resume( const std::string& file_path, const SimulationRecord& header, uint64_t n_keep )
+{
+    close();
+
+    std::ifstream in(file_path, std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+    {
+        std::cout << "could not open " << file_path << " to continue the simulation record" << std::endl;
+        return false;
+    }
+    uint64_t file_size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    char magic[8];
+    uint32_t version = 0, real_size = 0;
+    in.read(magic, 8);
+    read_raw(in, version);
+    read_raw(in, real_size);
+    if (!in || std::memcmp(magic, record_file_magic, 8) != 0 || version != record_file_version || real_size != sizeof(Real))
+    {
+        std::cout << file_path << " is not a simulation record of this version and precision, it can not be continued" << std::endl;
+        return false;
+    }
+
+    // walk over the header and the states to keep, like a reader of a record without index
+    std::vector<uint64_t> offsets;
+    uint64_t size = 0;
+    uint64_t pos = 16;
+    for (uint64_t k=0; k<=n_keep; ++k)
+    {
+        in.seekg(pos);
+        if (!read_raw(in, size) || size == 0 || pos + 8 + size > file_size)
+        {
+            std::cout << file_path << " only has " << offsets.size() << " of the " << n_keep << " states it had at the checkpoint" << std::endl;
+            return false;
+        }
+        if (k > 0) // the first chunk is the header
+            offsets.push_back(pos);
+        pos += 8 + size;
+    }
+    in.close();
+
+    if (truncate(file_path.c_str(), static_cast<off_t>(pos)) != 0)
+    {
+        std::cout << "could not cut " << file_path << " back to the checkpoint" << std::endl;
+        return false;
+    }
+
+    file.open(file_path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file.is_open())
+    {
+        std::cout << "could not open " << file_path << " to continue the simulation record" << std::endl;
+        return false;
+    }
+    file.seekp(static_cast<std::streamoff>(pos));
+
+    reset_state(header);
+    state_offsets = offsets;
+    n_states = n_keep;
+    return true;
+}
+
+void SimulationRecordWriter::reset_state( const SimulationRecord& header )
+{
+    n_states = 0;
+    state_offsets.clear();
+    last_sets = header.sets;
+    delta_history = DeltaHistory(); // the first state written is a keyframe
+    stats = Statistics();
+    write_failed = false;
+}
+
+std::streampos SimulationRecordWriter::begin_chunk()
+{
+    std::streampos chunk_position = file.tellp();
+    write_raw(file, static_cast<uint64_t>(0));
+    return chunk_position;
+}
+
+void SimulationRecordWriter::end_chunk( std::streampos chunk_position )
+{
+    std::streampos end = file.tellp();
+    file.seekp(chunk_position);
+    write_raw(file, static_cast<uint64_t>(end - chunk_position) - sizeof(uint64_t));
+    file.seekp(end);
+}
+
+void SimulationRecordWriter::set_codec( RecordCodec new_codec, const QuantizationSettings& settings )
+{
+    codec = new_codec;
+    quantization = settings;
+}
+
+void SimulationRecordWriter::start_async( size_t capacity )
+{
+    if (!file.is_open() || writer_thread.joinable() || capacity == 0)
+        return;
+
+    queue_capacity = capacity;
+    stop_writer = false;
+    writer_thread = std::thread(&SimulationRecordWriter::writer_loop, this);
+}
+
+void SimulationRecordWriter::write_state( SimulationState state, const std::vector<bool>& sets )
+{
+    if (!file.is_open())
+        return;
+
+    if (!writer_thread.joinable())
+    {
+        Clock::time_point start = Clock::now();
+        write_to_file(state, sets);
+        stats.write_seconds += seconds_since(start);
+        ++stats.frames;
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (queue.size() >= queue_capacity)
+    {
+        Clock::time_point start = Clock::now();
+        queue_not_full.wait(lock, [this]{ return queue.size() < queue_capacity; });
+        stats.stall_seconds += seconds_since(start);
+        ++stats.stalled_frames;
+    }
+
+    queue.push_back(PendingState());
+    queue.back().state = std::move(state);
+    queue.back().sets = sets;
+    stats.max_queue_size = std::max(stats.max_queue_size, queue.size());
+    ++stats.frames;
+
+    lock.unlock();
+    queue_not_empty.notify_one();
+}
+
+void SimulationRecordWriter::writer_loop()
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    while (true)
+    {
+        queue_not_empty.wait(lock, [this]{ return stop_writer || !queue.empty(); });
+        if (queue.empty()) // only when stopped, the queue is drained first
+            return;
+
+        PendingState pending = std::move(queue.front());
+        queue.pop_front();
+        writing = true;
+        lock.unlock();
+        queue_not_full.notify_all();
+
+        Clock::time_point start = Clock::now();
+        write_to_file(pending.state, pending.sets);
+        double elapsed = seconds_since(start);
+
+        lock.lock();
+        stats.write_seconds += elapsed;
+        writing = false;
+        queue_not_full.notify_all(); // flush waits for this as well
+    }
+}
+
+void SimulationRecordWriter::write_to_file( const SimulationState& state, const std::vector<bool>& sets )
+{
+    if (write_failed)
+        return;
+
+    // this may run on the writer thread, where an exception would terminate the program,
+    // so a failed write is reported once and the states after it are dropped
+    try {
+        std::streampos chunk = begin_chunk();
+        {
+            cereal::BinaryOutputArchive output(file);
+            encode_state(output, state, codec, quantization, delta_history);
+        }
+        end_chunk(chunk);
+        file.flush();
+
+        state_offsets.push_back(static_cast<uint64_t>(chunk));
+        last_sets = sets;
+        ++n_states;
+    } catch (const std::exception& e) {
+        std::cout << "record writer: writing state " << n_states << " failed, " << e.what() << std::endl;
+        write_failed = true;
+    }
+}
+
+void SimulationRecordWriter::write_index()
+{
+    try {
+        // a chunk of size 0 ends the states for readers that walk over them
+        write_raw(file, static_cast<uint64_t>(0));
+
+        uint64_t index_offset = static_cast<uint64_t>(file.tellp());
+        {
+            cereal::BinaryOutputArchive output(file);
+            output(last_sets, state_offsets);
+        }
+        write_raw(file, index_offset);
+        write_raw(file, n_states);
+        file.write(record_index_magic, 8);
+        file.flush();
+    } catch (const std::exception& e) {
+        std::cout << "record writer: writing the index failed, " << e.what() << std::endl;
+    }
+}
+
+void SimulationRecordWriter::flush()
+{
+    if (!writer_thread.joinable())
+        return;
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    queue_not_full.wait(lock, [this]{ return queue.empty() && !writing; });
+}
+
+void SimulationRecordWriter::close()
+{
+    if (writer_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stop_writer = true;
+        }
+        queue_not_empty.notify_one();
+        writer_thread.join();
+        print_statistics();
+    }
+
+    if (file.is_open())
+    {
+        if (!write_failed)
+            write_index();
+        file.close();
+    }
+}
+
+void SimulationRecordWriter::print_statistics() const
+{
+    std::cout << "record writer: " << stats.frames << " frames, " << stats.write_seconds << " s writing, "
+              << stats.stalled_frames << " frames waited " << stats.stall_seconds << " s for a full queue"
+              << " (max " << stats.max_queue_size << " of " << queue_capacity << " queued)" << std::endl;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "sim_record.hpp"
+#include "record_codec.hpp"
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace Simulator
+{
+/*
+ *  writes a SimulationRecord to disk frame by frame instead of keeping all states in memory,
+ *  in the indexed layout described in sim_record.hpp. every state is flushed once it is written,
+ *  the index of all states is appended when the writer is closed. if the run crashes before that,
+ *  the readers still find all states that were written completely.
+ *
+ *  after start_async the states are serialized and written by a background thread. write_state only moves
+ *  the state into a bounded queue, and waits if the queue is full, which means the disk is the bottleneck.
+ */
+    class SimulationRecordWriter {
+    public:
+        struct Statistics {
+            uint64_t frames = 0;
+            uint64_t stalled_frames = 0;    // the queue was full and the simulation had to wait
+            double   stall_seconds = 0.0;   // time the simulation waited for the queue
+            double   write_seconds = 0.0;   // time spent serializing and writing, on whichever thread does it
+            size_t   max_queue_size = 0;
+        };
+
+        SimulationRecordWriter() {}
+        ~SimulationRecordWriter() { close(); }
+
+        // writes the run parameters and the static boundary of the record, its states are not written
+        bool open( const std::string& file_path, const SimulationRecord& header );
+        // continues a record written by an earlier run of the same simulation after its first n_states states,
+        // the states after them and the index are overwritten
+        bool resume( const std::string& file_path, const SimulationRecord& header, uint64_t n_states );
+        // how the states are encoded, raw by default. the writer thread reads it, so set it before start_async
+        void set_codec( RecordCodec codec, const QuantizationSettings& settings );
+        // queue_capacity states can wait while the writer thread writes another one, 0 keeps writing synchronously
+        void start_async( size_t queue_capacity );
+        void write_state( SimulationState state, const std::vector<bool>& sets );
+        // waits until all queued states are written
+        void flush();
+        // waits until all queued states are written, then appends the index
+        void close();
+
+        bool is_open() const { return file.is_open(); }
+        uint64_t number_of_states() const { return n_states; }
+        const Statistics& statistics() const { return stats; }
+        void print_statistics() const;
+
+    private:
+        std::ofstream file;
+        std::vector<uint64_t> state_offsets;
+        std::vector<bool> last_sets;
+        uint64_t n_states = 0;
+        bool write_failed = false;
+        RecordCodec codec = RAW_CODEC;
+        QuantizationSettings quantization;
+        DeltaHistory delta_history; // the last written state, for the delta codec
+        Statistics stats;
+
+        struct PendingState {
+            SimulationState state;
+            std::vector<bool> sets;
+        };
+
+        std::thread writer_thread;
+        std::mutex queue_mutex;
+        std::condition_variable queue_not_empty;
+        std::condition_variable queue_not_full;
+        std::deque<PendingState> queue;
+        size_t queue_capacity = 0;
+        bool stop_writer = false;
+        bool writing = false; // the writer thread took a state from the queue and did not finish it yet
+
+        void reset_state( const SimulationRecord& header );
+        void write_to_file( const SimulationState& state, const std::vector<bool>& sets );
+        void write_index();
+        void writer_loop();
+
+        // a chunk starts with its size, which stays 0 until end_chunk patches it
+        std::streampos begin_chunk();
+        void end_chunk( std::streampos chunk_position );
+    };
+}
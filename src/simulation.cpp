@@ -5,6 +5,7 @@
 
 #include <merely3d/merely3d.hpp>
 #include <cassert>
+#include <cstdlib>
 
 using merely3d::renderable;
 using merely3d::Rectangle;
@@ -30,15 +31,17 @@ namespace Simulator
     }
 
 
-    Simulation::Simulation(int N, int mode, Real uParticle_len, Real dt, Real eta, Real B, Real alpha, Real rest_density, string fp, bool if_print, int with_viscosity, int with_XSPH, int solver_type)
+    Simulation::Simulation(int N, int mode, Real uParticle_len, Real dt, Real eta, Real B, Real alpha, Real rest_density, string fp, bool if_print, int with_viscosity, int with_XSPH, int solver_type, string checkpoint_fp)
     {
         file_path = fp;
         frame_count = 0;
+        start_step = 0;
         if_print_iteration = if_print;
         time_step = dt;
         this->eta = eta;
         this->B = B;
         this->alpha = alpha;
+        p_sphSimulator = nullptr;
   //      is_finished = false;
     	switch(mode) {
     		case 1:
@@ -84,6 +87,19 @@ namespace Simulator
     			std::cout << "Unknown model." << std::endl;
     			break;
     	}
+
+        // the record is written while the simulation runs, so memory stays bounded and a crash keeps the frames so far
+        if (p_sphSimulator != nullptr && checkpoint_fp.empty())
+            p_sphSimulator->open_sim_record(file_path);
+        else if (p_sphSimulator != nullptr)
+        {
+            try {
+                start_step = p_sphSimulator->resume_from_checkpoint(checkpoint_fp, file_path);
+            } catch (const char* msg) {
+                std::cout << "Error: " << msg << std::endl;
+                std::exit(-1);
+            }
+        }
     }
 
 //    Simulation::Simulation(Real dt, int N) : sphSimulator(dt, N)
@@ -34,7 +34,8 @@ namespace Simulator
     {
     public:
 
-        Simulation(int N, int mode, Real uParticle_len, Real dt, Real eta, Real B, Real alpha, Real rest_density, string fp, bool if_print=false, int with_viscosity=1, int with_XSPH=1, int solver_type=0);
+        // with a checkpoint_fp the scene continues from that checkpoint, and the record in fp after the states it had then
+        Simulation(int N, int mode, Real uParticle_len, Real dt, Real eta, Real B, Real alpha, Real rest_density, string fp, bool if_print=false, int with_viscosity=1, int with_XSPH=1, int solver_type=0, string checkpoint_fp="");
 
 
         //Simulation(Real dt, int N=5);
@@ -47,6 +48,7 @@ namespace Simulator
 
 
         SPHSimulator* p_sphSimulator;
+        int start_step; // 0, or the step of the checkpoint the run continues from
         //float neighbor_search_radius;
 
 
@@ -33,7 +33,8 @@ namespace Simulator
 
 	}
 
-    Visualization::Visualization(std::string simfile, float shift_x)
+    Visualization::Visualization(std::string simfile, float shift_x, size_t cache_frames)
+        : cache_frames(cache_frames)
     {
         player_init();
         simulation_init(simfile);
@@ -43,7 +44,8 @@ namespace Simulator
         shift = Vector3f(shift_x, 0.0f, 0.0f);
     }
 
-    Visualization::Visualization(std::string simfile, std::string meshfile, float shift_x)
+    Visualization::Visualization(std::string simfile, std::string meshfile, float shift_x, size_t cache_frames)
+        : cache_frames(cache_frames)
     {
         player_init();
         simulation_init(simfile);
@@ -58,10 +60,12 @@ namespace Simulator
     {
         input_mesh_record_bin(meshfile);
 
-        unit_voxel_length = mesh_rec.unit_voxel_length;
-        c = mesh_rec.c;
-        bounding_box = mesh_rec.meshSeries[0].bounding_box;
-        origin = mesh_rec.meshSeries[0].origin;
+        if (static_cast<int>(mesh_reader->number_of_frames()) < global_total_frame)
+            global_total_frame = mesh_reader->number_of_frames();
+        unit_voxel_length = mesh_reader->unit_voxel_length();
+        c = mesh_reader->c();
+        bounding_box = mesh_at(0).bounding_box;
+        origin = mesh_at(0).origin;
 
         total_grid = bounding_box[0]/unit_voxel_length * bounding_box[1]/unit_voxel_length * bounding_box[2]/unit_voxel_length;
     }
@@ -69,10 +73,10 @@ namespace Simulator
     void Visualization::simulation_init(std::string simfile)
     {
         input_sim_record_bin(simfile);
-        SimulationState simu_state = sim_rec.states[0];
+        const SimulationState& simu_state = state_at(0);
         particles_num = simu_state.particles.size();
         particle_radius = sim_rec.unit_particle_length/2.0;
-        total_frame_num = sim_rec.states.size();
+        total_frame_num = sim_reader->number_of_states();
         if (total_frame_num < global_total_frame)
             global_total_frame = total_frame_num;
         eta = sim_rec.eta;
@@ -115,16 +119,68 @@ namespace Simulator
 
     void Visualization::input_sim_record_bin(std::string fp)
     {
-        std::ifstream file(fp);
-        cereal::BinaryInputArchive input(file); // stream to cout
-        input(sim_rec);  //not good... maybe directly ar the vector
+        sim_reader = std::make_shared<SimulationRecordReader>();
+        if (!sim_reader->open(fp))
+            throw "Could not read the simulation record!";
+
+        sim_rec = sim_reader->header();
+
+        std::shared_ptr<SimulationRecordReader> reader = sim_reader;
+        state_cache = std::make_shared<FrameCache<SimulationState>>(reader->number_of_states(), cache_frames, cache_frames / 2,
+            [reader](size_t i) {
+                std::shared_ptr<SimulationState> state = std::make_shared<SimulationState>();
+                reader->read_state(i, *state);
+                return std::shared_ptr<const SimulationState>(state);
+            });
+        current_state_frame = -1;
+    }
+
+    int Visualization::read_ahead_step() const
+    {
+        // the frames render_control_panel goes to next
+        if (pausing_flag)
+            return 0;
+        int step = speed_ratio < 1.0 ? 1 : std::max(1, static_cast<int>(speed_ratio + 0.5));
+        return playback_flag ? -step : step;
+    }
+
+    const SimulationState& Visualization::state_at(int frame)
+    {
+        // the renderer asks for the same frame many times, the cache only when the frame changes
+        if (frame != current_state_frame)
+        {
+            current_state = state_cache->get(frame, read_ahead_step());
+            current_state_frame = frame;
+        }
+        return *current_state;
     }
 
     void Visualization::input_mesh_record_bin(std::string fp)
     {
-        std::ifstream file(fp);
-        cereal::BinaryInputArchive input(file); // stream to cout
-        input(mesh_rec);  //not good... maybe directly ar the vector
+        mesh_reader = std::make_shared<MeshRecordReader>();
+        if (!mesh_reader->open(fp))
+            throw "Could not read the mesh file!";
+
+        std::shared_ptr<MeshRecordReader> reader = mesh_reader;
+        mesh_cache = std::make_shared<FrameCache<mMeshData>>(reader->number_of_frames(), cache_frames, cache_frames / 2,
+            [reader](size_t i) {
+                std::shared_ptr<mMeshData> mesh = std::make_shared<mMeshData>();
+                reader->read_frame(i, *mesh);
+                return std::shared_ptr<const mMeshData>(mesh);
+            });
+        current_mesh_frame = -1;
+    }
+
+    const mMeshData& Visualization::mesh_at(int frame)
+    {
+        // like state_at. the StaticMesh is made here and not by the loader, merely3d gives out its ids on one thread only
+        if (frame != current_mesh_frame)
+        {
+            current_mesh = mesh_cache->get(frame, read_ahead_step());
+            current_static_mesh = std::make_shared<merely3d::StaticMesh>(current_mesh->vertices_and_normals, current_mesh->faces);
+            current_mesh_frame = frame;
+        }
+        return *current_mesh;
     }
 
     float Visualization::velocity_to_float(const Eigen::Vector3f& velocity)
@@ -149,7 +205,7 @@ namespace Simulator
     	// set total grid number
         if (!no_mesh)
         {
-    	    Vector3f bb = mesh_rec.meshSeries[sim_count].bounding_box;
+    	    Vector3f bb = mesh_at(sim_count).bounding_box;
             total_grid = bb[0]/unit_voxel_length * bb[1]/unit_voxel_length * bb[2]/unit_voxel_length;
         }
 
@@ -173,12 +229,12 @@ namespace Simulator
 
 		if (render_particle_flag)
 		{
-			std::vector<mParticle>& particles = sim_rec.states[sim_count].particles;
-            std::vector<bool> sets = sim_rec.sets;
+			const std::vector<mParticle>& particles = state_at(sim_count).particles;
+            const std::vector<bool>& sets = sim_rec.sets;
 
 			for (size_t i = 0; i < particles.size(); ++i)
 			{
-				Simulator::mParticle& mparticle = particles[i];
+				const Simulator::mParticle& mparticle = particles[i];
 				Eigen::Vector3f p(static_cast<float>(mparticle.position[0]), static_cast<float>(mparticle.position[1]), static_cast<float>(mparticle.position[2]));
 
 
@@ -226,11 +282,11 @@ namespace Simulator
 				}
 			}
 		} else if (render_discarded_particle_flag) {
-			std::vector<mParticle>& particles = sim_rec.states[sim_count].particles;
+			const std::vector<mParticle>& particles = state_at(sim_count).particles;
 
 			for (size_t i = 0; i < particles.size(); ++i)
 			{
-				Simulator::mParticle& mparticle = particles[i];
+				const Simulator::mParticle& mparticle = particles[i];
 				Eigen::Vector3f p(static_cast<float>(mparticle.position[0]), static_cast<float>(mparticle.position[1]), static_cast<float>(mparticle.position[2]));
 
     			const auto dp_color = Color(0., 0., 0.);
@@ -259,10 +315,10 @@ namespace Simulator
                 frame.draw_particle(Particle(p+shift).with_radius(boundary_particle_size*0.5).with_color(Color(0.2f, 0.2f, 0.2f)));
             }
             
-            std::vector<mParticle>& moving_boundary = sim_rec.states[sim_count].moving_boundary_particles;
+            const std::vector<mParticle>& moving_boundary = state_at(sim_count).moving_boundary_particles;
             for (size_t i =0;i<moving_boundary.size();++i)
             {
-                Simulator::mParticle& mparticle = moving_boundary[i];
+                const Simulator::mParticle& mparticle = moving_boundary[i];
                 Eigen::Vector3f p(static_cast<float>(mparticle.position[0]), static_cast<float>(mparticle.position[1]), static_cast<float>(mparticle.position[2]));
                 frame.draw_particle(Particle(p+shift).with_radius(boundary_particle_size*0.5).with_color(Color(0.2f, 0.2f, 0.2f)));
             }
@@ -274,10 +330,8 @@ namespace Simulator
         	{
     			const auto model_color = Color(1., 1., 1.);
 
-            	auto md = mesh_rec.meshSeries[sim_count];
-
-            	merely3d::StaticMesh mesh(md.vertices_and_normals, md.faces);
-    			frame.draw(renderable(mesh)
+            	mesh_at(sim_count);
+    			frame.draw(renderable(*current_static_mesh)
     					   .with_position(0.0+shift[0], 0.0, 0.0)
     					   .with_material(Material().with_pattern_grid_size(0).with_color(model_color))
     					  );
@@ -285,8 +339,8 @@ namespace Simulator
 
         	if (render_bounding_box_flag)
         	{
-        		bounding_box = mesh_rec.meshSeries[sim_count].bounding_box;
-        		origin = mesh_rec.meshSeries[sim_count].origin;
+        		bounding_box = mesh_at(sim_count).bounding_box;
+        		origin = mesh_at(sim_count).origin;
 
     			const auto box_color = Color(1.0, 1.0, 0.0);
 
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <merely3d/frame.hpp>
+#include <merely3d/mesh.hpp>
 
 #include "math_types.hpp"  //maybe even math_types is not needs
 #include "sim_record.hpp"
+#include "sim_record_reader.hpp"
 #include "mesh_record.hpp"
+#include "mesh_record_reader.hpp"
+#include "frame_cache.hpp"
 #include "Particle.hpp"
 
 #include <iostream>
@@ -17,6 +21,7 @@
 #include <cereal/archives/xml.hpp>
 
 #include <chrono>
+#include <memory>
 
 
 
@@ -26,8 +31,9 @@ namespace Simulator
     {
     public:
     	Visualization();
-        Visualization(std::string simfile, float shift_x=0.0f);
-        Visualization(std::string simfile, std::string meshfile, float shift_x=0.0f);
+        // cache_frames states (and meshes) of the files are kept in memory, half of them are read ahead while playing
+        Visualization(std::string simfile, float shift_x=0.0f, size_t cache_frames=16);
+        Visualization(std::string simfile, std::string meshfile, float shift_x=0.0f, size_t cache_frames=16);
 
         void player_init();
         void simulation_init(std::string simfile);
@@ -49,8 +55,12 @@ namespace Simulator
         // You probably want some methods to add bodies to the system
         // void addBody(const RigidBody & body);
 
-        // Simulation info
+        // Simulation info, sim_rec only holds the run parameters and the boundary,
+        // the states are decoded from the mapped record by the thread of state_cache, only it reads states from sim_reader
         SimulationRecord sim_rec;
+        std::shared_ptr<SimulationRecordReader> sim_reader;
+        std::shared_ptr<FrameCache<SimulationState>> state_cache;
+        const SimulationState& state_at(int frame);
 
         //int sim_count;
         int total_frame_num;
@@ -64,8 +74,10 @@ namespace Simulator
         Real alpha;
         int solver_type;
 
-        // Rendering info
-        mMeshSeries mesh_rec;
+        // Rendering info, the meshes are decoded from the mapped mesh file like the states
+        std::shared_ptr<MeshRecordReader> mesh_reader;
+        std::shared_ptr<FrameCache<mMeshData>> mesh_cache;
+        const mMeshData& mesh_at(int frame);
 
     	float unit_voxel_length;
         float c;
@@ -104,5 +116,16 @@ namespace Simulator
         float acc_to_float(const Eigen::Vector3f& a);
         float velocity_to_float(const Eigen::Vector3f& v);
 
+    private:
+        size_t cache_frames = 16;
+        int read_ahead_step() const;
+
+        std::shared_ptr<const SimulationState> current_state;
+        int current_state_frame = -1;
+
+        std::shared_ptr<const mMeshData> current_mesh;
+        std::shared_ptr<merely3d::StaticMesh> current_static_mesh; // made once per shown frame, not every render
+        int current_mesh_frame = -1;
+
     };
 }
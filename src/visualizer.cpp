@@ -73,6 +73,9 @@ int main(int argc, char* argv[])
 	std::vector<std::string> meshfiles;
 	CLIapp.add_option("-m, --mesh", meshfiles, "path to serialized mesh data");
 
+	size_t cache_frames = 16;
+	CLIapp.add_option("--cache", cache_frames, "number of frames of every file kept in memory, half of them are loaded ahead while playing");
+
 	CLIapp.option_defaults()->required();
 
 	std::vector<std::string> simfiles;
@@ -129,12 +132,12 @@ int main(int argc, char* argv[])
     {
         for (int i=0; i<simfiles.size(); ++i)
         {
-            visualizations.push_back( Visualization(simfiles[i], shift_x[i]) );
+            visualizations.push_back( Visualization(simfiles[i], shift_x[i], cache_frames) );
         }
     }  else{
         for (int i=0; i<simfiles.size(); ++i)
         {
-            visualizations.push_back( Visualization(simfiles[i], meshfiles[i], shift_x[i]) );
+            visualizations.push_back( Visualization(simfiles[i], meshfiles[i], shift_x[i], cache_frames) );
         }
     }
 
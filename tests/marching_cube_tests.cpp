@@ -0,0 +1,261 @@
+#include <catch.hpp>
+
+#include "marching_cube.hpp"
+#include "marching_cube_sphere.hpp"
+#include "marching_cube_fluid.hpp"
+#include "mesh_record.hpp"
+#include "sim_record.hpp"
+
+#include <cmath>
+#include <vector>
+#include <array>
+#include <map>
+#include <utility>
+#include <algorithm>
+
+using namespace Simulator;
+
+// number of times every directed edge is used by the triangles
+static std::map<std::pair<unsigned int, unsigned int>, int> directed_edges( const std::vector<unsigned int>& faces )
+{
+	std::map<std::pair<unsigned int, unsigned int>, int> edges;
+	for (size_t t=0; t+2<faces.size(); t+=3)
+		for (int e=0; e<3; ++e)
+			++edges[std::make_pair(faces[t+e], faces[t+(e+1)%3])];
+	return edges;
+}
+
+TEST_CASE( "Marching cubes reconstruct a closed sphere", "[MarchingCube]" ) {
+	const float unit_voxel_length = 0.1f;
+	marching_cube_sphere sphere(unit_voxel_length);
+	sphere.start_marching_cube();
+
+	std::vector<float> vertices;
+	std::vector<unsigned int> faces;
+	sphere.output_marching_vertices(vertices);
+	sphere.output_marching_indices(faces);
+
+	REQUIRE(vertices.size() > 0);
+	REQUIRE(faces.size() > 0);
+	REQUIRE(faces.size() % 3 == 0);
+
+	SECTION( "the vertices are on the sphere" ) {
+		for (size_t v=0; v<vertices.size(); v+=3)
+		{
+			float r = std::sqrt(vertices[v]*vertices[v] + vertices[v+1]*vertices[v+1] + vertices[v+2]*vertices[v+2]);
+			CHECK(std::abs(r - 1.0f) <= unit_voxel_length);
+		}
+	}
+
+	SECTION( "every edge is shared by two triangles with the same winding" ) {
+		// a closed surface wound the same way uses every edge once in each direction
+		auto edges = directed_edges(faces);
+		for (const auto& edge : edges)
+		{
+			CHECK(edge.second == 1);
+			auto reverse = edges.find(std::make_pair(edge.first.second, edge.first.first));
+			REQUIRE(reverse != edges.end());
+			CHECK(reverse->second == 1);
+		}
+	}
+
+	SECTION( "the triangles face outwards" ) {
+		// the signed volume is only positive if the triangles are counter clockwise seen from outside
+		double volume = 0.0;
+		for (size_t t=0; t<faces.size(); t+=3)
+		{
+			const float* a = &vertices[3*faces[t]];
+			const float* b = &vertices[3*faces[t+1]];
+			const float* c = &vertices[3*faces[t+2]];
+			volume += (a[0]*(b[1]*c[2] - b[2]*c[1]) - a[1]*(b[0]*c[2] - b[2]*c[0]) + a[2]*(b[0]*c[1] - b[1]*c[0])) / 6.0;
+		}
+		CHECK(volume == Approx(4.0 / 3.0 * M_PI).epsilon(0.05));
+	}
+}
+
+static SimulationRecord fluid_header( Real unit_particle_length )
+{
+	SimulationRecord header;
+	header.unit_particle_length = unit_particle_length;
+	header.eta = 1.2;
+	header.rest_density = 1000.0;
+	return header;
+}
+
+// a block of nx * ny * nz fluid particles at rest density with its lowest corner at (x, y, z)
+static void add_block( SimulationState& state, size_t nx, size_t ny, size_t nz, Real x, Real y, Real z, Real unit_particle_length )
+{
+	const Real mass = unit_particle_length * unit_particle_length * unit_particle_length * 1000.0;
+	for (size_t k=0; k<nz; ++k)
+		for (size_t j=0; j<ny; ++j)
+			for (size_t i=0; i<nx; ++i)
+				state.particles.push_back(mParticle(x + i*unit_particle_length, y + j*unit_particle_length, z + k*unit_particle_length, 0.0, 0.0, 0.0, 1000.0, mass));
+}
+
+// meshes the states one after the other like the workers of MarchingCubePipeline do
+static std::vector<mMeshData> mesh_states( const std::vector<SimulationState>& states, const SimulationRecord& header, float unit_voxel_length, bool sparse, bool anisotropic = false )
+{
+	marching_cube_fluid mesher(unit_voxel_length, 0.6, header);
+	mesher.set_sparse(sparse);
+	mesher.set_anisotropic(anisotropic);
+
+	std::vector<mMeshData> meshes(states.size());
+	for (size_t f=0; f<states.size(); ++f)
+	{
+		mesher.set_state(states[f]);
+		marching_cube_fluid::GridBounds grid = mesher.follow_grid(f == 0);
+		mesher.mesh_state(grid, f == 0);
+		mesher.output_mesh_data(meshes[f]);
+	}
+	return meshes;
+}
+
+static std::vector<std::array<float,3>> sorted_positions( const mMeshData& mesh )
+{
+	std::vector<std::array<float,3>> positions;
+	for (size_t v=0; v+5<mesh.vertices_and_normals.size(); v+=6)
+		positions.push_back({{ mesh.vertices_and_normals[v], mesh.vertices_and_normals[v+1], mesh.vertices_and_normals[v+2] }});
+	std::sort(positions.begin(), positions.end());
+	return positions;
+}
+
+TEST_CASE( "The sparse grid gives the mesh of the dense grid", "[MarchingCube]" ) {
+	const Real unit_particle_length = 0.05;
+	const float unit_voxel_length = 0.04f;
+	SimulationRecord header = fluid_header(unit_particle_length);
+
+	// a block, then the same block moved with a drop above it, so the second frame follows the grid of the first
+	std::vector<SimulationState> states(2);
+	add_block(states[0], 8, 6, 5, 0.0, 0.0, 0.0, unit_particle_length);
+	add_block(states[1], 8, 6, 5, 0.03, -0.02, 0.0, unit_particle_length);
+	add_block(states[1], 2, 2, 2, 0.15, 0.1, 0.6, unit_particle_length);
+
+	std::vector<mMeshData> dense = mesh_states(states, header, unit_voxel_length, false);
+	std::vector<mMeshData> sparse = mesh_states(states, header, unit_voxel_length, true);
+
+	for (size_t f=0; f<states.size(); ++f)
+	{
+		REQUIRE(dense[f].faces.size() > 0);
+		CHECK(sparse[f].faces.size() == dense[f].faces.size());
+		REQUIRE(sparse[f].vertices_and_normals.size() == dense[f].vertices_and_normals.size());
+
+		// the phi of the grid vertices only differs in the order of the sums
+		std::vector<std::array<float,3>> dense_positions = sorted_positions(dense[f]);
+		std::vector<std::array<float,3>> sparse_positions = sorted_positions(sparse[f]);
+		for (size_t v=0; v<dense_positions.size(); ++v)
+			for (int a=0; a<3; ++a)
+				CHECK(sparse_positions[v][a] == Approx(dense_positions[v][a]).margin(1e-5));
+	}
+}
+
+// gives the tests the anisotropic kernels of marching_cube_fluid
+class anisotropic_fluid : public marching_cube_fluid
+{
+public:
+	anisotropic_fluid( float unit_length, Real c, const SimulationRecord& header ) : marching_cube_fluid(unit_length, c, header) {}
+
+	// the kernels of the particles of the state, with the neighbors splat_particles_phi gives them
+	void compute_kernels( const SimulationState& state )
+	{
+		set_state(state);
+		update_particle_positions();
+		ns.find_neighbors_within_radius(particle_neighbors, true);
+		compute_anisotropic_kernels();
+	}
+
+	using marching_cube_fluid::search_radius;
+	using marching_cube_fluid::anisotropic_max_ratio;
+	using marching_cube_fluid::anisotropic_min_neighbors;
+	using marching_cube_fluid::anisotropic_isolated_scale;
+	using marching_cube_fluid::kernel_matrices;
+	using marching_cube_fluid::kernel_determinants;
+	using marching_cube_fluid::kernel_radii;
+};
+
+TEST_CASE( "Anisotropic kernels", "[MarchingCube]" ) {
+	const Real unit_particle_length = 0.05;
+	const float unit_voxel_length = 0.04f;
+	SimulationRecord header = fluid_header(unit_particle_length);
+
+	SECTION( "the kernels keep their volume and are clamped" ) {
+		const size_t n = 10;
+		SimulationState state;
+		add_block(state, n, n, n, 0.0, 0.0, 0.0, unit_particle_length);
+		// far away from the block and from each other
+		state.particles.push_back(mParticle(2.0, 2.0, 2.0, 0.0, 0.0, 0.0, 1000.0, state.particles[0].mass));
+		state.particles.push_back(mParticle(2.5, 2.0, 2.0, 0.0, 0.0, 0.0, 1000.0, state.particles[0].mass));
+
+		anisotropic_fluid fluid(unit_voxel_length, 0.6, header);
+		fluid.anisotropic_isolated_scale = 0.5;
+		fluid.compute_kernels(state);
+		REQUIRE(fluid.kernel_radii.size() == state.particles.size());
+
+		const Real k_n = fluid.anisotropic_isolated_scale;
+		const Real largest_radius = fluid.search_radius * std::pow(fluid.anisotropic_max_ratio, 2.0 / 3.0);
+
+		// the neighborhood of the particles at least search_radius within the block is complete
+		const size_t first = static_cast<size_t>(std::ceil(fluid.search_radius / unit_particle_length));
+		REQUIRE(first < n / 2);
+		for (size_t k=first; k<n-first; ++k)
+			for (size_t j=first; j<n-first; ++j)
+				for (size_t i=first; i<n-first; ++i)
+				{
+					size_t p = i + n*(j + n*k);
+					CHECK(fluid.kernel_determinants[p] == 1.0);
+					CHECK(fluid.kernel_radii[p] <= largest_radius * (1.0 + 1e-12));
+				}
+
+		// at the corners and edges of the block the kernels are stretched the most
+		for (size_t p=0; p<n*n*n; ++p)
+			if (fluid.kernel_determinants[p] == 1.0)
+				CHECK(fluid.kernel_radii[p] <= largest_radius * (1.0 + 1e-12));
+
+		// fewer neighbors than anisotropic_min_neighbors
+		for (size_t p=n*n*n; p<state.particles.size(); ++p)
+		{
+			CHECK(fluid.kernel_matrices[p].isApprox(RealMatrix3::Identity() / k_n));
+			CHECK(fluid.kernel_determinants[p] == Approx(1.0 / (k_n*k_n*k_n)));
+			CHECK(fluid.kernel_radii[p] == Approx(fluid.search_radius * k_n));
+		}
+	}
+
+	SECTION( "the mesh of a flat slab stays flat" ) {
+		const size_t n = 16;
+		const size_t layers = 3;
+		std::vector<SimulationState> states(1);
+		add_block(states[0], n, n, layers, 0.0, 0.0, 0.0, unit_particle_length);
+
+		mMeshData mesh = mesh_states(states, header, unit_voxel_length, true, true)[0];
+		REQUIRE(mesh.faces.size() > 0);
+
+		// only the vertices away from the sides of the slab, its top and bottom are planes
+		const Real search_radius = header.unit_particle_length * header.eta * 2;
+		const Real lowest = 2.0 * search_radius;
+		const Real highest = (n - 1) * unit_particle_length - 2.0 * search_radius;
+		const Real middle = 0.5 * (layers - 1) * unit_particle_length;
+		float top_min = 1e10f, top_max = -1e10f, bottom_min = 1e10f, bottom_max = -1e10f;
+		size_t checked = 0;
+		for (size_t v=0; v+5<mesh.vertices_and_normals.size(); v+=6)
+		{
+			const float* vertex = &mesh.vertices_and_normals[v];
+			if (vertex[0] < lowest || vertex[0] > highest || vertex[1] < lowest || vertex[1] > highest)
+				continue;
+			++checked;
+			if (vertex[2] > middle)
+			{
+				top_min = std::min(top_min, vertex[2]);
+				top_max = std::max(top_max, vertex[2]);
+			}
+			else
+			{
+				bottom_min = std::min(bottom_min, vertex[2]);
+				bottom_max = std::max(bottom_max, vertex[2]);
+			}
+			CHECK(std::abs(vertex[5]) > 0.99f);
+		}
+		REQUIRE(checked > 0);
+		INFO("top " << top_min << " " << top_max << " bottom " << bottom_min << " " << bottom_max);
+		CHECK(top_max - top_min < 0.05f * unit_voxel_length);
+		CHECK(bottom_max - bottom_min < 0.05f * unit_voxel_length);
+	}
+}
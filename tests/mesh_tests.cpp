@@ -0,0 +1,274 @@
+#include <catch.hpp>
+
+#include "mesh_decimation.hpp"
+#include "mesh_codec.hpp"
+#include "mesh_record_writer.hpp"
+#include "mesh_record_reader.hpp"
+
+#include <cereal/archives/binary.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+// n x n quads of two triangles on z = height(x, y), facing +z.
+// with separate_vertices every triangle gets its own three vertices, as if nothing was welded
+template <typename Height>
+static mMeshData grid_mesh( size_t n, Height height, bool separate_vertices )
+{
+	mMeshData mesh;
+	auto add_vertex = [&mesh, n, &height]( size_t i, size_t j ) {
+		float x = float(i) / n, y = float(j) / n;
+		float values[6] = { x, y, height(x, y), 0.0f, 0.0f, 1.0f };
+		mesh.vertices_and_normals.insert(mesh.vertices_and_normals.end(), values, values + 6);
+		return static_cast<unsigned int>(mesh.vertices_and_normals.size() / 6 - 1);
+	};
+
+	if (!separate_vertices)
+		for (size_t j=0; j<=n; ++j)
+			for (size_t i=0; i<=n; ++i)
+				add_vertex(i, j);
+
+	for (size_t j=0; j<n; ++j)
+	{
+		for (size_t i=0; i<n; ++i)
+		{
+			const size_t corners[2][3][2] = { { {i, j}, {i+1, j}, {i+1, j+1} }, { {i, j}, {i+1, j+1}, {i, j+1} } };
+			for (const auto& triangle : corners)
+				for (const auto& c : triangle)
+					mesh.faces.push_back(separate_vertices ? add_vertex(c[0], c[1]) : static_cast<unsigned int>(c[0] + c[1] * (n+1)));
+		}
+	}
+	return mesh;
+}
+
+static Vector3f position( const mMeshData& mesh, unsigned int v )
+{
+	return Vector3f(mesh.vertices_and_normals[6*v], mesh.vertices_and_normals[6*v+1], mesh.vertices_and_normals[6*v+2]);
+}
+
+static bool all_faces_up( const mMeshData& mesh )
+{
+	for (size_t f=0; f<mesh.faces.size(); f+=3)
+	{
+		Vector3f p0 = position(mesh, mesh.faces[f]), p1 = position(mesh, mesh.faces[f+1]), p2 = position(mesh, mesh.faces[f+2]);
+		if ((p1 - p0).cross(p2 - p0)[2] <= 0.0f)
+			return false;
+	}
+	return true;
+}
+
+TEST_CASE( "Welding merges the duplicated vertices of a mesh", "[Mesh]" ) {
+	const size_t n = 10;
+	mMeshData mesh = grid_mesh(n, [](float, float) { return 0.0f; }, true);
+	REQUIRE(mesh.vertices_and_normals.size() == 6 * 6 * n * n);
+
+	REQUIRE(weld_mesh_vertices(mesh, 1e-4f) == 0);
+	CHECK(mesh.vertices_and_normals.size() == 6 * (n+1) * (n+1));
+	CHECK(mesh.faces.size() == 6 * n * n);
+	CHECK(all_faces_up(mesh));
+
+	// a distance of more than a quad collapses some triangles
+	CHECK(weld_mesh_vertices(mesh, 0.15f) > 0);
+	CHECK(mesh.vertices_and_normals.size() < 6 * (n+1) * (n+1));
+	for (size_t f=0; f<mesh.faces.size(); f+=3)
+	{
+		CHECK(mesh.faces[f] != mesh.faces[f+1]);
+		CHECK(mesh.faces[f+1] != mesh.faces[f+2]);
+		CHECK(mesh.faces[f+2] != mesh.faces[f]);
+	}
+}
+
+TEST_CASE( "Decimation keeps the mesh within the error bound", "[Mesh]" ) {
+	const size_t n = 40;
+
+	SECTION( "a plane keeps its border only" ) {
+		mMeshData mesh = grid_mesh(n, [](float, float) { return 0.0f; }, false);
+		decimate_mesh(mesh, 1e-4f);
+
+		// the 4n vertices of the border are kept, nearly all vertices inside can go
+		// (the border has straight sides, some triangles need a vertex inside to not become degenerate)
+		size_t n_border = 0;
+		for (size_t v=0; v<mesh.vertices_and_normals.size() / 6; ++v)
+		{
+			Vector3f p = position(mesh, v);
+			CHECK(p[2] == 0.0f);
+			if (p[0] == 0.0f || p[0] == 1.0f || p[1] == 0.0f || p[1] == 1.0f)
+				++n_border;
+		}
+		CHECK(n_border == 4 * n);
+		CHECK(mesh.vertices_and_normals.size() / 6 < 4 * n + 4);
+		CHECK(mesh.faces.size() / 3 < 4 * n + 8);
+		CHECK(all_faces_up(mesh));
+	}
+
+	SECTION( "a curved surface moves less than the error" ) {
+		auto height = [](float x, float y) { return 0.1f * std::sin(3.0f * x) * std::cos(2.0f * y); };
+		const float max_error = 0.002f;
+
+		mMeshData mesh = grid_mesh(n, height, false);
+		const size_t n_faces = mesh.faces.size() / 3;
+		decimate_mesh(mesh, max_error);
+
+		CHECK(mesh.faces.size() / 3 < n_faces / 2);
+		CHECK(all_faces_up(mesh));
+		// the vertices stay within the error of the planes of the faces they replace, a bit more than that from the
+		// surface as the faces are only a piecewise linear approximation of it
+		for (size_t v=0; v<mesh.vertices_and_normals.size() / 6; ++v)
+		{
+			Vector3f p = position(mesh, v);
+			CHECK(std::abs(p[2] - height(p[0], p[1])) < 1.5f * max_error);
+		}
+	}
+
+	SECTION( "no error bound does nothing" ) {
+		mMeshData mesh = grid_mesh(n, [](float, float) { return 0.0f; }, false);
+		mMeshData original = mesh;
+		CHECK(decimate_mesh(mesh, 0.0f) == 0);
+		CHECK(mesh.faces == original.faces);
+		CHECK(mesh.vertices_and_normals == original.vertices_and_normals);
+	}
+}
+
+// a bumpy grid with normals in every direction, in the grid box the marching cubes would use
+static mMeshData curved_mesh( size_t n, float shift )
+{
+	mMeshData mesh = grid_mesh(n, [shift](float x, float y) { return 0.3f * std::sin(5.0f * x + shift) * std::cos(4.0f * y); }, false);
+	for (size_t v=0; v<mesh.vertices_and_normals.size() / 6; ++v)
+	{
+		float* p = &mesh.vertices_and_normals[6*v];
+		Vector3f normal = Vector3f(std::sin(7.0f * p[0]), std::cos(3.0f * p[1]), std::sin(11.0f * p[0] * p[1] - 0.5f)).normalized();
+		p[3] = normal[0]; p[4] = normal[1]; p[5] = normal[2];
+	}
+	mesh.origin = Vector3f(0.5f, 0.5f, -0.3f);
+	mesh.bounding_box = Vector3f(1.0f, 1.0f, 0.6f);
+	return mesh;
+}
+
+TEST_CASE( "Quantized meshes keep their faces and stay close to the original", "[Mesh]" ) {
+	mMeshData mesh = curved_mesh(30, 0.0f);
+	// decimated vertices can leave the grid box a bit
+	mesh.vertices_and_normals[2] = -0.35f;
+
+	std::stringstream ss;
+	{
+		cereal::BinaryOutputArchive output(ss);
+		encode_mesh(output, mesh, QUANTIZED_MESH_CODEC);
+	}
+	size_t bytes = ss.str().size();
+	CHECK(5 * bytes < 2 * (4 * mesh.vertices_and_normals.size() + 4 * mesh.faces.size()));
+
+	mMeshData decoded;
+	{
+		cereal::BinaryInputArchive input(ss);
+		decode_mesh(input, decoded);
+	}
+
+	CHECK(decoded.faces == mesh.faces);
+	CHECK(decoded.origin == mesh.origin);
+	CHECK(decoded.bounding_box == mesh.bounding_box);
+	REQUIRE(decoded.vertices_and_normals.size() == mesh.vertices_and_normals.size());
+	for (size_t v=0; v<mesh.vertices_and_normals.size() / 6; ++v)
+	{
+		const float* a = &mesh.vertices_and_normals[6*v];
+		const float* b = &decoded.vertices_and_normals[6*v];
+		for (int k=0; k<3; ++k)
+			CHECK(std::abs(a[k] - b[k]) <= 1.0f / 65535.0f);
+		Vector3f na(a[3], a[4], a[5]), nb(b[3], b[4], b[5]);
+		CHECK(std::abs(nb.norm() - 1.0f) < 1e-5f);
+		CHECK(na.dot(nb) > 0.0f);
+		CHECK(na.cross(nb).norm() < std::sin(0.01f * M_PI / 180.0f));
+	}
+}
+
+TEST_CASE( "Mesh files are read frame by frame", "[Mesh]" ) {
+	mMeshSeries series;
+	series.unit_voxel_length = 0.05f;
+	series.c = 0.6f;
+	for (int i=0; i<4; ++i)
+		series.meshSeries.push_back(curved_mesh(10 + i, 0.5f * i));
+	series.meshSeries.push_back(mMeshData()); // a frame without fluid
+
+	const std::string file_path = "mesh_tests_record.bin";
+
+	SECTION( "raw frames come back unchanged" ) {
+		REQUIRE(write_mesh_record(file_path, series, RAW_MESH_CODEC));
+
+		MeshRecordReader reader;
+		REQUIRE(reader.open(file_path));
+		CHECK(reader.number_of_frames() == series.meshSeries.size());
+		CHECK(reader.unit_voxel_length() == series.unit_voxel_length);
+		CHECK(reader.c() == series.c);
+
+		// in any order
+		for (size_t i : { 3, 0, 4, 1, 2 })
+		{
+			mMeshData mesh;
+			reader.read_frame(i, mesh);
+			CHECK(mesh.vertices_and_normals == series.meshSeries[i].vertices_and_normals);
+			CHECK(mesh.faces == series.meshSeries[i].faces);
+		}
+	}
+
+	SECTION( "quantized frames" ) {
+		REQUIRE(write_mesh_record(file_path, series, QUANTIZED_MESH_CODEC));
+
+		MeshRecordReader reader;
+		REQUIRE(reader.open(file_path));
+		REQUIRE(reader.number_of_frames() == series.meshSeries.size());
+		for (size_t i=0; i<series.meshSeries.size(); ++i)
+		{
+			mMeshData mesh;
+			reader.read_frame(i, mesh);
+			CHECK(mesh.faces == series.meshSeries[i].faces);
+			CHECK(mesh.vertices_and_normals.size() == series.meshSeries[i].vertices_and_normals.size());
+		}
+	}
+
+	SECTION( "a damaged index is rejected" ) {
+		REQUIRE(write_mesh_record(file_path, series, QUANTIZED_MESH_CODEC));
+
+		// the offsets are the last thing in the index, right before offset, count and magic of the trailer
+		uint64_t file_size, last_offset;
+		{
+			std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+			file_size = static_cast<uint64_t>(file.tellg());
+			file.seekg(static_cast<std::streamoff>(file_size - 32));
+			file.read(reinterpret_cast<char*>(&last_offset), sizeof(last_offset));
+		}
+		auto patch = [&file_path]( uint64_t position, uint64_t value ) {
+			std::fstream file(file_path, std::ios::binary | std::ios::in | std::ios::out);
+			file.seekp(static_cast<std::streamoff>(position));
+			file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+		};
+		MeshRecordReader reader;
+
+		patch(file_size - 32, file_size + 100);
+		REQUIRE_FALSE(reader.open(file_path));
+
+		// an offset inside the file, but the size of the frame there reaches past its end
+		patch(file_size - 32, last_offset);
+		REQUIRE(reader.open(file_path));
+		patch(last_offset, file_size);
+		REQUIRE_FALSE(reader.open(file_path));
+	}
+
+	SECTION( "old files are still read" ) {
+		{
+			std::ofstream file(file_path, std::ios::binary);
+			cereal::BinaryOutputArchive output(file);
+			output(series);
+		}
+
+		MeshRecordReader reader;
+		REQUIRE(reader.open(file_path));
+		CHECK(reader.number_of_frames() == series.meshSeries.size());
+		CHECK(reader.c() == series.c);
+		mMeshData mesh;
+		reader.read_frame(2, mesh);
+		CHECK(mesh.vertices_and_normals == series.meshSeries[2].vertices_and_normals);
+	}
+
+	std::remove(file_path.c_str());
+}
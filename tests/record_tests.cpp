@@ -0,0 +1,422 @@
+#include <catch.hpp>
+
+#include "record_codec.hpp"
+#include "sim_record.hpp"
+#include "sim_record_writer.hpp"
+#include "sim_record_reader.hpp"
+#include "math_types.hpp"
+#include "frame_cache.hpp"
+
+#include <cereal/archives/binary.hpp>
+
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <random>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <chrono>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace Simulator;
+
+static SimulationState random_state( size_t n, Real extent )
+{
+	std::mt19937 gen(42);
+	std::uniform_real_distribution<Real> position(0.0, extent);
+	std::uniform_real_distribution<Real> velocity(-3.0, 3.0);
+	std::uniform_real_distribution<Real> density(800.0, 1200.0);
+
+	SimulationState state;
+	for (size_t i=0; i<n; ++i)
+		state.particles.push_back(mParticle(position(gen), position(gen), position(gen), velocity(gen), velocity(gen), velocity(gen), density(gen), 0.001));
+	for (size_t i=0; i<10; ++i)
+		state.moving_boundary_particles.push_back(mParticle(position(gen), position(gen), position(gen), 0.0, 0.0, 0.0, 1000.0, 0.0005 + 0.0001 * i));
+	return state;
+}
+
+static SimulationState round_trip( const SimulationState& state, RecordCodec codec, Real max_position_error, size_t& bytes )
+{
+	QuantizationSettings settings;
+	settings.max_position_error = max_position_error;
+
+	DeltaHistory history;
+	std::stringstream ss;
+	{
+		cereal::BinaryOutputArchive output(ss);
+		encode_state(output, state, codec, settings, history);
+	}
+	bytes = ss.str().size();
+
+	SimulationState decoded;
+	cereal::BinaryInputArchive input(ss);
+	decode_state(input, decoded, history);
+	return decoded;
+}
+
+static Real max_position_error( const SimulationState& a, const SimulationState& b )
+{
+	Real error = 0.0;
+	for (size_t i=0; i<a.particles.size(); ++i)
+		error = std::max(error, (a.particles[i].position - b.particles[i].position).norm());
+	return error;
+}
+
+TEST_CASE( "Recorded states are encoded", "[Record Codec]" ) {
+
+	SimulationState state = random_state(1000, 4.0);
+
+	SECTION( "raw states are stored exactly" ) {
+		size_t bytes;
+		SimulationState decoded = round_trip(state, RAW_CODEC, 0.0, bytes);
+
+		REQUIRE( decoded.particles.size() == state.particles.size() );
+		REQUIRE( max_position_error(state, decoded) == 0.0 );
+		REQUIRE( decoded.moving_boundary_particles[3].mass == state.moving_boundary_particles[3].mass );
+	}
+
+	SECTION( "quantized states keep the error bound" ) {
+		for (Real bound : {0.001, 0.00001})
+		{
+			size_t raw_bytes, bytes;
+			round_trip(state, RAW_CODEC, 0.0, raw_bytes);
+			SimulationState decoded = round_trip(state, QUANTIZED_CODEC, bound, bytes);
+
+			REQUIRE( decoded.particles.size() == state.particles.size() );
+			REQUIRE( max_position_error(state, decoded) <= bound );
+			REQUIRE( bytes * 2 <= raw_bytes );
+
+			for (size_t i=0; i<state.particles.size(); ++i)
+			{
+				REQUIRE( (decoded.particles[i].velocity - state.particles[i].velocity).norm() <= 0.001 * state.particles[i].velocity.norm() + 1e-6 );
+				REQUIRE( std::abs(decoded.particles[i].density - state.particles[i].density) <= 0.01 );
+				REQUIRE( decoded.particles[i].mass == state.particles[i].mass );
+			}
+			for (size_t i=0; i<state.moving_boundary_particles.size(); ++i)
+				REQUIRE( decoded.moving_boundary_particles[i].mass == state.moving_boundary_particles[i].mass );
+		}
+	}
+
+	SECTION( "states that cannot keep the bound are stored raw" ) {
+		size_t bytes;
+		SimulationState decoded = round_trip(state, QUANTIZED_CODEC, 1e-9, bytes);
+
+		REQUIRE( max_position_error(state, decoded) == 0.0 );
+	}
+}
+
+TEST_CASE( "Consecutive states are encoded as deltas", "[Record Codec]" ) {
+
+	QuantizationSettings settings;
+	settings.max_position_error = 0.0001;
+	settings.keyframe_interval = 4;
+
+	SimulationState state = random_state(1000, 4.0);
+	DeltaHistory write_history, read_history;
+
+	std::vector<size_t> sizes;
+	std::vector<uint8_t> codecs;
+	for (int frame=0; frame<7; ++frame)
+	{
+		std::stringstream ss;
+		{
+			cereal::BinaryOutputArchive output(ss);
+			encode_state(output, state, DELTA_CODEC, settings, write_history);
+		}
+		sizes.push_back(ss.str().size());
+		codecs.push_back(static_cast<uint8_t>(ss.str()[0]));
+
+		SimulationState decoded;
+		cereal::BinaryInputArchive input(ss);
+		decode_state(input, decoded, read_history);
+
+		// the error does not grow from one delta to the next
+		REQUIRE( max_position_error(state, decoded) <= settings.max_position_error );
+		for (size_t i=0; i<state.particles.size(); ++i)
+		{
+			REQUIRE( (decoded.particles[i].velocity - state.particles[i].velocity).norm() <= settings.max_velocity_error );
+			REQUIRE( std::abs(decoded.particles[i].density - state.particles[i].density) <= settings.max_density_error );
+			REQUIRE( decoded.particles[i].mass == state.particles[i].mass );
+		}
+
+		for (auto& p : state.particles)
+		{
+			p.position += 0.001 * p.velocity;
+			p.velocity[1] -= 0.01;
+		}
+	}
+
+	REQUIRE( codecs[0] == DELTA_KEYFRAME_CODEC );
+	REQUIRE( codecs[1] == DELTA_CODEC );
+	REQUIRE( codecs[4] == DELTA_KEYFRAME_CODEC );
+	REQUIRE( sizes[1] * 2 < sizes[0] );
+
+	SECTION( "a delta state needs the state before it" ) {
+		DeltaHistory empty_history;
+		std::stringstream ss;
+		{
+			cereal::BinaryOutputArchive output(ss);
+			encode_state(output, state, DELTA_CODEC, settings, write_history);
+		}
+		SimulationState decoded;
+		cereal::BinaryInputArchive input(ss);
+		REQUIRE_THROWS( decode_state(input, decoded, empty_history) );
+	}
+
+	SECTION( "a changed mass starts a new keyframe" ) {
+		state.particles[7].mass *= 2.0;
+		std::stringstream ss;
+		{
+			cereal::BinaryOutputArchive output(ss);
+			encode_state(output, state, DELTA_CODEC, settings, write_history);
+		}
+		REQUIRE( static_cast<uint8_t>(ss.str()[0]) == DELTA_KEYFRAME_CODEC );
+	}
+}
+
+// the states 0..n-1 of a record, every one moved a bit from the one before
+static std::vector<SimulationState> moving_states( size_t n, Real speed )
+{
+	std::vector<SimulationState> states;
+	SimulationState state = random_state(500, 4.0);
+	for (size_t k=0; k<n; ++k)
+	{
+		states.push_back(state);
+		for (auto& p : state.particles)
+		{
+			p.position += speed * p.velocity;
+			p.velocity[1] -= 0.01;
+		}
+	}
+	return states;
+}
+
+static void write_record( const std::string& file_path, const std::vector<SimulationState>& states, const QuantizationSettings& settings )
+{
+	SimulationRecordWriter writer;
+	REQUIRE( writer.open(file_path, SimulationRecord()) );
+	writer.set_codec(DELTA_CODEC, settings);
+	for (const SimulationState& state : states)
+		writer.write_state(state, std::vector<bool>());
+	writer.close();
+}
+
+static std::vector<SimulationState> read_record( const std::string& file_path )
+{
+	SimulationRecordReader reader;
+	REQUIRE( reader.open(file_path) );
+	std::vector<SimulationState> states(reader.number_of_states());
+	for (size_t i=0; i<states.size(); ++i)
+		reader.read_state(i, states[i]);
+	return states;
+}
+
+static bool same_positions( const SimulationState& a, const SimulationState& b )
+{
+	if (a.particles.size() != b.particles.size())
+		return false;
+	for (size_t i=0; i<a.particles.size(); ++i)
+	{
+		if (a.particles[i].position != b.particles[i].position)
+			return false;
+	}
+	return true;
+}
+
+// reads or overwrites 8 bytes of a file, counted from its end
+static uint64_t uint64_from_end( const std::string& file_path, std::streamoff from_end )
+{
+	std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+	file.seekg(static_cast<std::streamoff>(file.tellg()) - from_end);
+	uint64_t value = 0;
+	file.read(reinterpret_cast<char*>(&value), sizeof(value));
+	return value;
+}
+
+static void patch_uint64( const std::string& file_path, std::streamoff position, uint64_t value )
+{
+	std::fstream file(file_path, std::ios::binary | std::ios::in | std::ios::out);
+	file.seekp(position);
+	file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+TEST_CASE( "Records are written and read back", "[Record File]" ) {
+
+	const std::string file_path = "record_tests_record.bin";
+
+	QuantizationSettings settings;
+	settings.max_position_error = 0.0001;
+	settings.keyframe_interval = 4;
+
+	std::vector<SimulationState> states = moving_states(10, 0.001);
+	write_record(file_path, states, settings);
+
+	// read in order, every delta state only needs the one before
+	std::vector<SimulationState> in_order = read_record(file_path);
+	REQUIRE( in_order.size() == states.size() );
+	for (size_t i=0; i<states.size(); ++i)
+		REQUIRE( max_position_error(states[i], in_order[i]) <= settings.max_position_error );
+
+	SECTION( "delta states are read in any order" ) {
+		SimulationRecordReader reader;
+		REQUIRE( reader.open(file_path) );
+
+		// backwards, across keyframes (0, 4, 8), twice the same and the one after it
+		SimulationState state;
+		for (size_t i : {9, 2, 3, 7, 0, 5, 5, 6, 1, 8, 4, 9})
+		{
+			reader.read_state(i, state);
+			REQUIRE( same_positions(state, in_order[i]) );
+		}
+	}
+
+	SECTION( "a record without index is read up to its last complete state" ) {
+		uint64_t index_offset = uint64_from_end(file_path, 24);
+
+		// the run was stopped before the index was written
+		REQUIRE( truncate(file_path.c_str(), static_cast<off_t>(index_offset)) == 0 );
+		std::vector<SimulationState> recovered = read_record(file_path);
+		REQUIRE( recovered.size() == states.size() );
+		for (size_t i=0; i<recovered.size(); ++i)
+			REQUIRE( same_positions(recovered[i], in_order[i]) );
+
+		// and in the middle of the last state, without the 0 in front of the index
+		REQUIRE( truncate(file_path.c_str(), static_cast<off_t>(index_offset) - 8 - 5) == 0 );
+		recovered = read_record(file_path);
+		REQUIRE( recovered.size() == states.size() - 1 );
+		for (size_t i=0; i<recovered.size(); ++i)
+			REQUIRE( same_positions(recovered[i], in_order[i]) );
+	}
+
+	SECTION( "a damaged index is rejected" ) {
+		// the offsets are the last thing in the index, right before offset, count and magic of the trailer
+		uint64_t file_size;
+		{
+			std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+			file_size = static_cast<uint64_t>(file.tellg());
+		}
+		uint64_t last_offset = uint64_from_end(file_path, 32);
+		SimulationRecordReader reader;
+
+		patch_uint64(file_path, file_size - 32, file_size + 100);
+		REQUIRE_FALSE( reader.open(file_path) );
+
+		// an offset inside the file, but the size of the state there reaches past its end
+		patch_uint64(file_path, file_size - 32, last_offset);
+		REQUIRE( reader.open(file_path) );
+		patch_uint64(file_path, last_offset, file_size);
+		REQUIRE_FALSE( reader.open(file_path) );
+	}
+
+	SECTION( "a resumed record is cut back to the checkpoint" ) {
+		std::vector<SimulationState> resumed_states = moving_states(3, -0.002);
+
+		SimulationRecordWriter writer;
+		REQUIRE_FALSE( writer.resume(file_path, SimulationRecord(), 20) );
+		REQUIRE( writer.resume(file_path, SimulationRecord(), 6) );
+		REQUIRE( writer.number_of_states() == 6 );
+		writer.set_codec(DELTA_CODEC, settings);
+		for (const SimulationState& state : resumed_states)
+			writer.write_state(state, std::vector<bool>());
+		writer.close();
+
+		std::vector<SimulationState> read = read_record(file_path);
+		REQUIRE( read.size() == 9 );
+		for (size_t i=0; i<6; ++i)
+			REQUIRE( same_positions(read[i], in_order[i]) );
+		// the states after the checkpoint were overwritten, the first one written after it is a keyframe
+		for (size_t i=0; i<3; ++i)
+			REQUIRE( max_position_error(resumed_states[i], read[6+i]) <= settings.max_position_error );
+	}
+
+	std::remove(file_path.c_str());
+}
+
+TEST_CASE( "Frames are cached and read ahead", "[Frame Cache]" ) {
+	std::mutex mutex;
+	std::vector<size_t> loads;
+	auto loader = [&mutex, &loads]( size_t i ) {
+		std::lock_guard<std::mutex> lock(mutex);
+		loads.push_back(i);
+		return std::make_shared<const size_t>(i * 10);
+	};
+	auto loaded = [&mutex, &loads]( size_t i ) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return std::count(loads.begin(), loads.end(), i);
+	};
+	auto wait_for = [&loaded]( size_t i ) {
+		for (int k=0; k<1000 && loaded(i) == 0; ++k)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	};
+
+	FrameCache<size_t> cache(100, 8, 4, loader);
+
+	REQUIRE( *cache.get(10, 0) == 100 );
+	REQUIRE( *cache.get(10, 0) == 100 );
+	REQUIRE( loaded(10) == 1 );
+
+	SECTION( "forward" ) {
+		cache.get(10, 2);
+		wait_for(18);
+		REQUIRE( loaded(12) == 1 );
+		REQUIRE( loaded(18) == 1 );
+		REQUIRE( loaded(20) == 0 ); // only 4 frames ahead
+		REQUIRE( loaded(11) == 0 );
+
+		// playing on, every frame is loaded once
+		for (size_t i=12; i<=30; i+=2)
+			REQUIRE( *cache.get(i, 2) == i * 10 );
+		for (size_t i=12; i<=30; i+=2)
+			REQUIRE( loaded(i) == 1 );
+	}
+
+	SECTION( "backward and at the ends" ) {
+		cache.get(2, -1);
+		wait_for(0);
+		REQUIRE( loaded(1) == 1 );
+		REQUIRE( loaded(0) == 1 );
+
+		REQUIRE( *cache.get(99, 1) == 990 );
+		REQUIRE_THROWS( cache.get(100, 1) );
+	}
+
+	SECTION( "the least recently used frames are dropped" ) {
+		for (size_t i=50; i<60; ++i)
+			cache.get(i, 0);
+		REQUIRE( *cache.get(10, 0) == 100 );
+		REQUIRE( loaded(10) == 2 );
+		REQUIRE( *cache.get(59, 0) == 590 );
+		REQUIRE( loaded(59) == 1 );
+	}
+}
+
+TEST_CASE( "A frame that fails to load does not stop the cache", "[Frame Cache]" ) {
+	std::mutex mutex;
+	int failures = 1;
+	auto loader = [&mutex, &failures]( size_t i ) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (i == 5 && failures > 0)
+		{
+			--failures;
+			throw "Broken frame!";
+		}
+		return std::make_shared<const size_t>(i * 10);
+	};
+
+	FrameCache<size_t> cache(20, 8, 4, loader);
+
+	// 5 fails while it is read ahead, only its own get throws
+	REQUIRE( *cache.get(3, 1) == 30 );
+	REQUIRE( *cache.get(4, 1) == 40 );
+	REQUIRE_THROWS( cache.get(5, 1) );
+	REQUIRE( *cache.get(6, 1) == 60 );
+	REQUIRE( *cache.get(7, 1) == 70 );
+
+	// the error was passed on, the next get loads it again
+	REQUIRE( *cache.get(5, 1) == 50 );
+}